@@ -0,0 +1,71 @@
+// SlidingBuffer Feed/Consume patterns of the receive path
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "../include/SlidingBuffer.hpp"
+
+namespace {
+
+// feed a chunk, consume all of it: the common case of whole frames per read
+void BM_SlidingBufferFeedConsumeAll(benchmark::State &state) {
+    auto                   chunk = static_cast<size_t>(state.range(0));
+    std::vector<uint8_t>   data(chunk, 'x');
+    wsocket::SlidingBuffer buffer(chunk * 2);
+
+    for(auto _ : state) {
+        buffer.Feed({data.data(), data.size()});
+        buffer.Consume(buffer.GetDataLen());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk));
+}
+BENCHMARK(BM_SlidingBufferFeedConsumeAll)->Range(64, 64 * 1024);
+
+// feed a chunk, consume a frame-sized prefix at a time: every Consume moves the remainder
+void BM_SlidingBufferFeedConsumePartial(benchmark::State &state) {
+    auto                   chunk = static_cast<size_t>(state.range(0));
+    auto                   frame = static_cast<size_t>(state.range(1));
+    std::vector<uint8_t>   data(chunk, 'x');
+    wsocket::SlidingBuffer buffer(chunk * 2);
+
+    for(auto _ : state) {
+        buffer.Feed({data.data(), data.size()});
+        while(buffer.GetDataLen() >= frame) {
+            buffer.Consume(frame);
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk));
+}
+BENCHMARK(BM_SlidingBufferFeedConsumePartial)->Args({8 * 1024, 64})->Args({8 * 1024, 1024})->Args({64 * 1024, 1024});
+
+// write into PrepareWrite()/CommitWrite() as a socket read does
+void BM_SlidingBufferPrepareCommit(benchmark::State &state) {
+    auto                   chunk = static_cast<size_t>(state.range(0));
+    std::vector<uint8_t>   data(chunk, 'x');
+    wsocket::SlidingBuffer buffer(chunk);
+
+    for(auto _ : state) {
+        auto dst = buffer.PrepareWrite();
+        std::memcpy(dst.buf, data.data(), chunk);
+        buffer.CommitWrite(chunk);
+        buffer.Consume(chunk);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk));
+}
+BENCHMARK(BM_SlidingBufferPrepareCommit)->Range(64, 64 * 1024);
+
+// Feed beyond capacity, the buffer grows once and is reused afterwards
+void BM_SlidingBufferGrow(benchmark::State &state) {
+    auto                 chunk = static_cast<size_t>(state.range(0));
+    std::vector<uint8_t> data(chunk, 'x');
+
+    for(auto _ : state) {
+        wsocket::SlidingBuffer buffer(1024);
+        buffer.Feed({data.data(), data.size()});
+        benchmark::DoNotOptimize(buffer.GetData().buf);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * chunk));
+}
+BENCHMARK(BM_SlidingBufferGrow)->Range(4 * 1024, 1024 * 1024);
+
+} // namespace
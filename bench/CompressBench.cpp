@@ -0,0 +1,77 @@
+// ZstdContext compress/decompress by level and message size
+#include <benchmark/benchmark.h>
+
+#ifdef WITH_ZSTD
+
+#include <string>
+
+#include "../include/WSocketContext.hpp"
+#include "../include/compress/Zstd.hpp"
+
+namespace {
+
+// json-like text, compresses roughly as well as typical application messages
+std::string MakeMessage(size_t size) {
+    std::string message;
+    size_t      i = 0;
+    while(message.size() < size) {
+        message += "{\"id\":" + std::to_string(i * 7919 % 100003) + ",\"name\":\"user" + std::to_string(i % 97) +
+                   "\",\"active\":" + (i % 3 ? "true" : "false") + "},";
+        ++i;
+    }
+    message.resize(size);
+    return message;
+}
+
+wsocket::Buffer ToBuffer(std::string &s) { return {reinterpret_cast<uint8_t *>(s.data()), s.size()}; }
+
+void BM_ZstdCompress(benchmark::State &state) {
+    auto message = MakeMessage(state.range(1));
+
+    wsocket::ZstdContext ctx;
+    ctx.Open();
+    ctx.CompressionLevel(static_cast<int>(state.range(0)));
+
+    size_t compressed = 0;
+    for(auto _ : state) {
+        auto out   = ctx.Compress(ToBuffer(message));
+        compressed = out.size;
+        benchmark::DoNotOptimize(out.buf);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * message.size()));
+    state.counters["ratio"] = static_cast<double>(message.size()) / static_cast<double>(compressed);
+}
+
+void BM_ZstdDecompress(benchmark::State &state) {
+    auto message = MakeMessage(state.range(1));
+
+    wsocket::ZstdContext ctx;
+    ctx.Open();
+    ctx.CompressionLevel(static_cast<int>(state.range(0)));
+    auto        out = ctx.Compress(ToBuffer(message));
+    std::string compressed(reinterpret_cast<char *>(out.buf), out.size);
+
+    for(auto _ : state) {
+        auto plain = ctx.Decompress(ToBuffer(compressed));
+        benchmark::DoNotOptimize(plain.buf);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * message.size()));
+}
+
+void ZstdArgs(benchmark::internal::Benchmark *b) {
+    b->ArgNames({"level", "size"});
+    for(int level : {1, 3, 9, 19}) {
+        for(int size : {256, 4 * 1024, 64 * 1024, 1024 * 1024}) {
+            if(level >= 19 && size > 64 * 1024) {
+                continue; // about a second per iteration
+            }
+            b->Args({level, size});
+        }
+    }
+}
+BENCHMARK(BM_ZstdCompress)->Apply(ZstdArgs);
+BENCHMARK(BM_ZstdDecompress)->Apply(ZstdArgs);
+
+} // namespace
+
+#endif // WITH_ZSTD
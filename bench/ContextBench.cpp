@@ -0,0 +1,76 @@
+// WSocketContext end to end over an in-memory LoopbackPipe, and text validation cost
+#include <benchmark/benchmark.h>
+
+#include <string>
+
+#include "../include/LoopbackPipe.hpp"
+
+namespace {
+
+class CountingClient final {
+public:
+    void                  OnError(std::error_code code) {}
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) {
+        return wsocket::CompressType::None;
+    }
+    void OnClose(int16_t code, const std::string &reason) {}
+    void OnPing() {}
+    void OnPong() {}
+    void OnText(std::string_view text, bool finish) { bytes += text.size(); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) { bytes += buffer.size; }
+
+    size_t bytes = 0;
+};
+
+using Context = wsocket::BasicWSocketContext<CountingClient>;
+using Pipe    = wsocket::BasicLoopbackPipe<Context>;
+
+template <bool IsText>
+void BM_ContextRoundTrip(benchmark::State &state) {
+    auto           size = static_cast<size_t>(state.range(0));
+    std::string    message(size, 'x');
+    Context        ctx1, ctx2;
+    CountingClient client1, client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+
+    Pipe pipe(ctx1, ctx2);
+    ctx1.Handshake();
+    pipe.Run();
+
+    for(auto _ : state) {
+        // a burst of messages per iteration so the pipe drains in batches
+        for(int i = 0; i < 64; ++i) {
+            if constexpr(IsText) {
+                ctx1.SendText(message);
+            } else {
+                ctx1.SendBinary({reinterpret_cast<uint8_t *>(message.data()), message.size()});
+            }
+        }
+        pipe.Run();
+    }
+    state.SetItemsProcessed(state.iterations() * 64);
+    state.SetBytesProcessed(static_cast<int64_t>(client2.bytes));
+}
+BENCHMARK_TEMPLATE(BM_ContextRoundTrip, true)->Arg(16)->Arg(256)->Arg(4 * 1024)->Arg(64 * 1024);
+BENCHMARK_TEMPLATE(BM_ContextRoundTrip, false)->Arg(16)->Arg(256)->Arg(4 * 1024)->Arg(64 * 1024);
+
+template <bool Simd>
+void BM_Utf8Validate(benchmark::State &state) {
+    std::string text;
+    while(text.size() < static_cast<size_t>(state.range(1))) {
+        // range(0): 0 ascii, 1 mixed
+        text += state.range(0) ? "h\xc3\xa9llo \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80 " : "hello world ";
+    }
+    auto data = reinterpret_cast<const uint8_t *>(text.data());
+    for(auto _ : state) {
+        bool ok = Simd ? wsocket::Utf8Validator::Validate(data, text.size())
+                       : wsocket::Utf8Validator::ValidateScalar(data, text.size());
+        benchmark::DoNotOptimize(ok);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * text.size()));
+}
+BENCHMARK_TEMPLATE(BM_Utf8Validate, false)->ArgNames({"mixed", "size"})->Args({0, 64 * 1024})->Args({1, 64 * 1024});
+BENCHMARK_TEMPLATE(BM_Utf8Validate, true)->ArgNames({"mixed", "size"})->Args({0, 64 * 1024})->Args({1, 64 * 1024});
+
+} // namespace
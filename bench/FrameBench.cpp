@@ -0,0 +1,122 @@
+// Frame header encode/decode, parser and scanner throughput
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "../include/WSocketContext.hpp"
+
+namespace {
+
+struct CountingHandler {
+    void OnFrame(const wsocket::Frame &frame) {
+        ++frames;
+        bytes += frame.data.size;
+    }
+
+    size_t frames = 0;
+    size_t bytes  = 0;
+};
+
+std::vector<uint8_t> MakeStream(size_t payload, size_t count) {
+    std::vector<uint8_t> stream;
+    for(size_t i = 0; i < count; ++i) {
+        wsocket::FrameHeader header;
+        header.Finished(true);
+        header.Type(wsocket::FrameHeader::Binary);
+        header.Length(payload);
+
+        auto pos = stream.size();
+        stream.resize(pos + header.HeaderLength() + payload, 'x');
+        std::memcpy(&stream[pos], &header, header.HeaderLength());
+    }
+    return stream;
+}
+
+// payload lengths of the three length classes: 2, 4 and 10 byte headers
+constexpr int64_t SHORT_LEN  = 100;
+constexpr int64_t MIDDLE_LEN = 1000;
+constexpr int64_t LONG_LEN   = 100000;
+
+void BM_FrameHeaderEncode(benchmark::State &state) {
+    auto len = static_cast<uint64_t>(state.range(0));
+    for(auto _ : state) {
+        wsocket::FrameHeader header;
+        header.Finished(true);
+        header.Type(wsocket::FrameHeader::Binary);
+        header.Length(len);
+        benchmark::DoNotOptimize(header);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FrameHeaderEncode)->Arg(SHORT_LEN)->Arg(MIDDLE_LEN)->Arg(LONG_LEN);
+
+void BM_FrameHeaderDecode(benchmark::State &state) {
+    wsocket::FrameHeader header;
+    header.Finished(true);
+    header.Type(wsocket::FrameHeader::Binary);
+    header.Length(state.range(0));
+
+    for(auto _ : state) {
+        benchmark::DoNotOptimize(&header);
+        auto total = header.HeaderLength() + header.Length();
+        benchmark::DoNotOptimize(total);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FrameHeaderDecode)->Arg(SHORT_LEN)->Arg(MIDDLE_LEN)->Arg(LONG_LEN);
+
+// feed the stream in receive-sized chunks, as WSocketBase does
+template <typename Parse>
+void RunParser(benchmark::State &state, Parse &&parse) {
+    static constexpr size_t chunk = 8 * 1024;
+
+    auto payload = static_cast<size_t>(state.range(0));
+    auto stream  = MakeStream(payload, std::max<size_t>(1, (1 << 20) / (payload + 2)));
+
+    CountingHandler                            handler;
+    wsocket::BasicFrameParser<CountingHandler> parser(&handler);
+    parser.SetReceiveBufferSize(std::max(chunk * 2, payload + 16));
+
+    for(auto _ : state) {
+        for(size_t pos = 0; pos < stream.size(); pos += chunk) {
+            auto len = std::min(chunk, stream.size() - pos);
+            parser.Feed({const_cast<uint8_t *>(stream.data()) + pos, len});
+            parse(parser);
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(handler.frames));
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * stream.size()));
+}
+
+void BM_ParseOne(benchmark::State &state) {
+    RunParser(state, [](auto &parser) {
+        while(parser.ParseOne()) {
+        }
+    });
+}
+BENCHMARK(BM_ParseOne)->Arg(0)->Arg(16)->Arg(200)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+
+void BM_ParseAll(benchmark::State &state) {
+    RunParser(state, [](auto &parser) { parser.ParseAll([] { return true; }); });
+}
+BENCHMARK(BM_ParseAll)->Arg(0)->Arg(16)->Arg(200)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+
+template <bool Simd>
+void BM_FrameScan(benchmark::State &state) {
+    auto                             stream = MakeStream(state.range(0), 100 * 1000);
+    std::vector<wsocket::FrameIndex> index(stream.size() / 2);
+
+    for(auto _ : state) {
+        size_t scanned = 0;
+        auto   n       = Simd ? wsocket::FrameScanner::Scan(
+                                        stream.data(), stream.size(), index.data(), index.size(), &scanned)
+                              : wsocket::FrameScanner::ScanScalar(
+                                        stream.data(), stream.size(), index.data(), index.size(), &scanned);
+        benchmark::DoNotOptimize(n);
+    }
+    state.SetItemsProcessed(state.iterations() * 100 * 1000);
+}
+BENCHMARK_TEMPLATE(BM_FrameScan, false)->Arg(0)->Arg(4)->Arg(64);
+BENCHMARK_TEMPLATE(BM_FrameScan, true)->Arg(0)->Arg(4)->Arg(64);
+
+} // namespace
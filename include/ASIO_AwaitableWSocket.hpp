@@ -0,0 +1,260 @@
+#pragma once
+#ifndef WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
+#define WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
+
+#ifdef WITH_ASIO
+
+#include <asio.hpp>
+
+#ifdef ASIO_HAS_CO_AWAIT
+
+#include <deque>
+
+#include "ASIO_WSocket.hpp"
+
+namespace wsocket {
+
+/**
+ * Message handed out by AwaitableWSocketBase::Read()
+ *
+ * A message delivered to a reader that is already waiting on the socket's strand is borrowed: data
+ * points into the receive buffer and stays valid until the coroutine waits on anything other than
+ * Send() of the same socket. A message that arrived while nobody was reading is queued, and data
+ * points into storage owned by the message.
+ */
+struct Message {
+    FrameHeader::FrameType type = FrameHeader::Text;
+    Buffer                 data;
+    bool                   finish = true;
+    std::error_code        error; // set when the connection is closed or failed, data holds the close reason
+
+    std::shared_ptr<uint8_t[]> storage;
+
+    std::string_view Text() const { return {reinterpret_cast<const char *>(data.buf), data.size}; }
+    bool             Owned() const { return storage != nullptr; }
+};
+
+/**
+ * C++20 coroutine facade over WSocketBase
+ *
+ *   auto ws = AwaitableWSocket::Create(strand);
+ *   co_await ws->Handshake(endpoint);
+ *   auto msg = co_await ws->Read();
+ *   co_await ws->Send(msg.Text());
+ *
+ * Spawn the coroutine on ws->GetExecutor() so messages are delivered inline, without a copy.
+ * The listener callbacks are consumed by this class and are final.
+ */
+template <typename Protocol>
+class AwaitableWSocketBase : public WSocketBase<Protocol> {
+    using base_type     = WSocketBase<Protocol>;
+    using socket_type   = typename Protocol::socket;
+    using endpoint_type = typename Protocol::endpoint;
+
+    // single argument completion, so errors are returned instead of thrown
+    struct Completion {
+        std::error_code ec;
+    };
+
+protected:
+    explicit AwaitableWSocketBase(asio::any_io_executor io_executor) : base_type(std::move(io_executor)) {}
+    explicit AwaitableWSocketBase(socket_type &&socket) : base_type(std::move(socket)) {}
+
+public:
+    static std::shared_ptr<AwaitableWSocketBase> Create(asio::any_io_executor io_executor) {
+        return std::shared_ptr<AwaitableWSocketBase>(new AwaitableWSocketBase(std::move(io_executor)));
+    }
+    static std::shared_ptr<AwaitableWSocketBase> Create(socket_type &&socket) {
+        return std::shared_ptr<AwaitableWSocketBase>(new AwaitableWSocketBase(std::move(socket)));
+    }
+
+    // Connect and complete the WSocket handshake
+    // (initiations borrow `this`, the awaiting caller keeps the socket alive until they run)
+    asio::awaitable<std::error_code> Handshake(const endpoint_type &endpoint) {
+        auto res = co_await asio::async_initiate<decltype(asio::use_awaitable), void(Completion)>(
+                [this, endpoint](auto handler) {
+                    auto self   = Self();
+                    auto strand = self->GetExecutor();
+                    asio::dispatch(strand, [self, endpoint, h = Erase<Completion>(std::move(handler))]() mutable {
+                        self->handshake_handler_ = std::move(h);
+                        self->base_type::Handshake(endpoint);
+                    });
+                },
+                asio::use_awaitable);
+        co_return res.ec;
+    }
+
+    // Wait for the next Text or Binary message
+    asio::awaitable<Message> Read() {
+        return asio::async_initiate<decltype(asio::use_awaitable), void(Message)>(
+                [this](auto handler) {
+                    auto self      = Self();
+                    auto strand    = self->GetExecutor();
+                    bool in_strand = asio::get_associated_executor(handler, strand) == strand;
+                    asio::dispatch(strand, [self, in_strand, h = Erase<Message>(std::move(handler))]() mutable {
+                        self->StartRead(std::move(h), in_strand);
+                    });
+                },
+                asio::use_awaitable);
+    }
+
+    // Send a text/binary message, resumes once the frame is handed to the socket
+    asio::awaitable<std::error_code> Send(std::string_view text, bool finish = true) {
+        co_return co_await RunOnStrand([text, finish](base_type &ws) { ws.Text(text, finish); });
+    }
+    asio::awaitable<std::error_code> Send(Buffer buffer, bool finish = true) {
+        co_return co_await RunOnStrand([buffer, finish](base_type &ws) { ws.Binary(buffer, finish); });
+    }
+
+protected:
+    // Pick the compression for this connection, called during the handshake
+    virtual CompressType SelectCompressType(const std::vector<CompressType> &supported_compress_type) {
+        return CompressType::None;
+    }
+
+    //============ WSocketContext::Listener start ============//
+    void OnError(std::error_code code) final {
+        this->Fail(code, {});
+        if(handshake_handler_) {
+            std::exchange(handshake_handler_, nullptr)(Completion{code});
+        }
+    }
+    CompressType OnHandshake(const std::vector<CompressType> &supported_compress_type) final {
+        auto type = this->SelectCompressType(supported_compress_type);
+        if(handshake_handler_) {
+            // complete after the context switches to Connected
+            asio::post(this->GetExecutor(), [self = Self()] {
+                if(self->handshake_handler_) {
+                    std::exchange(self->handshake_handler_, nullptr)(Completion{});
+                }
+            });
+        }
+        return type;
+    }
+    void OnClose(int16_t code, const std::string &reason) final {
+        this->Fail(make_error_code(asio::error::eof), reason);
+    }
+    void OnText(std::string_view text, bool finish) final {
+        this->Deliver(FrameHeader::Text,
+                      {reinterpret_cast<uint8_t *>(const_cast<char *>(text.data())), text.size()},
+                      finish);
+    }
+    void OnBinary(Buffer buffer, bool finish) final { this->Deliver(FrameHeader::Binary, buffer, finish); }
+    //============ WSocketContext::Listener end ============//
+
+private:
+    std::shared_ptr<AwaitableWSocketBase> Self() {
+        return std::static_pointer_cast<AwaitableWSocketBase>(this->shared_from_this());
+    }
+
+    // Type-erase a completion handler, invoking it through its associated executor
+    template <typename Arg, typename Handler>
+    static std::function<void(Arg)> Erase(Handler &&handler) {
+        auto h = std::make_shared<std::decay_t<Handler>>(std::forward<Handler>(handler));
+        return [h](Arg arg) {
+            auto ex = asio::get_associated_executor(*h);
+            asio::dispatch(ex, [h, arg = std::move(arg)]() mutable { (*h)(std::move(arg)); });
+        };
+    }
+
+    template <typename F>
+    asio::awaitable<std::error_code> RunOnStrand(F f) {
+        auto res = co_await asio::async_initiate<decltype(asio::use_awaitable), void(Completion)>(
+                [this, f](auto handler) {
+                    auto self   = Self();
+                    auto strand = self->GetExecutor();
+                    asio::dispatch(strand, [self, f, h = Erase<Completion>(std::move(handler))]() mutable {
+                        if(self->error_) {
+                            h(Completion{self->error_});
+                            return;
+                        }
+                        // sends are written synchronously, returning here is the backpressure point
+                        f(*self);
+                        h(Completion{self->error_});
+                    });
+                },
+                asio::use_awaitable);
+        co_return res.ec;
+    }
+
+    void StartRead(std::function<void(Message)> handler, bool in_strand) {
+        assert(!read_handler_);
+
+        if(!queue_.empty()) {
+            auto msg = std::move(queue_.front());
+            queue_.pop_front();
+            handler(std::move(msg));
+            return;
+        }
+        if(error_) {
+            handler(Message{FrameHeader::Close, {}, true, error_, nullptr});
+            return;
+        }
+
+        read_handler_ = std::move(handler);
+        read_inline_  = in_strand;
+    }
+
+    void Deliver(FrameHeader::FrameType type, Buffer data, bool finish) {
+        Message msg{type, data, finish, {}, nullptr};
+
+        if(read_handler_ && read_inline_) {
+            // the reader runs on this strand, it resumes right here and sees the receive buffer directly
+            std::exchange(read_handler_, nullptr)(std::move(msg));
+            return;
+        }
+
+        Own(msg);
+        if(read_handler_) {
+            std::exchange(read_handler_, nullptr)(std::move(msg));
+            return;
+        }
+        queue_.push_back(std::move(msg));
+    }
+
+    void Fail(std::error_code ec, const std::string &reason) {
+        if(error_) {
+            return;
+        }
+        error_ = ec;
+
+        if(read_handler_) {
+            Message msg{FrameHeader::Close,
+                        {reinterpret_cast<uint8_t *>(const_cast<char *>(reason.data())), reason.size()},
+                        true,
+                        ec,
+                        nullptr};
+            Own(msg);
+            std::exchange(read_handler_, nullptr)(std::move(msg));
+        }
+    }
+
+    static void Own(Message &msg) {
+        if(msg.Owned() || msg.data.size == 0) {
+            return;
+        }
+        msg.storage = std::shared_ptr<uint8_t[]>(new uint8_t[msg.data.size]);
+        std::memcpy(msg.storage.get(), msg.data.buf, msg.data.size);
+        msg.data.buf = msg.storage.get();
+    }
+
+private:
+    std::function<void(Completion)> handshake_handler_;
+    std::function<void(Message)>    read_handler_;
+    bool                            read_inline_{false};
+    std::deque<Message>             queue_;
+    std::error_code                 error_;
+};
+
+using AwaitableWSocket = AwaitableWSocketBase<asio::ip::tcp>;
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+using AwaitableUnixWSocket = AwaitableWSocketBase<asio::local::stream_protocol>;
+#endif
+
+} // namespace wsocket
+
+#endif // ASIO_HAS_CO_AWAIT
+
+#endif // WITH_ASIO
+
+#endif // WSOCKET__ASIO_AWAITABLE_WSOCKET_HPP
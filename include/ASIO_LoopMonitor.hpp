@@ -0,0 +1,280 @@
+#pragma once
+#ifndef WSOCKET__ASIO_LOOP_MONITOR_HPP
+#define WSOCKET__ASIO_LOOP_MONITOR_HPP
+
+#ifdef WITH_ASIO
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace wsocket {
+
+// Lag thresholds of a LoopMonitor, 0 disables the action
+struct LoopMonitorOptions {
+    std::chrono::milliseconds interval{100};    // between probes
+    std::chrono::milliseconds pause_accept{50}; // WhenAccepting() holds new accepts back
+    std::chrono::milliseconds skip_ping{100};   // connections skip their keep-alive pings
+    std::chrono::milliseconds shed{500};        // tracked connections are closed, lowest priority first
+    size_t                    shed_count = 1;   // connections closed per probe while shedding
+};
+
+struct LoopLagSnapshot {
+    int64_t  lag_ns           = 0; // latest probe
+    int64_t  max_lag_ns       = 0; // since Start()
+    uint64_t probes           = 0;
+    bool     accepting        = true;
+    bool     skipping_pings   = false;
+    uint64_t accepts_paused   = 0; // WhenAccepting() calls held back
+    uint64_t pings_skipped    = 0;
+    uint64_t connections_shed = 0;
+};
+
+/**
+ * Scheduling delay of one io_context, and load shedding above configurable delays
+ *
+ *   auto monitor = LoopMonitor::Create(io.get_executor());
+ *   monitor->Start();
+ *   ws->SetLoopMonitor(monitor, priority);                // per accepted connection
+ *   monitor->WhenAccepting([&] { acceptor.async_accept(...); });
+ *
+ * Every `interval` a timer posts a probe to the executor; the time from the timer's expiry to the
+ * probe running is the lag, i.e. how long a handler queued now waits behind the others. Each probe
+ * decides from its own lag: from `pause_accept` on WhenAccepting() defers accepting, from
+ * `skip_ping` connections skip their keep-alive pings, and once two probes in a row reach `shed`
+ * the `shed_count` tracked connections of lowest priority (newest first among equals) are closed
+ * with CLOSE_TRY_AGAIN_LATER. A single slow handler delays one probe, sustained overload all of
+ * them, so only the latter closes connections.
+ *
+ * Run one monitor per io_context; with several threads on one io_context it measures whichever
+ * thread picks the probe up. The probe runs on a strand of its own, which adds no delay of note.
+ * Instances come from Create(), the methods may be called from any thread.
+ */
+class LoopMonitor : public std::enable_shared_from_this<LoopMonitor> {
+    LoopMonitor(asio::any_io_executor io_executor, const LoopMonitorOptions &options) :
+        executor_(asio::make_strand(io_executor)), timer_(executor_), options_(options) {}
+
+public:
+    // What the monitor closes while shedding (see WSocketBase::SetLoopMonitor)
+    class Connection {
+    public:
+        virtual ~Connection() = default;
+        // Any thread
+        virtual void Shed() = 0;
+    };
+
+    static std::shared_ptr<LoopMonitor> Create(asio::any_io_executor     io_executor,
+                                               const LoopMonitorOptions &options = {}) {
+        return std::shared_ptr<LoopMonitor>(new LoopMonitor(std::move(io_executor), options));
+    }
+
+    LoopMonitor(const LoopMonitor &)            = delete;
+    LoopMonitor &operator=(const LoopMonitor &) = delete;
+
+    void Start() {
+        asio::post(executor_, [self = this->shared_from_this()] { self->Arm(); });
+    }
+    // Stop probing, deferred accepts start and nothing is shed any more
+    void Stop() {
+        stopped_.store(true, std::memory_order_relaxed);
+        asio::post(executor_, [self = this->shared_from_this()] {
+            self->timer_.cancel();
+            self->accepting_.store(true, std::memory_order_relaxed);
+            self->skipping_pings_.store(false, std::memory_order_relaxed);
+            self->RunAccepts();
+        });
+    }
+
+    // Run `start` (e.g. the next async_accept) now, or on the monitor's executor once the lag
+    // fell below `pause_accept`
+    void WhenAccepting(std::function<void()> start) {
+        if(accepting_.load(std::memory_order_relaxed)) {
+            start();
+            return;
+        }
+        accepts_paused_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex_);
+        deferred_accepts_.push_back(std::move(start));
+    }
+
+    // false while keep-alive pings are skipped, the skipped ping is counted
+    bool AllowPing() {
+        if(!skipping_pings_.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        pings_skipped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Close `connection` when shedding, lower `priority` first; expired connections are forgotten
+    void Track(std::weak_ptr<Connection> connection, int priority) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(tracked_.size() >= prune_at_) {
+            this->Prune();
+            prune_at_ = std::max<size_t>(PRUNE_MIN, 2 * tracked_.size());
+        }
+        tracked_.push_back({priority, next_order_++, std::move(connection)});
+    }
+
+    LoopLagSnapshot Snapshot() const {
+        LoopLagSnapshot s;
+        s.lag_ns           = lag_ns_.load(std::memory_order_relaxed);
+        s.max_lag_ns       = max_lag_ns_.load(std::memory_order_relaxed);
+        s.probes           = probes_.load(std::memory_order_relaxed);
+        s.accepting        = accepting_.load(std::memory_order_relaxed);
+        s.skipping_pings   = skipping_pings_.load(std::memory_order_relaxed);
+        s.accepts_paused   = accepts_paused_.load(std::memory_order_relaxed);
+        s.pings_skipped    = pings_skipped_.load(std::memory_order_relaxed);
+        s.connections_shed = connections_shed_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+private:
+    struct Tracked {
+        int                       priority;
+        uint64_t                  order;
+        std::weak_ptr<Connection> connection;
+    };
+
+    void Arm() {
+        if(stopped_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        timer_.expires_after(options_.interval);
+        timer_.async_wait([self = this->shared_from_this()](std::error_code ec) {
+            if(ec) {
+                return;
+            }
+            asio::post(self->executor_, [self, due = self->timer_.expiry()] {
+                self->OnProbe(std::chrono::steady_clock::now() - due);
+            });
+        });
+    }
+
+    void OnProbe(std::chrono::steady_clock::duration lag) {
+        if(stopped_.load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto lag_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(lag).count();
+        lag_ns_.store(lag_ns, std::memory_order_relaxed);
+        max_lag_ns_.store(std::max(lag_ns, max_lag_ns_.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        probes_.fetch_add(1, std::memory_order_relaxed);
+
+        auto reached = [lag](std::chrono::milliseconds threshold) {
+            return threshold.count() > 0 && lag >= threshold;
+        };
+        accepting_.store(!reached(options_.pause_accept), std::memory_order_relaxed);
+        skipping_pings_.store(reached(options_.skip_ping), std::memory_order_relaxed);
+        shed_probes_ = reached(options_.shed) ? shed_probes_ + 1 : 0;
+
+        if(accepting_.load(std::memory_order_relaxed)) {
+            this->RunAccepts();
+        }
+        if(shed_probes_ >= 2) {
+            this->ShedLowest();
+        }
+        this->Arm();
+    }
+
+    void RunAccepts() {
+        std::vector<std::function<void()>> starts;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            starts.swap(deferred_accepts_);
+        }
+        for(auto &start : starts) {
+            start();
+        }
+    }
+
+    void ShedLowest() {
+        std::vector<std::shared_ptr<Connection>> victims;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            this->Prune();
+            auto count = std::min(options_.shed_count, tracked_.size());
+            auto last  = tracked_.begin() + static_cast<std::ptrdiff_t>(count);
+            std::partial_sort(tracked_.begin(), last, tracked_.end(), [](const Tracked &a, const Tracked &b) {
+                return a.priority != b.priority ? a.priority < b.priority : a.order > b.order;
+            });
+            for(auto it = tracked_.begin(); it != last; ++it) {
+                if(auto connection = it->connection.lock()) {
+                    victims.push_back(std::move(connection));
+                }
+            }
+            tracked_.erase(tracked_.begin(), last);
+        }
+        for(auto &connection : victims) {
+            connection->Shed();
+        }
+        connections_shed_.fetch_add(victims.size(), std::memory_order_relaxed);
+    }
+
+    // mutex_ held
+    void Prune() {
+        tracked_.erase(std::remove_if(tracked_.begin(),
+                                      tracked_.end(),
+                                      [](const Tracked &tracked) { return tracked.connection.expired(); }),
+                       tracked_.end());
+    }
+
+private:
+    static constexpr size_t PRUNE_MIN = 64;
+
+    asio::any_io_executor executor_;
+    asio::steady_timer    timer_;
+    LoopMonitorOptions    options_;
+    int                   shed_probes_ = 0; // consecutive probes at or above `shed`
+
+    std::atomic<bool>     stopped_{false};
+    std::atomic<bool>     accepting_{true};
+    std::atomic<bool>     skipping_pings_{false};
+    std::atomic<int64_t>  lag_ns_{0};
+    std::atomic<int64_t>  max_lag_ns_{0};
+    std::atomic<uint64_t> probes_{0};
+    std::atomic<uint64_t> accepts_paused_{0};
+    std::atomic<uint64_t> pings_skipped_{0};
+    std::atomic<uint64_t> connections_shed_{0};
+
+    std::mutex                         mutex_;
+    std::vector<std::function<void()>> deferred_accepts_;
+    std::vector<Tracked>               tracked_;
+    size_t                             prune_at_   = PRUNE_MIN;
+    uint64_t                           next_order_ = 0;
+};
+
+// Render a snapshot in the Prometheus text exposition format, `labels` e.g. `loop="0"`
+inline std::string LoopLagToPrometheus(const LoopLagSnapshot &s, const std::string &labels = "") {
+    std::ostringstream out;
+    auto               metric = [&](const char *name, const char *type, const char *help, auto value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n"
+            << name << (labels.empty() ? "" : "{" + labels + "}") << " " << value << "\n";
+    };
+
+    metric("wsocket_loop_lag_seconds", "gauge", "Scheduling delay of the latest probe.", s.lag_ns / 1e9);
+    metric("wsocket_loop_lag_max_seconds", "gauge", "Largest scheduling delay seen.", s.max_lag_ns / 1e9);
+    metric("wsocket_loop_probes_total", "counter", "Lag probes run.", s.probes);
+    metric("wsocket_loop_accept_paused", "gauge", "New accepts are held back.", s.accepting ? 0 : 1);
+    metric("wsocket_loop_ping_skipping", "gauge", "Keep-alive pings are skipped.", s.skipping_pings ? 1 : 0);
+    metric("wsocket_loop_accepts_paused_total", "counter", "Accepts held back by lag.", s.accepts_paused);
+    metric("wsocket_loop_pings_skipped_total", "counter", "Keep-alive pings skipped by lag.", s.pings_skipped);
+    metric("wsocket_loop_connections_shed_total",
+           "counter",
+           "Connections closed by lag.",
+           s.connections_shed);
+    return out.str();
+}
+
+} // namespace wsocket
+
+#endif
+
+#endif // WSOCKET__ASIO_LOOP_MONITOR_HPP
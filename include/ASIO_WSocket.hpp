@@ -6,14 +6,30 @@
 
 #include <asio.hpp>
 
+#include <array>
+#include <atomic>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
 #include "WSocketContext.hpp"
 #include "ASIO_KeepAliveManager.hpp"
+#include "ASIO_LoopMonitor.hpp"
+#include "Capture.hpp"
+#include "IndexStack.hpp"
+#include "MpscQueue.hpp"
+#include "WorkerPool.hpp"
 
 namespace wsocket {
 
 template <typename Protocol>
 class WSocketBase : public WSocketContext::Listener,
                     public KeepAliveManager::Listener,
+                    public LoopMonitor::Connection,
                     public std::enable_shared_from_this<WSocketBase<Protocol>> {
 
     using socket_type   = typename Protocol::socket;
@@ -21,11 +37,19 @@ class WSocketBase : public WSocketContext::Listener,
 
 protected:
     explicit WSocketBase(asio::any_io_executor io_executor) :
-        socket_(asio::make_strand(io_executor)), keep_alive_manager_(socket_.get_executor()) {
+        socket_(asio::make_strand(io_executor)),
+        keep_alive_manager_(socket_.get_executor()),
+        ack_timer_(socket_.get_executor()),
+        rate_timer_(socket_.get_executor()),
+        offload_listener_(*this) {
         Initialize();
     }
     explicit WSocketBase(socket_type &&socket) :
-        socket_(std::move(socket)), keep_alive_manager_(socket_.get_executor()) {
+        socket_(std::move(socket)),
+        keep_alive_manager_(socket_.get_executor()),
+        ack_timer_(socket_.get_executor()),
+        rate_timer_(socket_.get_executor()),
+        offload_listener_(*this) {
         Initialize();
     }
 
@@ -34,12 +58,16 @@ private:
     void Initialize() {
         keep_alive_manager_.ResetListener(this);
         wsocket_context_.ResetListener(this);
+        wsocket_context_.SetFlushBudget(FLUSH_BUDGET);
 
         // Set send handler
-        wsocket_context_.ResetSendHandler([this](Buffer buffer) {
+        wsocket_context_.ResetSendHandler([this](const FrameBuffer &buffer) {
+            WSOCKET_TRACE_SCOPE("SocketWrite");
+            this->CaptureBytes(CaptureDirection::Sent, buffer.Data(), buffer.Size());
             asio::error_code ec;
-            this->socket_.send(asio::buffer(buffer.buf, buffer.size), 0, ec);
+            this->socket_.send(asio::buffer(buffer.Data(), buffer.Size()), this->send_flags_, ec);
             if(ec) {
+                this->send_failed_ = true;
                 this->OnError(ec);
             }
         });
@@ -54,6 +82,19 @@ public:
     }
 
     ~WSocketBase() override {
+        // posted messages the strand did not get to
+        for(auto *op = posted_.PopAll(); op;) {
+            auto *next = op->next;
+            if(op->slot == NO_SLOT) {
+                op->Destroy();
+            }
+            op = next;
+        }
+        for(auto *op : post_cache_) {
+            if(op) {
+                op->Destroy();
+            }
+        }
         wsocket_context_.ResetListener(nullptr);
         wsocket_context_.ResetSendHandler(nullptr);
         keep_alive_manager_.ResetListener(nullptr);
@@ -64,6 +105,18 @@ public:
         }
     }
 
+    asio::any_io_executor GetExecutor() { return socket_.get_executor(); }
+
+    // Counters of this connection (see Metrics.hpp)
+    MetricsSnapshot GetMetrics() const { return this->wsocket_context_.Metrics().Snapshot(); }
+    // Queued payload bytes not yet written, safe to read from any thread
+    size_t PendingSendBytes() const {
+        return this->wsocket_context_.Metrics().send_queue_bytes.load(std::memory_order_relaxed);
+    }
+
+    // Underlying socket, e.g. to set options such as tcp::no_delay once connected
+    socket_type &GetSocket() { return socket_; }
+
     void Start() {
         this->StartRecv();
         keep_alive_manager_.Start();
@@ -78,15 +131,77 @@ public:
     // Initiate connection and perform WSocket handshake
     void Handshake(const endpoint_type &endpoint) {
         auto _this = this->shared_from_this();
-        socket_.async_connect(endpoint, [=](asio::error_code ec) {
+        socket_.async_connect(endpoint, [_this](asio::error_code ec) {
             if(ec) {
-                this->OnError(ec);
+                _this->OnError(ec);
                 return;
             }
             _this->OnSocketConnected();
         });
     }
 
+    // Validate Text payloads as UTF-8 (see Utf8Policy)
+    void SetUtf8Policy(Utf8Policy policy) { this->wsocket_context_.SetUtf8Policy(policy); }
+
+    // Split outbound messages into frames of at most `size` payload bytes
+    void SetMaxFrameSize(size_t size) { this->wsocket_context_.SetMaxFrameSize(size); }
+
+    // Session resumption (see WSocketContext::UseSession), set up before the handshake
+    void ResetSessionStore(SessionStore *store) { this->wsocket_context_.ResetSessionStore(store); }
+    void UseSession(std::shared_ptr<Session> session) { this->wsocket_context_.UseSession(std::move(session)); }
+    std::shared_ptr<Session> GetSession() const { return this->wsocket_context_.GetSession(); }
+    bool                     SessionResumed() const { return this->wsocket_context_.SessionResumed(); }
+
+    // Append the bytes read and written to `writer` (see Capture.hpp), nullptr stops. SendMapped and
+    // SendFile copy their payload through SendBinary meanwhile, so that it is captured as well.
+    void SetCapture(std::shared_ptr<CaptureWriter> writer) {
+        capture_id_ = writer ? writer->NewConnection() : 0;
+        capture_    = std::move(writer);
+    }
+
+    // Acknowledged delivery (see WSocketContext::SetReliable), set up before the handshake
+    void     SetReliable(const ReliableOptions &options = {}) { this->wsocket_context_.SetReliable(options); }
+    uint64_t SentSequence() const { return this->wsocket_context_.SentSequence(); }
+    uint64_t AckedSequence() const { return this->wsocket_context_.AckedSequence(); }
+
+    // Inbound limits (see WSocketContext::SetRateLimit), with RateLimitPolicy::Pause the socket is
+    // not read until they allow more
+    void SetRateLimit(const RateLimitOptions &options) { this->wsocket_context_.SetRateLimit(options); }
+
+    /**
+     * Run OnText/OnBinary on `pool` instead of the connection's strand, nullptr goes back; set it up
+     * before Start()/Handshake()
+     *
+     * The messages of this connection are handled one after another in arrival order (SerialQueue),
+     * different connections in parallel. Payloads are not copied: the receive buffer they point
+     * into is retained until their handler returned (see WSocketContext::RetainPayload). The other
+     * callbacks and stream listeners stay on the strand, reliable-mode acks count a message once it
+     * is handed over. Handlers on the pool send through PostText/PostBinary/PostClose.
+     */
+    void SetWorkerPool(WorkerPool *pool) {
+        if(pool) {
+            offload_ = SerialQueue::Create(*pool);
+            this->wsocket_context_.ResetListener(&offload_listener_);
+        } else {
+            offload_.reset();
+            this->wsocket_context_.ResetListener(this);
+        }
+    }
+
+    /**
+     * Shed load with `monitor` (see LoopMonitor), call once per connection
+     *
+     * While the monitor's lag is above its thresholds keep-alive pings are skipped and, under
+     * sustained overload, the connection may be closed with CLOSE_TRY_AGAIN_LATER; connections of
+     * lower `priority` go first.
+     */
+    void SetLoopMonitor(std::shared_ptr<LoopMonitor> monitor, int priority = 0) {
+        loop_monitor_ = std::move(monitor);
+        if(loop_monitor_) {
+            loop_monitor_->Track(this->weak_from_this(), priority);
+        }
+    }
+
     // Send Ping frame
     void Ping() { this->wsocket_context_.Ping(); }
 
@@ -94,10 +209,128 @@ public:
     void Pong() { this->wsocket_context_.Pong(); }
 
     // Send text message
-    void Text(std::string_view text, bool finish = true) { this->wsocket_context_.SendText(text, finish); }
+    void Text(std::string_view text, bool finish = true) {
+        this->wsocket_context_.SendText(text, finish);
+        this->ScheduleFlush();
+    }
 
     // Send binary message
-    void Binary(Buffer buffer, bool finish = true) { this->wsocket_context_.SendBinary(buffer, finish); }
+    void Binary(Buffer buffer, bool finish = true) {
+        this->wsocket_context_.SendBinary(buffer, finish);
+        this->ScheduleFlush();
+    }
+
+    // Queue a text/binary message by priority; queued messages are written in fragments, a slice per
+    // executor turn, so higher priorities, other streams and receives are not held up (see StreamScheduler)
+    void Text(std::string_view text, bool finish, SendPriority priority) {
+        this->wsocket_context_.SendText(text, finish, priority);
+        this->ScheduleFlush();
+    }
+    void Binary(Buffer buffer, bool finish, SendPriority priority) {
+        this->wsocket_context_.SendBinary(buffer, finish, priority);
+        this->ScheduleFlush();
+    }
+
+    // Send a trivially copyable struct with its precomputed header (see WSocketContext::SendTyped)
+    template <typename T>
+    void SendTyped(const T &message) {
+        this->wsocket_context_.SendTyped(message);
+        this->ScheduleFlush();
+    }
+
+    // Send memory that outlives the call (e.g. an mmap'ed file) as one Binary message, the payload is
+    // written straight from `region` instead of being copied into a frame buffer first
+    void SendMapped(Buffer region, bool finish = true) {
+        auto max = this->wsocket_context_.MaxFrameSize();
+        if(capture_ || !this->SendPayloadHeader(std::min(region.size, max), finish && region.size <= max)) {
+            if(region.size == 0 || send_failed_) {
+                return;
+            }
+            this->wsocket_context_.SendBinary(region, finish);
+            return;
+        }
+        size_t pos = 0;
+        while(true) {
+            auto             len = std::min(region.size - pos, max);
+            asio::error_code ec;
+            asio::write(socket_, asio::buffer(region.buf + pos, len), ec);
+            if(ec) {
+                this->AbortPayload(ec);
+                return;
+            }
+            pos += len;
+            if(pos == region.size) {
+                return;
+            }
+            len = std::min(region.size - pos, max);
+            if(!this->SendNextPayloadHeader(len, finish && pos + len == region.size)) {
+                return;
+            }
+        }
+    }
+
+#ifndef _WIN32
+    // Send `len` bytes of a file from `offset` as one Binary message. On Linux the payload goes from
+    // the page cache to the socket through sendfile(2) and never enters user space; elsewhere, and on
+    // compressed connections, it is read in chunks.
+    void SendFile(int fd, off_t offset, size_t len, bool finish = true) {
+        auto max = this->wsocket_context_.MaxFrameSize();
+        if(capture_ || !this->SendPayloadHeader(std::min(len, max), finish && len <= max)) {
+            if(len == 0 || send_failed_) {
+                return;
+            }
+            auto data = FramePool::Allocate(len);
+            auto ec   = ReadFile(fd, offset, data.Data(), len);
+            if(ec) {
+                this->OnError(ec);
+                return;
+            }
+            this->wsocket_context_.SendBinary(data, finish);
+            return;
+        }
+
+        asio::error_code ec;
+        size_t           pos = 0;
+        while(!ec) {
+            auto part = std::min(len - pos, max);
+            auto sent = this->SendFileSegments(fd, offset + static_cast<off_t>(pos), part, ec);
+            if(!ec && sent < part) {
+                ec = asio::error::eof; // the file is shorter than announced
+            }
+            pos += sent;
+            if(ec || pos == len) {
+                break;
+            }
+            part = std::min(len - pos, max);
+            if(!this->SendNextPayloadHeader(part, finish && pos + part == len)) {
+                return;
+            }
+        }
+        if(ec) {
+            // the peer already got the header, the stream cannot be resynchronised
+            this->AbortPayload(ec);
+        }
+    }
+#endif
+
+    // Queue a text/binary message on a logical stream
+    void Text(uint32_t         stream,
+              std::string_view text,
+              bool             finish   = true,
+              SendPriority     priority = SendPriority::Normal) {
+        this->wsocket_context_.SendText(stream, text, finish, priority);
+        this->ScheduleFlush();
+    }
+    void Binary(uint32_t stream, Buffer buffer, bool finish = true, SendPriority priority = SendPriority::Normal) {
+        this->wsocket_context_.SendBinary(stream, buffer, finish, priority);
+        this->ScheduleFlush();
+    }
+
+    // Receive the messages of one logical stream, or of all streams without their own listener
+    void ResetStreamListener(uint32_t stream, StreamListener *listener) {
+        this->wsocket_context_.ResetStreamListener(stream, listener);
+    }
+    void ResetStreamListener(StreamListener *listener) { this->wsocket_context_.ResetStreamListener(listener); }
 
     // Close connection (using standard close code)
     void Close(CloseCode code) { this->wsocket_context_.Close(code); }
@@ -105,6 +338,33 @@ public:
     // Close connection (using custom close code and reason)
     void Close(int16_t code, const std::string &reason) { this->wsocket_context_.Close(code, reason); }
 
+    /**
+     * Thread safe sends: Text/Binary/Close run on the connection's strand, these may be called from
+     * any thread
+     *
+     * The message is copied into one block and pushed onto a lock-free queue (MpscQueue), only the
+     * push that finds the queue empty posts a drain to the strand. The drain sends in push order,
+     * each producer's messages stay in its order. Messages reaching the strand while the connection
+     * cannot send (before the handshake, after Close) are dropped, counted in send_queue_drops and
+     * reported as OnError(MessagesDropped).
+     * A post costs the producer two CAS, taking a cached block (IndexStack::Pop) and pushing it
+     * (MpscQueue::Push), and the strand one to hand the block back; the drain itself takes the
+     * whole queue with one exchange.
+     * The connection recycles up to POST_CACHE blocks of at most POST_CACHE_BLOCK bytes, handed back
+     * by the strand through a lock-free stack (IndexStack); larger messages, and messages posted
+     * while all of them are queued, take a block from the FramePool.
+     */
+    void PostText(std::string_view text, bool finish = true) {
+        this->Post(FrameHeader::Text, reinterpret_cast<const uint8_t *>(text.data()), text.size(), finish);
+    }
+    void PostBinary(Buffer buffer, bool finish = true) {
+        this->Post(FrameHeader::Binary, buffer.buf, buffer.size, finish);
+    }
+    void PostClose(CloseCode code) { this->PostClose(static_cast<int16_t>(code), CloseMessage(code)); }
+    void PostClose(int16_t code, const std::string &reason) {
+        this->Post(FrameHeader::Close, reinterpret_cast<const uint8_t *>(reason.data()), reason.size(), true, code);
+    }
+
 protected:
     //============ WSocketContext::Listener start ============//
     void         OnError(std::error_code code) override {}
@@ -116,21 +376,41 @@ protected:
     void OnPong() override {}
     void OnText(std::string_view text, bool finish) override {}
     void OnBinary(Buffer buffer, bool finish) override {}
+    void OnAck(uint64_t sequence) override {}
     //============ WSocketContext::Listener end ============//
 
+    // Client side, right after the handshake frame went out: messages sent here are pipelined
+    // with it (0-RTT, uncompressed) instead of waiting for the peer's answer
+    virtual void OnHandshakeSent() {}
+
     //============ KeepAliveManager::Listener start ============//
     void OnKeepAliveExpired(std::error_code ec) override {
         if(ec == asio::error::operation_aborted) {
             return;
         }
         this->keep_alive_manager_.Flush();
-        this->wsocket_context_.Ping();
+        if(!loop_monitor_ || loop_monitor_->AllowPing()) {
+            this->wsocket_context_.Ping();
+        }
+
+        // no message since the last expiry: stop holding a receive buffer between reads
+        auto received = this->ReceivedMessageBytes();
+        if(received == idle_mark_ && !idle_) {
+            idle_ = true;
+            if(this->wsocket_context_.ReceiveBuffered() == 0) {
+                asio::error_code ignore_ec;
+                cancel_pending_ = true;
+                std::ignore     = socket_.cancel(ignore_ec);
+            }
+        }
+        idle_mark_ = received;
     }
     void OnKeepAliveTimeout(std::error_code ec) override {
         if(ec == asio::error::operation_aborted) {
             return;
         }
-        this->wsocket_context_.Close(CloseCode::CLOSE_PROTOCOL_ERROR);
+        ConnectionMetrics::Add(this->wsocket_context_.Metrics().keepalive_timeouts, 1);
+        this->wsocket_context_.CloseNow(CloseCode::CLOSE_PROTOCOL_ERROR); // the peer is not reading
 
         asio::error_code ignore_ec;
         std::ignore = socket_.shutdown(socket_type::shutdown_both, ignore_ec);
@@ -139,16 +419,41 @@ protected:
     }
     //============ KeepAliveManager::Listener end ============//
 
+    //============ LoopMonitor::Connection start ============//
+    void Shed() override {
+        asio::post(this->GetExecutor(), [self = this->shared_from_this()] {
+            if(self->wsocket_context_.CanSend()) {
+                self->wsocket_context_.CloseNow(CloseCode::CLOSE_TRY_AGAIN_LATER);
+            }
+        });
+    }
+    //============ LoopMonitor::Connection end ============//
+
 private:
     // connection success callback
     void OnSocketConnected() {
         this->Start();
         this->wsocket_context_.Handshake();
+        this->OnHandshakeSent();
     }
     // Data receive completion callback
     void OnReceived(std::size_t bytes_transferred) {
+        WSOCKET_TRACE_SCOPE("OnReceived");
         this->wsocket_context_.CommitWrite(bytes_transferred);
-        this->StartRecv();
+        this->ScheduleAck();
+        this->ScheduleFlush(); // acks may have opened the reliable window
+        if(this->PauseForRateLimit()) {
+            return;
+        }
+
+        if(idle_ && this->ReceivedMessageBytes() != idle_mark_) {
+            idle_ = false;
+        }
+        if(idle_ && this->wsocket_context_.ReceiveBuffered() == 0) {
+            this->ReleaseAndWait();
+        } else {
+            this->StartRecv();
+        }
     }
 
     // Start asynchronous data reception
@@ -156,18 +461,374 @@ private:
         auto _this = this->shared_from_this();
         auto buf   = wsocket_context_.PrepareWrite();
         socket_.async_receive(asio::buffer(buf.buf, buf.size), [=](std::error_code ec, std::size_t bytes_transferred) {
+            if(ec == asio::error::operation_aborted && _this->cancel_pending_) {
+                _this->cancel_pending_ = false;
+                _this->ReleaseAndWait();
+                return;
+            }
             if(ec) {
                 _this->OnError(ec);
                 return;
             }
+            _this->cancel_pending_ = false; // completed before the cancel reached it
+            _this->CaptureBytes(CaptureDirection::Received, buf.buf, bytes_transferred);
             _this->OnReceived(bytes_transferred);
         });
     }
 
+    // Parsing held back by the rate limit: read nothing until the limits allow more, TCP flow
+    // control then slows the peer down
+    bool PauseForRateLimit() {
+        auto pause = wsocket_context_.ReceivePause();
+        if(!pause) {
+            return false;
+        }
+        rate_timer_.expires_after(*pause);
+        rate_timer_.async_wait([_this = this->shared_from_this()](std::error_code ec) {
+            if(ec) {
+                return;
+            }
+            _this->wsocket_context_.ResumeReceive();
+            _this->ScheduleAck();
+            _this->ScheduleFlush();
+            if(!_this->PauseForRateLimit()) {
+                _this->StartRecv();
+            }
+        });
+        return true;
+    }
+
+    // Free the receive buffer and wait for readability without one, an idle connection holds no buffer
+    void ReleaseAndWait() {
+        wsocket_context_.ReleaseReceiveBuffer();
+
+        auto _this = this->shared_from_this();
+        socket_.async_wait(socket_type::wait_read, [_this](std::error_code ec) {
+            if(ec) {
+                _this->OnError(ec);
+                return;
+            }
+            _this->StartRecv();
+        });
+    }
+
+    // Frame header of a payload written by the caller, held back (MSG_MORE) to leave with the payload;
+    // false when it was refused or could not be written (send_failed_, OnError already called)
+    bool SendPayloadHeader(size_t len, bool finish) {
+        send_failed_ = false;
+#ifdef MSG_MORE
+        send_flags_ = MSG_MORE;
+#endif
+        bool sent   = this->wsocket_context_.SendBinaryHeader(len, finish);
+        send_flags_ = 0;
+        return sent && !send_failed_;
+    }
+    // Header of a later chunk: the peer already got part of the message, without it the stream
+    // cannot be resynchronised
+    bool SendNextPayloadHeader(size_t len, bool finish) {
+        if(this->wsocket_context_.CanSend() && this->SendPayloadHeader(len, finish)) {
+            return true;
+        }
+        this->AbortPayload(send_failed_ ? std::error_code() : make_error_code(Error::UnexpectedError));
+        return false;
+    }
+    // Give up a message whose payload is partly written, `ec` is reported unless it is empty
+    void AbortPayload(std::error_code ec) {
+        asio::error_code ignore_ec;
+        std::ignore = socket_.shutdown(socket_type::shutdown_both, ignore_ec);
+        if(ec) {
+            this->OnError(ec);
+        }
+    }
+
+#ifndef _WIN32
+    static asio::error_code ReadFile(int fd, off_t offset, uint8_t *dst, size_t len) {
+        while(len > 0) {
+            auto n = ::pread(fd, dst, len, offset);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n < 0) {
+                return {errno, asio::error::get_system_category()};
+            }
+            if(n == 0) {
+                return asio::error::eof;
+            }
+            dst += n;
+            offset += n;
+            len -= static_cast<size_t>(n);
+        }
+        return {};
+    }
+
+    // Returns the payload bytes written, fewer than `len` only when ec is set or the file ended
+    size_t SendFileSegments(int fd, off_t offset, size_t len, asio::error_code &ec) {
+        size_t sent = 0;
+#ifdef __linux__
+        while(sent < len) {
+            auto n = ::sendfile(socket_.native_handle(), fd, &offset, len - sent);
+            if(n > 0) {
+                sent += static_cast<size_t>(n);
+                continue;
+            }
+            if(n == 0) {
+                return sent;
+            }
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EAGAIN) {
+                // asio keeps the descriptor non-blocking once an async operation ran on it
+                socket_.wait(socket_type::wait_write, ec);
+                if(ec) {
+                    return sent;
+                }
+                continue;
+            }
+            if((errno == EINVAL || errno == ENOSYS) && sent == 0) {
+                break; // this kind of file cannot be sent, read it instead
+            }
+            ec = asio::error_code(errno, asio::error::get_system_category());
+            return sent;
+        }
+        if(sent == len) {
+            return sent;
+        }
+#endif
+        uint8_t chunk[64 * 1024];
+        while(sent < len) {
+            auto want = std::min(len - sent, sizeof(chunk));
+            auto n    = ::pread(fd, chunk, want, offset);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n < 0) {
+                ec = asio::error_code(errno, asio::error::get_system_category());
+                return sent;
+            }
+            if(n == 0) {
+                return sent;
+            }
+            asio::write(socket_, asio::buffer(chunk, static_cast<size_t>(n)), ec);
+            if(ec) {
+                return sent;
+            }
+            offset += n;
+            sent += static_cast<size_t>(n);
+        }
+        return sent;
+    }
+#endif
+
+    void ScheduleFlush() {
+        if(flush_scheduled_ || wsocket_context_.PendingSendBytes() == 0) {
+            return;
+        }
+        flush_scheduled_ = true;
+        asio::post(socket_.get_executor(), [_this = this->shared_from_this()] {
+            _this->flush_scheduled_ = false;
+            if(_this->wsocket_context_.Flush(FLUSH_BUDGET) > 0) {
+                _this->ScheduleFlush();
+            }
+        });
+    }
+
+    // Delayed ack of reliable mode, at the deadline of the oldest message not yet acknowledged
+    void ScheduleAck() {
+        auto deadline = wsocket_context_.AckDeadline();
+        if(ack_timer_armed_ || !deadline) {
+            return;
+        }
+        ack_timer_armed_ = true;
+        ack_timer_.expires_at(*deadline);
+        ack_timer_.async_wait([_this = this->shared_from_this()](std::error_code ec) {
+            _this->ack_timer_armed_ = false;
+            if(ec) {
+                return;
+            }
+            // the batch the timer was armed for may have gone out by count, wait for the current one
+            auto deadline = _this->wsocket_context_.AckDeadline();
+            if(deadline && *deadline > std::chrono::steady_clock::now()) {
+                _this->ScheduleAck();
+                return;
+            }
+            _this->wsocket_context_.SendAck();
+        });
+    }
+
+    static constexpr uint32_t POST_CACHE       = 64;
+    static constexpr size_t   POST_CACHE_BLOCK = 1024;
+    static constexpr uint32_t NO_SLOT          = IndexStack<POST_CACHE>::NONE;
+
+    // A message handed over by PostText/PostBinary/PostClose, it lives at the front of its own block
+    struct PostedOp {
+        PostedOp              *next = nullptr;
+        FrameBuffer            block;
+        uint32_t               slot = NO_SLOT; // in post_cache_, NO_SLOT for a block used once
+        FrameHeader::FrameType type{};
+        bool                   finish     = true;
+        int16_t                close_code = 0;
+        size_t                 size       = 0;
+
+        uint8_t *Payload() { return reinterpret_cast<uint8_t *>(this + 1); }
+        size_t   Capacity() const { return block.Capacity() - sizeof(PostedOp); }
+        void     Destroy() {
+            auto keep = std::move(block); // released after the node is gone
+            this->~PostedOp();
+        }
+    };
+
+    static PostedOp *NewPostedOp(size_t len, uint32_t slot) {
+        auto  block = FramePool::Allocate(sizeof(PostedOp) + len);
+        auto *op    = new(block.Data()) PostedOp;
+        op->block   = std::move(block);
+        op->slot    = slot;
+        return op;
+    }
+
+    // Any thread: an idle cached op, a slot of the cache never used yet, or a block of its own
+    PostedOp *AcquirePostedOp(size_t len) {
+        if(sizeof(PostedOp) + len > POST_CACHE_BLOCK) {
+            return NewPostedOp(len, NO_SLOT);
+        }
+        auto slot = post_idle_.Pop();
+        if(slot == NO_SLOT) {
+            if(post_slots_.load(std::memory_order_relaxed) >= POST_CACHE ||
+               (slot = post_slots_.fetch_add(1, std::memory_order_relaxed)) >= POST_CACHE) {
+                return NewPostedOp(len, NO_SLOT);
+            }
+        } else if(post_cache_[slot]->Capacity() >= len) {
+            return post_cache_[slot];
+        } else {
+            post_cache_[slot]->Destroy(); // grows, up to POST_CACHE_BLOCK
+        }
+        // the slot is ours until the strand gives it back
+        post_cache_[slot] = NewPostedOp(len, slot);
+        return post_cache_[slot];
+    }
+
+    // Strand
+    void ReleasePostedOp(PostedOp *op) {
+        if(op->slot == NO_SLOT) {
+            op->Destroy();
+            return;
+        }
+        post_idle_.Push(op->slot);
+    }
+
+    void Post(FrameHeader::FrameType type, const uint8_t *data, size_t len, bool finish, int16_t close_code = 0) {
+        auto *op       = this->AcquirePostedOp(len);
+        op->type       = type;
+        op->finish     = finish;
+        op->close_code = close_code;
+        op->size       = len;
+        std::memcpy(op->Payload(), data, len);
+
+        if(posted_.Push(op)) {
+            asio::post(socket_.get_executor(), [_this = this->shared_from_this()] { _this->DrainPosted(); });
+        }
+    }
+
+    void DrainPosted() {
+        uint64_t dropped = 0;
+        for(auto *op = posted_.PopAll(); op;) {
+            auto *next = op->next;
+            if(!wsocket_context_.CanSend()) {
+                dropped += op->type != FrameHeader::Close;
+            } else {
+                std::string_view payload(reinterpret_cast<char *>(op->Payload()), op->size);
+                if(op->type == FrameHeader::Text) {
+                    wsocket_context_.SendText(payload, op->finish);
+                } else if(op->type == FrameHeader::Binary) {
+                    wsocket_context_.SendBinary({op->Payload(), op->size}, op->finish);
+                } else {
+                    wsocket_context_.Close(op->close_code, std::string(payload));
+                }
+            }
+            this->ReleasePostedOp(op);
+            op = next;
+        }
+        if(dropped) {
+            // reported as the messages still queued when the connection closes
+            ConnectionMetrics::Add(wsocket_context_.Metrics().send_queue_drops, dropped);
+            this->OnError(Error::MessagesDropped);
+        }
+        this->ScheduleFlush();
+    }
+
+    // Context listener while a WorkerPool is set: messages go to the pool, the rest straight to the socket
+    class OffloadListener final : public WSocketContext::Listener {
+    public:
+        explicit OffloadListener(WSocketBase &owner) : owner_(owner) {}
+
+        void         OnError(std::error_code code) override { owner_.OnError(code); }
+        CompressType OnHandshake(const std::vector<CompressType> &supported_compress_type) override {
+            return owner_.OnHandshake(supported_compress_type);
+        }
+        void OnClose(int16_t code, const std::string &reason) override { owner_.OnClose(code, reason); }
+        void OnPing() override { owner_.OnPing(); }
+        void OnPong() override { owner_.OnPong(); }
+        void OnAck(uint64_t sequence) override { owner_.OnAck(sequence); }
+
+        void OnText(std::string_view text, bool finish) override {
+            auto payload = this->Retain({reinterpret_cast<uint8_t *>(const_cast<char *>(text.data())), text.size()});
+            owner_.offload_->Post([self = owner_.shared_from_this(), payload = std::move(payload), finish] {
+                self->OnText(payload.Text(), finish);
+            });
+        }
+        void OnBinary(Buffer buffer, bool finish) override {
+            owner_.offload_->Post([self = owner_.shared_from_this(), payload = this->Retain(buffer), finish] {
+                self->OnBinary(payload.data, finish);
+            });
+        }
+
+    private:
+        RetainedPayload Retain(Buffer payload) { return owner_.wsocket_context_.RetainPayload(payload); }
+
+        WSocketBase &owner_;
+    };
+
+    void CaptureBytes(CaptureDirection direction, const uint8_t *data, size_t len) {
+        if(capture_) {
+            capture_->Append(capture_id_, direction, data, len);
+        }
+    }
+
+    uint64_t ReceivedMessageBytes() const {
+        return wsocket_context_.Metrics().message_bytes_received.load(std::memory_order_relaxed);
+    }
+
 private:
+    static constexpr size_t FLUSH_BUDGET = 64 * 1024; // queued payload written per executor turn
+
     socket_type      socket_;
-    KeepAliveManager keep_alive_manager_;
-    WSocketContext   wsocket_context_;
+    KeepAliveManager   keep_alive_manager_;
+    asio::steady_timer ack_timer_;
+    asio::steady_timer rate_timer_;
+    WSocketContext     wsocket_context_;
+    bool               flush_scheduled_ = false;
+    bool               ack_timer_armed_ = false;
+
+    // A connection that received no message for a keep-alive period is idle until the next one,
+    // it reads only after waiting for readability and releases the receive buffer in between
+    bool     idle_           = false;
+    bool     cancel_pending_ = false; // the pending receive was cancelled to enter idle
+    uint64_t idle_mark_      = 0;     // message bytes received at the last keep-alive expiry
+
+    asio::socket_base::message_flags send_flags_  = 0;
+    bool                             send_failed_ = false; // the send handler reported an error
+
+    std::shared_ptr<CaptureWriter> capture_;
+    uint32_t                       capture_id_ = 0;
+
+    MpscQueue<PostedOp>                posted_;
+    IndexStack<POST_CACHE>             post_idle_;       // slots of post_cache_ holding an idle op
+    std::atomic<uint32_t>              post_slots_{0};   // slots of post_cache_ handed out so far
+    std::array<PostedOp *, POST_CACHE> post_cache_ = {}; // a slot is only touched by the thread holding it
+
+    OffloadListener              offload_listener_;
+    std::shared_ptr<SerialQueue> offload_; // set by SetWorkerPool()
+    std::shared_ptr<LoopMonitor> loop_monitor_;
 };
 
 using WSocket = WSocketBase<asio::ip::tcp>;
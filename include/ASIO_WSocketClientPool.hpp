@@ -0,0 +1,296 @@
+#pragma once
+#ifndef WSOCKET__ASIO_WSOCKET_CLIENT_POOL_HPP
+#define WSOCKET__ASIO_WSOCKET_CLIENT_POOL_HPP
+
+#ifdef WITH_ASIO
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "ASIO_WSocket.hpp"
+
+namespace wsocket {
+
+// Counters of a BasicWSocketClientPool
+struct ClientPoolStats {
+    uint64_t hits     = 0; // Acquire() found a ready connection
+    uint64_t misses   = 0; // Acquire() found none
+    uint64_t connects = 0; // handshakes completed
+    uint64_t failures = 0; // connections lost, or failed before the handshake completed
+    size_t   ready    = 0; // connections ready now
+};
+
+/**
+ * Member connection of a BasicWSocketClientPool
+ *
+ * Reports handshake completion and failure to its pool. The handshake and error callbacks are
+ * consumed by this class and are final; derive from it to handle messages, pick the compression
+ * through SelectCompressType() and observe the end of the connection through OnDisconnect().
+ */
+template <typename Protocol>
+class BasicPooledWSocket : public WSocketBase<Protocol> {
+    using base_type = WSocketBase<Protocol>;
+
+    template <typename, typename>
+    friend class BasicWSocketClientPool;
+
+protected:
+    using base_type::base_type;
+
+public:
+    static std::shared_ptr<BasicPooledWSocket> Create(asio::any_io_executor io_executor) {
+        return std::shared_ptr<BasicPooledWSocket>(new BasicPooledWSocket(std::move(io_executor)));
+    }
+
+    // Handshake completed and the connection did not fail since, safe to read from any thread
+    bool Ready() const { return ready_.load(std::memory_order_acquire); }
+
+protected:
+    virtual CompressType SelectCompressType(const std::vector<CompressType> &supported_compress_type) {
+        return CompressType::None;
+    }
+    // Called once, on error or close (asio::error::eof)
+    virtual void OnDisconnect(std::error_code code) {}
+
+    //============ WSocketContext::Listener start ============//
+    CompressType OnHandshake(const std::vector<CompressType> &supported_compress_type) final {
+        auto type = this->SelectCompressType(supported_compress_type);
+        ready_.store(true, std::memory_order_release);
+        this->Report(true);
+        return type;
+    }
+    void OnError(std::error_code code) final { this->Fail(code); }
+    void OnClose(int16_t code, const std::string &reason) final { this->Fail(make_error_code(asio::error::eof)); }
+    //============ WSocketContext::Listener end ============//
+
+private:
+    void Fail(std::error_code code) {
+        if(failed_) {
+            return;
+        }
+        failed_ = true;
+        ready_.store(false, std::memory_order_release);
+        this->Report(false);
+        this->OnDisconnect(code);
+    }
+    void Report(bool ready) {
+        if(on_state_) {
+            on_state_(this, ready);
+        }
+    }
+
+    std::function<void(BasicPooledWSocket *, bool ready)> on_state_;
+    std::atomic<bool>                                      ready_{false};
+    bool                                                   failed_ = false;
+};
+
+/**
+ * Warm connections to one endpoint
+ *
+ *   WSocketClientPool pool(io.get_executor(), endpoint, 4);
+ *   pool.Start();
+ *   if(auto ws = pool.Acquire()) { ... }   // on ws->GetExecutor()
+ *   pool.Text("hello");                    // from any thread
+ *
+ * Start() opens `size` connections and completes their handshakes ahead of use. Acquire() hands
+ * out the ready connection with the fewest queued send bytes, a miss returns nullptr instead of
+ * connecting on the caller's path. Lost connections are replaced in the background, with a delay
+ * doubling from RECONNECT_MIN to RECONNECT_MAX while connecting keeps failing.
+ *
+ * Each connection runs on its own strand, the pool itself may be used from any thread.
+ */
+template <typename Protocol, typename Connection = BasicPooledWSocket<Protocol>>
+class BasicWSocketClientPool {
+    using endpoint_type = typename Protocol::endpoint;
+
+public:
+    using connection_ptr = std::shared_ptr<Connection>;
+    using Factory        = std::function<connection_ptr(asio::any_io_executor)>;
+
+    static constexpr std::chrono::milliseconds RECONNECT_MIN{100};
+    static constexpr std::chrono::milliseconds RECONNECT_MAX{5000};
+
+    BasicWSocketClientPool(asio::any_io_executor io_executor,
+                           endpoint_type         endpoint,
+                           size_t                size,
+                           Factory               factory = {}) :
+        state_(std::make_shared<State>(std::move(io_executor), std::move(endpoint), size, std::move(factory))) {}
+
+    ~BasicWSocketClientPool() {
+        std::vector<connection_ptr> connections;
+        {
+            std::lock_guard<std::mutex> lock(state_->mutex);
+            state_->stopped = true;
+            connections.swap(state_->connections);
+            state_->retry_timer.cancel();
+        }
+        for(auto &connection : connections) {
+            asio::post(connection->GetExecutor(), [connection] {
+                connection->on_state_ = nullptr;
+                if(connection->Ready()) {
+                    connection->Close(CloseCode::CLOSE_NORMAL);
+                }
+            });
+        }
+    }
+
+    BasicWSocketClientPool(const BasicWSocketClientPool &)            = delete;
+    BasicWSocketClientPool &operator=(const BasicWSocketClientPool &) = delete;
+
+    void Start() { State::Fill(state_); }
+
+    // Ready connection with the least queued send bytes, nullptr when none is ready
+    connection_ptr Acquire() {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+
+        connection_ptr best;
+        size_t         best_pending = 0;
+        auto          &connections  = state_->connections;
+        // start after the last pick so equally loaded connections take turns
+        for(size_t i = 0; i < connections.size(); ++i) {
+            auto &connection = connections[(state_->cursor + 1 + i) % connections.size()];
+            if(!connection->Ready()) {
+                continue;
+            }
+            auto pending = connection->PendingSendBytes();
+            if(!best || pending < best_pending) {
+                best           = connection;
+                best_pending   = pending;
+                state_->cursor = (state_->cursor + 1 + i) % connections.size();
+            }
+        }
+        ++(best ? state_->stats.hits : state_->stats.misses);
+        return best;
+    }
+
+    // Send a copy through Acquire()'s connection (PostText/PostBinary), false on a miss
+    bool Text(std::string_view text, bool finish = true) {
+        auto connection = this->Acquire();
+        if(connection) {
+            connection->PostText(text, finish);
+        }
+        return connection != nullptr;
+    }
+    bool Binary(Buffer buffer, bool finish = true) {
+        auto connection = this->Acquire();
+        if(connection) {
+            connection->PostBinary(buffer, finish);
+        }
+        return connection != nullptr;
+    }
+
+    ClientPoolStats Stats() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+
+        auto stats = state_->stats;
+        for(auto &connection : state_->connections) {
+            stats.ready += connection->Ready();
+        }
+        return stats;
+    }
+
+private:
+    // Shared with the callbacks of the connections and the retry timer, which may outlive the pool
+    struct State : std::enable_shared_from_this<State> {
+        State(asio::any_io_executor io_executor, endpoint_type endpoint, size_t size, Factory factory) :
+            io_executor(std::move(io_executor)),
+            endpoint(std::move(endpoint)),
+            size(size),
+            factory(std::move(factory)),
+            retry_timer(this->io_executor) {
+            if(!this->factory) {
+                this->factory = [](asio::any_io_executor executor) { return Connection::Create(std::move(executor)); };
+            }
+        }
+
+        // Open connections up to `size`, outside the lock: a connection may report back right away
+        static void Fill(const std::shared_ptr<State> &state) {
+            size_t missing = 0;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if(state->stopped) {
+                    return;
+                }
+                missing = state->size - std::min(state->size, state->connections.size());
+            }
+
+            std::weak_ptr<State> weak = state;
+            for(size_t i = 0; i < missing; ++i) {
+                auto connection       = state->factory(state->io_executor);
+                connection->on_state_ = [weak](BasicPooledWSocket<Protocol> *connection, bool ready) {
+                    if(auto state = weak.lock()) {
+                        state->OnState(connection, ready);
+                    }
+                };
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->connections.push_back(connection);
+                }
+                asio::dispatch(connection->GetExecutor(),
+                               [connection, endpoint = state->endpoint] { connection->Handshake(endpoint); });
+            }
+        }
+
+        void OnState(BasicPooledWSocket<Protocol> *connection, bool ready) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(ready) {
+                ++stats.connects;
+                retry_delay = std::chrono::milliseconds(0);
+                return;
+            }
+            ++stats.failures;
+            connections.erase(std::remove_if(connections.begin(),
+                                             connections.end(),
+                                             [connection](auto &c) { return c.get() == connection; }),
+                              connections.end());
+            if(stopped || retry_armed) {
+                return;
+            }
+
+            // replace right away after a success, back off while connecting keeps failing
+            retry_armed = true;
+            retry_timer.expires_after(retry_delay);
+            retry_delay = std::clamp(retry_delay * 2, RECONNECT_MIN, RECONNECT_MAX);
+            retry_timer.async_wait([weak = std::weak_ptr<State>(this->shared_from_this())](std::error_code ec) {
+                auto state = weak.lock();
+                if(!state || ec == asio::error::operation_aborted) {
+                    return;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(state->mutex);
+                    state->retry_armed = false;
+                }
+                Fill(state);
+            });
+        }
+
+        asio::any_io_executor       io_executor;
+        endpoint_type               endpoint;
+        size_t                      size;
+        Factory                     factory;
+        asio::steady_timer          retry_timer;
+        std::chrono::milliseconds   retry_delay{0};
+        bool                        retry_armed = false;
+        bool                        stopped     = false;
+        mutable std::mutex          mutex;
+        std::vector<connection_ptr> connections;
+        size_t                      cursor = 0;
+        ClientPoolStats             stats;
+    };
+
+    std::shared_ptr<State> state_;
+};
+
+using PooledWSocket     = BasicPooledWSocket<asio::ip::tcp>;
+using WSocketClientPool = BasicWSocketClientPool<asio::ip::tcp>;
+
+} // namespace wsocket
+
+#endif // WITH_ASIO
+
+#endif // WSOCKET__ASIO_WSOCKET_CLIENT_POOL_HPP
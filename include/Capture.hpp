@@ -0,0 +1,270 @@
+#pragma once
+#ifndef WSOCKET__CAPTURE_HPP
+#define WSOCKET__CAPTURE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "SlidingBuffer.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Capture file: the raw bytes of connections as they were read from / written to the transport
+ *
+ * Layout: the 8 byte magic "WSCAP" 0 0 1, the capture start as system_clock ns (8 bytes, little
+ * endian), then one record per read or write:
+ *
+ *   direction (1 byte) | connection (varint) | ns since the previous record (varint) |
+ *   length (varint) | bytes
+ *
+ * Varints are LEB128, a small record costs 4 bytes on top of its payload.
+ */
+enum class CaptureDirection : uint8_t {
+    Received = 0,
+    Sent     = 1,
+};
+
+struct CaptureRecord {
+    CaptureDirection direction;
+    uint32_t         connection;
+    uint64_t         time_ns; // since the capture started
+    Buffer           data;    // points into the mapped file
+};
+
+namespace capture {
+
+constexpr uint8_t MAGIC[8]    = {'W', 'S', 'C', 'A', 'P', 0, 0, 1};
+constexpr size_t  HEADER_SIZE = 16;
+
+inline size_t PutVarint(uint8_t *dst, uint64_t value) {
+    size_t n = 0;
+    while(value >= 0x80) {
+        dst[n++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    dst[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+// false when the varint runs past `end`
+inline bool GetVarint(const uint8_t *&pos, const uint8_t *end, uint64_t &value) {
+    value = 0;
+    for(int shift = 0; pos < end && shift < 64; shift += 7) {
+        auto byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace capture
+
+/**
+ * Appends records of any number of connections to one capture file
+ *
+ * Thread safe, connections take an id from NewConnection(). Writes go through stdio buffering;
+ * Flush() or the destructor puts them in the file.
+ */
+class CaptureWriter {
+    using clock = std::chrono::steady_clock;
+
+    explicit CaptureWriter(FILE *file) : file_(file), last_(clock::now()) {}
+
+public:
+    // nullptr when the file cannot be created (errno tells why)
+    static std::shared_ptr<CaptureWriter> Open(const std::string &path) {
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if(file == nullptr) {
+            return nullptr;
+        }
+        uint8_t header[capture::HEADER_SIZE];
+        std::memcpy(header, capture::MAGIC, sizeof(capture::MAGIC));
+        auto start = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                                   std::chrono::system_clock::now().time_since_epoch())
+                                                   .count());
+        for(int i = 0; i < 8; ++i) {
+            header[8 + i] = static_cast<uint8_t>(start >> (i * 8));
+        }
+        if(std::fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+            std::fclose(file);
+            return nullptr;
+        }
+        return std::shared_ptr<CaptureWriter>(new CaptureWriter(file));
+    }
+    ~CaptureWriter() { std::fclose(file_); }
+
+    CaptureWriter(const CaptureWriter &)            = delete;
+    CaptureWriter &operator=(const CaptureWriter &) = delete;
+
+    uint32_t NewConnection() { return next_connection_.fetch_add(1, std::memory_order_relaxed); }
+
+    void Append(uint32_t connection, CaptureDirection direction, const uint8_t *data, size_t len) {
+        uint8_t head[1 + 3 * 10];
+        size_t  n = 0;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        now = clock::now();
+        head[n++]                       = static_cast<uint8_t>(direction);
+        n += capture::PutVarint(head + n, connection);
+        n += capture::PutVarint(head + n, std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_).count());
+        n += capture::PutVarint(head + n, len);
+        last_ = now;
+
+        std::fwrite(head, 1, n, file_);
+        std::fwrite(data, 1, len, file_);
+    }
+
+    void Flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::fflush(file_);
+    }
+
+private:
+    std::mutex            mutex_;
+    FILE                 *file_;
+    clock::time_point     last_;
+    std::atomic<uint32_t> next_connection_{0};
+};
+
+/**
+ * Reads a capture file mapped into memory, records point into the mapping
+ *
+ * A capture cut short (the process died while writing) reads up to its last complete record,
+ * Truncated() tells.
+ */
+class CaptureReader {
+public:
+    CaptureReader() = default;
+    ~CaptureReader() { this->Close(); }
+
+    CaptureReader(const CaptureReader &)            = delete;
+    CaptureReader &operator=(const CaptureReader &) = delete;
+
+    // false when the file cannot be read or is not a capture
+    bool Open(const std::string &path) {
+        this->Close();
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat st {};
+        if(::fstat(fd, &st) == 0 && st.st_size > 0) {
+            auto *map = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                ::madvise(map, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                data_ = static_cast<const uint8_t *>(map);
+                size_ = static_cast<size_t>(st.st_size);
+            }
+        }
+        ::close(fd);
+#else
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if(file == nullptr) {
+            return false;
+        }
+        uint8_t chunk[64 * 1024];
+        size_t  n;
+        while((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            copy_.insert(copy_.end(), chunk, chunk + n);
+        }
+        std::fclose(file);
+        data_ = copy_.data();
+        size_ = copy_.size();
+#endif
+        if(size_ < capture::HEADER_SIZE || std::memcmp(data_, capture::MAGIC, sizeof(capture::MAGIC)) != 0) {
+            this->Close();
+            return false;
+        }
+        for(int i = 0; i < 8; ++i) {
+            start_ns_ |= static_cast<uint64_t>(data_[8 + i]) << (i * 8);
+        }
+        this->Rewind();
+        return true;
+    }
+
+    // Next record, false at the end of the capture
+    bool Next(CaptureRecord &record) {
+        const uint8_t *pos = data_ + offset_;
+        const uint8_t *end = data_ + size_;
+        if(pos == end) {
+            return false;
+        }
+
+        uint64_t connection = 0;
+        uint64_t delta      = 0;
+        uint64_t len        = 0;
+        auto     direction  = *pos++;
+        if(!capture::GetVarint(pos, end, connection) || !capture::GetVarint(pos, end, delta) ||
+           !capture::GetVarint(pos, end, len) || static_cast<uint64_t>(end - pos) < len) {
+            truncated_ = true;
+            offset_    = size_;
+            return false;
+        }
+        time_ns_ += delta;
+
+        record.direction  = static_cast<CaptureDirection>(direction);
+        record.connection = static_cast<uint32_t>(connection);
+        record.time_ns    = time_ns_;
+        record.data       = {const_cast<uint8_t *>(pos), static_cast<size_t>(len)};
+        offset_           = static_cast<size_t>(pos + len - data_);
+        return true;
+    }
+
+    void Rewind() {
+        offset_    = capture::HEADER_SIZE;
+        time_ns_   = 0;
+        truncated_ = false;
+    }
+
+    bool     Truncated() const { return truncated_; }
+    size_t   Size() const { return size_; }
+    uint64_t StartTimeNs() const { return start_ns_; } // system_clock
+
+    void Close() {
+#ifndef _WIN32
+        if(data_) {
+            ::munmap(const_cast<uint8_t *>(data_), size_);
+        }
+#else
+        copy_.clear();
+#endif
+        data_     = nullptr;
+        size_     = 0;
+        offset_   = 0;
+        start_ns_ = 0;
+    }
+
+private:
+    const uint8_t *data_      = nullptr;
+    size_t         size_      = 0;
+    size_t         offset_    = 0;
+    uint64_t       time_ns_   = 0;
+    uint64_t       start_ns_  = 0;
+    bool           truncated_ = false;
+#ifdef _WIN32
+    std::vector<uint8_t> copy_;
+#endif
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__CAPTURE_HPP
@@ -0,0 +1,27 @@
+#pragma once
+#ifndef WSOCKET__CPU_FEATURES_HPP
+#define WSOCKET__CPU_FEATURES_HPP
+
+// SIMD paths are compiled with per-function target attributes and selected at runtime,
+// so the library builds without -mavx2 and still runs on older CPUs.
+#if(defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define WSOCKET_HAS_X86_SIMD 1
+#define WSOCKET_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+
+namespace wsocket {
+
+inline bool CpuHasAvx2() {
+#ifdef WSOCKET_HAS_X86_SIMD
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+} // namespace wsocket
+
+#endif // WSOCKET__CPU_FEATURES_HPP
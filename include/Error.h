@@ -17,6 +17,12 @@ enum Error : int {
     DecompressError    = 6,
     PayloadTooLong     = 7,
     MessageEmpty       = 8,
+    InvalidUtf8        = 9,
+    InvalidStreamFrame = 10,
+    InvalidAckFrame    = 11,
+    RateLimitExceeded  = 12,
+    MessagesDropped    = 13,
+    TooManyStreams     = 14,
 };
 
 class ErrorCategory : public std::error_category {
@@ -43,6 +49,18 @@ public:
             return "PayloadTooLong";
         case MessageEmpty:
             return "MessageEmpty";
+        case InvalidUtf8:
+            return "InvalidUtf8";
+        case InvalidStreamFrame:
+            return "InvalidStreamFrame";
+        case InvalidAckFrame:
+            return "InvalidAckFrame";
+        case RateLimitExceeded:
+            return "RateLimitExceeded";
+        case MessagesDropped:
+            return "MessagesDropped";
+        case TooManyStreams:
+            return "TooManyStreams";
         }
 
         return "Unknown error";
@@ -14,7 +14,7 @@ namespace wsocket {
  * Bit layout:
  * - Bits 0-3: Operation code (message type)
  * - Bit 4: Reserved for future use
- * - Bit 5: Reserved for future use
+ * - Bit 5: Stream flag, the payload starts with a 4 byte logical stream id (network byte order)
  * - Bit 6: Reserved for future use (commonly used for compression)
  * - Bit 7: Final frame indicator (1 = last frame in sequence)
  * - Second byte: Basic payload length or extended length indicator
@@ -50,6 +50,11 @@ public:
     bool Compressed() const { return header_.rsv1; }
     void Compressed(bool compressed) { this->header_.rsv1 = compressed; }
 
+    // Text/Binary frame of a logical stream, the stream id leads the payload
+    bool HasStream() const { return header_.rsv2; }
+    void HasStream(bool has_stream) { this->header_.rsv2 = has_stream; }
+    static constexpr size_t STREAM_ID_SIZE = 4;
+
     // Frame type enumeration and methods
     enum FrameType {
         System = 0x0,
@@ -58,6 +63,7 @@ public:
         Close  = 0x8,
         Ping   = 0x9,
         Pong   = 0xA,
+        Ack    = 0xB, // cumulative count of processed messages, reliable mode
     };
     FrameType Type() const { return static_cast<FrameType>(this->header_.opcode); }
     void      Type(FrameType type) { this->header_.opcode = static_cast<uint8_t>(type); }
@@ -73,32 +79,27 @@ public:
         return header_.payload_length;
     }
     void Length(uint64_t len) {
-        if(len < 0b1111'1110) {
-            this->header_.payload_length = len;
-        } else if(len <= std::numeric_limits<uint16_t>::max()) {
-            this->header_.payload_length = 0b1111'1110;
-            this->payload_length_        = ntohs(len);
-        } else {
-            this->header_.payload_length = 0b1111'1111;
-            this->payload_length_        = ntohll(len);
+        this->header_.payload_length = LengthMarker(len);
+        if(header_.payload_length == 0b1111'1110) {
+            this->payload_length_ = ntohs(len);
+        } else if(header_.payload_length == 0b1111'1111) {
+            this->payload_length_ = ntohll(len);
         }
     }
+    // Second header byte for a payload of `len` bytes: the length itself, 254 (16 bit follows) or 255 (64 bit follows)
+    static constexpr uint8_t LengthMarker(uint64_t len) {
+        return len < 0b1111'1110 ? static_cast<uint8_t>(len)
+                                 : (len <= std::numeric_limits<uint16_t>::max() ? 0b1111'1110 : 0b1111'1111);
+    }
 
     // Calculate total header size based on payload length encoding
-    int HeaderLength() const {
-        // 2 bytes
-        static constexpr int basic_len = sizeof(BasicHeader);
+    int HeaderLength() const { return HeaderLength(header_.payload_length); }
 
-        if(header_.payload_length < 0b1111'1110) {
-            // 2 bytes
-            return basic_len;
-        } else if(header_.payload_length == 0b1111'1111) {
-            // 2 + 2 bytes
-            return basic_len + sizeof(uint16_t);
-        } else {
-            // 2 + 8 bytes
-            return basic_len + sizeof(uint64_t);
-        }
+    // Header size for a length marker: 0-253 -> 2 bytes, 254 -> 2 + 2 bytes, 255 -> 2 + 8 bytes
+    static constexpr int HeaderLength(uint8_t length_marker) {
+        // branch free, tiny frames are parsed in tight loops
+        return static_cast<int>(sizeof(BasicHeader)) +
+               (length_marker >= 0b1111'1110) * (2 + (length_marker == 0b1111'1111) * 6);
     }
 
 private:
@@ -126,16 +127,20 @@ struct OwnedFrame : Frame {
 };
 
 enum class CloseCode : int {
-    CLOSE_NORMAL         = 1000,
-    CLOSE_PROTOCOL_ERROR = 1002,
-    INTERNAL_ERROR       = 1011,
+    CLOSE_NORMAL          = 1000,
+    CLOSE_PROTOCOL_ERROR  = 1002,
+    CLOSE_INVALID_PAYLOAD = 1007,
+    INTERNAL_ERROR        = 1011,
+    CLOSE_TRY_AGAIN_LATER = 1013,
 };
 
 inline const char *CloseMessage(CloseCode code) {
     static std::unordered_map<CloseCode, const char *> CloseMessageMap = {
             {CloseCode::CLOSE_NORMAL, "close normal"},
             {CloseCode::CLOSE_PROTOCOL_ERROR, "close protocol error"},
+            {CloseCode::CLOSE_INVALID_PAYLOAD, "close invalid payload"},
             {CloseCode::INTERNAL_ERROR, "internal error"},
+            {CloseCode::CLOSE_TRY_AGAIN_LATER, "try again later"},
     };
 
     auto it = CloseMessageMap.find(code);
@@ -0,0 +1,213 @@
+#pragma once
+#ifndef WSOCKET__FRAME_POOL_HPP
+#define WSOCKET__FRAME_POOL_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <utility>
+
+#include "SlidingBuffer.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Header of a refcounted outbound buffer, the payload follows it in the same allocation
+ *
+ * `release` is called by the last FrameBuffer handle, which lets a custom FrameAllocator put
+ * blocks back wherever it took them from.
+ */
+struct FrameBlock {
+    std::atomic<uint32_t> refs{1};
+    uint32_t              size_class = 0;
+    size_t                capacity   = 0;
+    void (*release)(FrameBlock *)    = nullptr;
+
+    uint8_t *Data() { return reinterpret_cast<uint8_t *>(this + 1); }
+
+    // Placement-construct a block in raw storage of sizeof(FrameBlock) + capacity bytes
+    static FrameBlock *
+    Construct(void *storage, size_t capacity, void (*release)(FrameBlock *), uint32_t size_class = 0) {
+        auto *block       = new(storage) FrameBlock;
+        block->capacity   = capacity;
+        block->release    = release;
+        block->size_class = size_class;
+        return block;
+    }
+};
+
+/**
+ * Refcounted handle to one encoded frame (or several), converts to Buffer
+ *
+ * Copies share the block, so a transport can keep frames queued for an async write without
+ * copying them. The last handle returns the block through FrameBlock::release.
+ */
+class FrameBuffer {
+public:
+    FrameBuffer() = default;
+    // adopts the block's initial reference
+    FrameBuffer(FrameBlock *block, size_t size) : block_(block), size_(size) {}
+
+    FrameBuffer(const FrameBuffer &other) : block_(other.block_), size_(other.size_) {
+        if(block_) {
+            block_->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    FrameBuffer(FrameBuffer &&other) noexcept :
+        block_(std::exchange(other.block_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    FrameBuffer &operator=(FrameBuffer other) noexcept {
+        std::swap(block_, other.block_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+    ~FrameBuffer() { Reset(); }
+
+    void Reset() {
+        if(block_ == nullptr) {
+            return;
+        }
+        // the sole owner skips the atomic read-modify-write, the common case for synchronous sends
+        if(block_->refs.load(std::memory_order_acquire) == 1 ||
+           block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block_->release(block_);
+        }
+        block_ = nullptr;
+        size_  = 0;
+    }
+
+    uint8_t *Data() const { return block_ ? block_->Data() : nullptr; }
+    size_t   Size() const { return size_; }
+    size_t   Capacity() const { return block_ ? block_->capacity : 0; }
+    void     Resize(size_t size) {
+        assert(size <= Capacity());
+        size_ = size;
+    }
+
+    explicit operator bool() const { return block_ != nullptr; }
+    operator Buffer() const { return {Data(), size_}; }
+
+    // Unpooled block from the global heap
+    static FrameBuffer Heap(size_t size) {
+        void *storage = ::operator new(sizeof(FrameBlock) + size);
+        return {FrameBlock::Construct(storage, size, [](FrameBlock *block) { FreeBlock(block); }), size};
+    }
+
+    static void FreeBlock(FrameBlock *block) {
+        block->~FrameBlock();
+        ::operator delete(static_cast<void *>(block));
+    }
+
+private:
+    FrameBlock *block_ = nullptr;
+    size_t      size_  = 0;
+};
+
+// Hook returning a buffer of at least `size` bytes, FrameBuffer::Size() == size
+using FrameAllocator = std::function<FrameBuffer(size_t size)>;
+
+/**
+ * Size-classed, thread-local cache of frame blocks
+ *
+ * Allocate() takes a block of the smallest fitting class from the calling thread's free list,
+ * the last handle puts it on the free list of the thread that releases it. Each class caches at
+ * most CACHE_BYTES per thread, frames above the largest class come from the heap.
+ */
+class FramePool {
+    static constexpr size_t CLASS_COUNT             = 6;
+    static constexpr size_t CLASS_SIZE[CLASS_COUNT] = {64, 256, 1024, 4 * 1024, 16 * 1024, 64 * 1024};
+    static constexpr size_t CACHE_BYTES             = 1024 * 1024; // per class and thread
+
+public:
+    static FrameBuffer Allocate(size_t size) {
+        for(uint32_t c = 0; c < CLASS_COUNT; ++c) {
+            if(size <= CLASS_SIZE[c]) {
+                return {Local().Take(c), size};
+            }
+        }
+        return FrameBuffer::Heap(size);
+    }
+
+    // Blocks cached by the calling thread, for tests and diagnostics
+    static size_t CachedBlocks() {
+        size_t n = 0;
+        for(auto &list : Local().free_) {
+            n += list.count;
+        }
+        return n;
+    }
+
+    ~FramePool() {
+        State() = Dead;
+        for(auto &list : free_) {
+            while(list.head) {
+                auto *next = list.head->next;
+                FrameBuffer::FreeBlock(&list.head->block);
+                list.head = next;
+            }
+        }
+    }
+
+private:
+    // a cached block reuses its payload area as the free list link
+    struct FreeNode {
+        FrameBlock block;
+        FreeNode  *next;
+    };
+    struct FreeList {
+        FreeNode *head  = nullptr;
+        size_t    count = 0;
+    };
+
+    enum ThreadState { Unused, Alive, Dead };
+
+    static ThreadState &State() {
+        thread_local ThreadState state = Unused;
+        return state;
+    }
+    static FramePool &Local() {
+        thread_local FramePool pool;
+        State() = Alive;
+        return pool;
+    }
+
+    FrameBlock *Take(uint32_t c) {
+        auto &list = free_[c];
+        if(list.head) {
+            auto *node = list.head;
+            list.head  = node->next;
+            --list.count;
+            node->block.refs.store(1, std::memory_order_relaxed);
+            return &node->block;
+        }
+        void *storage = ::operator new(sizeof(FrameBlock) + CLASS_SIZE[c]);
+        return FrameBlock::Construct(storage, CLASS_SIZE[c], &FramePool::Release, c);
+    }
+
+    static void Release(FrameBlock *block) {
+        // a thread whose pool is already destroyed hands memory straight back
+        if(State() == Dead) {
+            FrameBuffer::FreeBlock(block);
+            return;
+        }
+        auto &list = Local().free_[block->size_class];
+        if(list.count * CLASS_SIZE[block->size_class] >= CACHE_BYTES) {
+            FrameBuffer::FreeBlock(block);
+            return;
+        }
+        auto *node = reinterpret_cast<FreeNode *>(block);
+        node->next = list.head;
+        list.head  = node;
+        ++list.count;
+    }
+
+private:
+    FreeList free_[CLASS_COUNT];
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__FRAME_POOL_HPP
@@ -0,0 +1,127 @@
+#pragma once
+#ifndef WSOCKET__FRAME_SCANNER_HPP
+#define WSOCKET__FRAME_SCANNER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "CpuFeatures.hpp"
+
+
+namespace wsocket {
+
+// Position of one frame inside a receive buffer
+struct FrameIndex {
+    uint32_t offset; // header offset
+    uint32_t length; // payload length
+};
+
+/**
+ * Index a run of short frames (2 byte header, payload length 0-253)
+ *
+ * Walks complete short frames from the start of `data` and writes one FrameIndex per frame,
+ * stopping at the first frame with an extended length, the first incomplete frame, or after
+ * `max_count` frames. `scanned` receives the number of bytes covered by the indexed frames.
+ *
+ * When the CPU supports AVX2 runs of identical headers (same flags, opcode and length, the
+ * usual shape of a tiny-frame stream) are verified 8 frames at a time with one gather, and
+ * their index entries are emitted with two vector stores. Other input takes the scalar path.
+ */
+class FrameScanner {
+public:
+    static size_t Scan(const uint8_t *data, size_t size, FrameIndex *out, size_t max_count, size_t *scanned) {
+#ifdef WSOCKET_HAS_X86_SIMD
+        if(CpuHasAvx2()) {
+            return ScanAvx2(data, size, out, max_count, scanned);
+        }
+#endif
+        return ScanScalar(data, size, out, max_count, scanned);
+    }
+
+    static size_t ScanScalar(const uint8_t *data, size_t size, FrameIndex *out, size_t max_count, size_t *scanned) {
+        size_t pos   = 0;
+        size_t count = 0;
+        while(count < max_count) {
+            if(!ScalarStep(data, size, pos, out[count])) {
+                break;
+            }
+            ++count;
+        }
+        *scanned = pos;
+        return count;
+    }
+
+#ifdef WSOCKET_HAS_X86_SIMD
+    WSOCKET_TARGET_AVX2 static size_t
+    ScanAvx2(const uint8_t *data, size_t size, FrameIndex *out, size_t max_count, size_t *scanned) {
+        static constexpr size_t lanes = 8;
+
+        const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+        size_t pos   = 0;
+        size_t count = 0;
+        while(count < max_count) {
+            if(pos + 2 > size) {
+                break;
+            }
+
+            uint16_t word;
+            std::memcpy(&word, data + pos, sizeof(word));
+            size_t payload = word >> 8;
+            size_t stride  = payload + 2;
+
+            // the gather loads 4 bytes per lane, the last lane starts at pos + 7 * stride
+            if(payload < 0b1111'1110 && count + lanes <= max_count && pos + (lanes - 1) * stride + 4 <= size &&
+               pos + lanes * stride <= size && pos + lanes * stride <= UINT32_MAX) {
+                __m256i offsets = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(pos)),
+                                                   _mm256_mullo_epi32(iota, _mm256_set1_epi32(static_cast<int>(stride))));
+                __m256i headers = _mm256_and_si256(
+                        _mm256_i32gather_epi32(reinterpret_cast<const int *>(data), offsets, 1), mask);
+
+                if(_mm256_movemask_epi8(_mm256_cmpeq_epi32(headers, _mm256_set1_epi32(word))) == -1) {
+                    // interleave {offset, length} pairs, lanes 0-3 then 4-7
+                    __m256i lengths = _mm256_set1_epi32(static_cast<int>(payload));
+                    __m256i lo      = _mm256_unpacklo_epi32(offsets, lengths); // 0 1 | 4 5
+                    __m256i hi      = _mm256_unpackhi_epi32(offsets, lengths); // 2 3 | 6 7
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + count),
+                                        _mm256_permute2x128_si256(lo, hi, 0x20));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + count + 4),
+                                        _mm256_permute2x128_si256(lo, hi, 0x31));
+
+                    count += lanes;
+                    pos += lanes * stride;
+                    continue;
+                }
+            }
+
+            if(!ScalarStep(data, size, pos, out[count])) {
+                break;
+            }
+            ++count;
+        }
+        *scanned = pos;
+        return count;
+    }
+#endif
+
+private:
+    static bool ScalarStep(const uint8_t *data, size_t size, size_t &pos, FrameIndex &index) {
+        if(pos + 2 > size) {
+            return false;
+        }
+        size_t payload = data[pos + 1];
+        if(payload >= 0b1111'1110 || pos + 2 + payload > size || pos + 2 + payload > UINT32_MAX) {
+            return false;
+        }
+        index.offset = static_cast<uint32_t>(pos);
+        index.length = static_cast<uint32_t>(payload);
+        pos += 2 + payload;
+        return true;
+    }
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__FRAME_SCANNER_HPP
@@ -0,0 +1,150 @@
+#pragma once
+#ifndef WSOCKET__HANDSHAKE_HPP
+#define WSOCKET__HANDSHAKE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SlidingBuffer.hpp"
+#include "compress/CompressManager.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Payload of the System frame exchanged when a connection starts
+ *
+ * Binary layout: one version byte below 0x20, then TLV fields (type byte, length byte, value).
+ * Integers are 4 or 8 bytes in network byte order, unknown fields are skipped. The legacy payload is
+ * the ';' separated codec names, which always start with a printable character (or are empty).
+ */
+struct HandshakeInfo {
+    static constexpr uint8_t VERSION = 0x01;
+
+    enum Field : uint8_t {
+        Codecs        = 0x01, // one CompressType per byte, in order of preference
+        MaxFrameSize  = 0x02, // largest Text/Binary frame payload wanted, 0 = unlimited
+        ReceiveBuffer = 0x03, // receive buffer base size, a hint for fragment sizes
+        SessionToken  = 0x04, // session to resume, empty to ask for a new one (see Session)
+        Received      = 0x05, // data frames of the session received so far
+        ReplayFrom    = 0x06, // oldest data frame of the session the sender can still replay
+        Reliable      = 0x07, // empty, the sender acknowledges processed messages
+    };
+
+    std::vector<CompressType> compress_types;
+    uint32_t                  max_frame_size = 0;
+    uint32_t                  receive_buffer = 0;
+    bool                      legacy         = false; // peer sent the ';' separated names
+
+    bool        session     = false; // SessionToken present
+    std::string session_token;
+    uint64_t    received    = 0;
+    uint64_t    replay_from = 0;
+
+    bool reliable = false;
+
+    std::string Encode() const {
+        std::string out(1, static_cast<char>(VERSION));
+        out += static_cast<char>(Codecs);
+        out += static_cast<char>(compress_types.size());
+        for(auto type : compress_types) {
+            out += static_cast<char>(type);
+        }
+        if(max_frame_size) {
+            EncodeInt(out, MaxFrameSize, max_frame_size, 4);
+        }
+        if(receive_buffer) {
+            EncodeInt(out, ReceiveBuffer, receive_buffer, 4);
+        }
+        if(session) {
+            out += static_cast<char>(SessionToken);
+            out += static_cast<char>(session_token.size());
+            out += session_token;
+            EncodeInt(out, Received, received, 8);
+            EncodeInt(out, ReplayFrom, replay_from, 8);
+        }
+        if(reliable) {
+            out += static_cast<char>(Reliable);
+            out += '\0';
+        }
+        return out;
+    }
+
+    // false on a truncated or malformed binary payload
+    bool Decode(const Buffer &payload) {
+        *this = HandshakeInfo{};
+        if(payload.size == 0 || payload.buf[0] >= 0x20) {
+            legacy         = true;
+            compress_types = CompressManager::Instance().GetSupportedCompressTypes(
+                    std::string(reinterpret_cast<const char *>(payload.buf), payload.size));
+            return true;
+        }
+
+        size_t pos = 1;
+        while(pos < payload.size) {
+            if(payload.size - pos < 2 || payload.size - pos - 2 < payload.buf[pos + 1]) {
+                return false;
+            }
+            auto type  = payload.buf[pos];
+            auto len   = payload.buf[pos + 1];
+            auto value = payload.buf + pos + 2;
+            pos += 2 + len;
+
+            switch(type) {
+            case Codecs:
+                for(size_t i = 0; i < len; ++i) {
+                    auto codec = static_cast<CompressType>(value[i]);
+                    if(CompressManager::Instance().IsSupported(codec)) {
+                        compress_types.push_back(codec);
+                    }
+                }
+                break;
+            case MaxFrameSize:
+            case ReceiveBuffer:
+                if(len != 4) {
+                    return false;
+                }
+                (type == MaxFrameSize ? max_frame_size : receive_buffer) = static_cast<uint32_t>(DecodeInt(value, 4));
+                break;
+            case SessionToken:
+                session = true;
+                session_token.assign(reinterpret_cast<const char *>(value), len);
+                break;
+            case Received:
+            case ReplayFrom:
+                if(len != 8) {
+                    return false;
+                }
+                (type == Received ? received : replay_from) = DecodeInt(value, 8);
+                break;
+            case Reliable:
+                reliable = true;
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+private:
+    static void EncodeInt(std::string &out, Field field, uint64_t value, int size) {
+        out += static_cast<char>(field);
+        out += static_cast<char>(size);
+        for(int shift = (size - 1) * 8; shift >= 0; shift -= 8) {
+            out += static_cast<char>((value >> shift) & 0xFF);
+        }
+    }
+    static uint64_t DecodeInt(const uint8_t *value, int size) {
+        uint64_t n = 0;
+        for(int i = 0; i < size; ++i) {
+            n = n << 8 | value[i];
+        }
+        return n;
+    }
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__HANDSHAKE_HPP
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef WSOCKET__INDEX_STACK_HPP
+#define WSOCKET__INDEX_STACK_HPP
+
+#include <atomic>
+#include <cstdint>
+
+
+namespace wsocket {
+
+/**
+ * Lock-free stack of the indices 0..N-1, e.g. the free slots of a fixed array
+ *
+ * Push() and Pop() may be called from any thread. The head packs the top index with a tag that
+ * every change increments, so a Pop() that read a stale `next` (the index was taken and given back
+ * meanwhile) fails its CAS instead of corrupting the stack; there is no ABA problem. Each index must
+ * be pushed at most once before it is popped again.
+ */
+template <uint32_t N>
+class IndexStack {
+public:
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    void Push(uint32_t index) {
+        auto head = head_.load(std::memory_order_relaxed);
+        do {
+            next_[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        } while(!head_.compare_exchange_weak(head, Pack(head, index + 1), std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+    // NONE when empty
+    uint32_t Pop() {
+        auto head = head_.load(std::memory_order_acquire);
+        do {
+            auto top = static_cast<uint32_t>(head);
+            if(top == 0) {
+                return NONE;
+            }
+            auto next = next_[top - 1].load(std::memory_order_relaxed);
+            if(head_.compare_exchange_weak(head, Pack(head, next), std::memory_order_acquire,
+                                           std::memory_order_acquire)) {
+                return top - 1;
+            }
+        } while(true);
+    }
+
+private:
+    // low half index + 1 (0 for empty), high half the tag
+    static uint64_t Pack(uint64_t head, uint32_t top) { return ((head >> 32) + 1) << 32 | top; }
+
+    alignas(64) std::atomic<uint64_t> head_{0};
+    std::atomic<uint32_t> next_[N] = {};
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__INDEX_STACK_HPP
@@ -0,0 +1,239 @@
+#pragma once
+#ifndef WSOCKET__LOOPBACK_PIPE_HPP
+#define WSOCKET__LOOPBACK_PIPE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "WSocketContext.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Lock-free single-producer single-consumer byte ring
+ *
+ * Capacity is rounded up to a power of two. Positions grow monotonically and are masked on access,
+ * each side keeps a cached copy of the other side's position to avoid touching the shared cache line
+ * on every call.
+ */
+class SpscByteRing {
+public:
+    explicit SpscByteRing(size_t capacity) {
+        size_t cap = 1;
+        while(cap < capacity) {
+            cap <<= 1;
+        }
+        data_     = std::make_unique<uint8_t[]>(cap);
+        capacity_ = cap;
+    }
+
+    SpscByteRing(const SpscByteRing &)            = delete;
+    SpscByteRing &operator=(const SpscByteRing &) = delete;
+
+    size_t Capacity() const { return capacity_; }
+
+    // Producer side: copy as many bytes as fit, returns bytes written
+    size_t Write(const uint8_t *data, size_t len) {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if(capacity_ - (tail - head_cache_) < len) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+        }
+
+        len = std::min(len, capacity_ - (tail - head_cache_));
+        if(len == 0) {
+            return 0;
+        }
+
+        auto pos   = tail & (capacity_ - 1);
+        auto first = std::min(len, capacity_ - pos);
+        std::memcpy(data_.get() + pos, data, first);
+        std::memcpy(data_.get(), data + first, len - first);
+
+        tail_.store(tail + len, std::memory_order_release);
+        return len;
+    }
+
+    // Consumer side: copy up to dst.size bytes, returns bytes read
+    size_t Read(Buffer dst) {
+        auto head = head_.load(std::memory_order_relaxed);
+        if(tail_cache_ - head < dst.size) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+        }
+
+        auto len = std::min(dst.size, tail_cache_ - head);
+        if(len == 0) {
+            return 0;
+        }
+
+        auto pos   = head & (capacity_ - 1);
+        auto first = std::min(len, capacity_ - pos);
+        std::memcpy(dst.buf, data_.get() + pos, first);
+        std::memcpy(dst.buf + first, data_.get(), len - first);
+
+        head_.store(head + len, std::memory_order_release);
+        return len;
+    }
+
+    bool Empty() const { return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire); }
+
+private:
+    std::unique_ptr<uint8_t[]> data_;
+    size_t                     capacity_ = 0;
+
+    alignas(64) std::atomic<size_t> head_{0}; // consumer position
+    size_t tail_cache_ = 0;                   // consumer's view of tail_
+    alignas(64) std::atomic<size_t> tail_{0}; // producer position
+    size_t head_cache_ = 0;                   // producer's view of head_
+};
+
+/**
+ * In-process transport pairing two contexts (WSocketContext or any BasicWSocketContext)
+ * through a lock-free ring per direction
+ *
+ * Each context's send handler writes its frames into the peer's ring, Poll* drains a ring
+ * straight into the context receive buffer. No syscall is involved, which makes framing,
+ * compression and dispatch measurable in isolation and keeps tests deterministic.
+ *
+ * Mode::Inline  - everything runs on one thread, call Run() to pump both directions.
+ *                 A full ring is drained inline by the writer.
+ * Mode::Threaded- one thread per context calls PollFirst()/PollSecond() in its loop.
+ *                 A full ring makes the writer yield until the reader catches up. Meanwhile it
+ *                 moves its own inbound ring aside, so two writers filling each other's ring at
+ *                 once (e.g. a Pong written while parsing a burst) do not wait on each other;
+ *                 the next Poll feeds those bytes first.
+ */
+template <typename Context>
+class BasicLoopbackPipe {
+public:
+    enum class Mode {
+        Inline,
+        Threaded,
+    };
+
+    static constexpr size_t RING_SIZE_DEFAULT = 1024 * 1024; // 1M
+
+    BasicLoopbackPipe(Context &first,
+                      Context &second,
+                      Mode     mode      = Mode::Inline,
+                      size_t   ring_size = RING_SIZE_DEFAULT) :
+        mode_(mode), first_(first, ring_size), second_(second, ring_size) {
+        first.ResetSendHandler([this](const Buffer &data) { this->Write(second_, data); });
+        second.ResetSendHandler([this](const Buffer &data) { this->Write(first_, data); });
+    }
+    ~BasicLoopbackPipe() {
+        first_.ctx->ResetSendHandler(nullptr);
+        second_.ctx->ResetSendHandler(nullptr);
+    }
+
+    BasicLoopbackPipe(const BasicLoopbackPipe &)            = delete;
+    BasicLoopbackPipe &operator=(const BasicLoopbackPipe &) = delete;
+
+    // Deliver bytes pending for the first/second context, returns bytes delivered
+    size_t PollFirst() { return Poll(first_); }
+    size_t PollSecond() { return Poll(second_); }
+
+    // Pump both directions until both rings are empty (Mode::Inline only)
+    size_t Run() {
+        assert(mode_ == Mode::Inline);
+
+        size_t total = 0;
+        while(true) {
+            auto n = Poll(first_) + Poll(second_);
+            if(n == 0) {
+                break;
+            }
+            total += n;
+        }
+        return total;
+    }
+
+private:
+    struct Endpoint {
+        Endpoint(Context &context, size_t ring_size) : ctx(&context), ring(ring_size) {}
+
+        Context             *ctx;
+        SpscByteRing         ring;  // bytes waiting to be fed into ctx
+        std::vector<uint8_t> spill; // taken off the ring by a blocked writer, fed before the ring
+        bool                 polling{false};
+    };
+
+    void Write(Endpoint &to, const Buffer &data) {
+        size_t pos = 0;
+        while(pos < data.size) {
+            pos += to.ring.Write(data.buf + pos, data.size - pos);
+            if(pos == data.size) {
+                break;
+            }
+
+            if(mode_ == Mode::Threaded) {
+                // the peer may be blocked writing to us, keep our side moving; the context is busy
+                // sending (or parsing) on this thread and cannot be fed here
+                this->Spill(&to == &first_ ? second_ : first_);
+                std::this_thread::yield();
+                continue;
+            }
+
+            // the reader is this thread, drain it now; a re-entrant drain means the ring is too small
+            // to hold both directions' bursts
+            assert(!to.polling);
+            Poll(to);
+        }
+    }
+
+    // Writer thread of `ep`'s context, which is also the reader of its ring
+    void Spill(Endpoint &ep) {
+        uint8_t chunk[4096];
+        while(auto n = ep.ring.Read({chunk, sizeof(chunk)})) {
+            ep.spill.insert(ep.spill.end(), chunk, chunk + n);
+        }
+    }
+
+    size_t Poll(Endpoint &ep) {
+        ep.polling   = true;
+        size_t total = 0;
+        while(true) {
+            size_t n = 0;
+            if(!ep.spill.empty()) {
+                // older than what is left in the ring; a write from Feed may spill again
+                auto spill = std::move(ep.spill);
+                ep.spill.clear();
+                n = spill.size();
+                ep.ctx->Feed({spill.data(), n});
+            } else if(auto dst = ep.ctx->PrepareWrite(); dst.size > 0) {
+                // read straight into the parser buffer
+                n = ep.ring.Read(dst);
+                if(n > 0) {
+                    ep.ctx->CommitWrite(n);
+                }
+            } else {
+                // receive buffer is full of a partial frame, let Feed grow it
+                uint8_t chunk[4096];
+                n = ep.ring.Read({chunk, sizeof(chunk)});
+                if(n > 0) {
+                    ep.ctx->Feed({chunk, n});
+                }
+            }
+
+            if(n == 0) {
+                break;
+            }
+            total += n;
+        }
+        ep.polling = false;
+        return total;
+    }
+
+private:
+    Mode     mode_;
+    Endpoint first_;
+    Endpoint second_;
+};
+
+using LoopbackPipe = BasicLoopbackPipe<WSocketContext>;
+
+} // namespace wsocket
+
+#endif // WSOCKET__LOOPBACK_PIPE_HPP
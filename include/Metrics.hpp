@@ -0,0 +1,301 @@
+#pragma once
+#ifndef WSOCKET__METRICS_HPP
+#define WSOCKET__METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+
+
+namespace wsocket {
+
+// Plain copy of the counters, safe to pass around and sum
+struct MetricsSnapshot {
+    static constexpr size_t OPCODES = 16;
+
+    uint64_t frames_received[OPCODES] = {}; // by FrameHeader::FrameType
+    uint64_t frames_sent[OPCODES]     = {};
+
+    uint64_t wire_bytes_received    = 0; // bytes read from / written to the transport
+    uint64_t wire_bytes_sent        = 0;
+    uint64_t message_bytes_received = 0; // Text/Binary payload after decompression
+    uint64_t message_bytes_sent     = 0; // Text/Binary payload before compression
+
+    uint64_t compress_ns          = 0;
+    uint64_t compress_bytes_in    = 0;
+    uint64_t compress_bytes_out   = 0;
+    uint64_t decompress_ns        = 0;
+    uint64_t decompress_bytes_in  = 0;
+    uint64_t decompress_bytes_out = 0;
+
+    uint64_t errors             = 0; // everything reported through OnError
+    uint64_t parse_errors       = 0; // received data that could not be decoded
+    uint64_t keepalive_timeouts = 0;
+    uint64_t send_queue_drops   = 0; // queued messages dropped by Close
+
+    uint64_t rate_limit_drops  = 0; // messages dropped by RateLimitPolicy::Drop
+    uint64_t rate_limit_pauses = 0; // times reading paused by RateLimitPolicy::Pause
+    uint64_t rate_limit_closes = 0; // connections closed by RateLimitPolicy::Close
+
+    uint64_t send_queue_frames    = 0; // gauges, frames/bytes accepted but not yet written
+    uint64_t send_queue_bytes     = 0;
+    uint64_t receive_buffer_bytes = 0; // gauge, receive buffer memory held
+    uint64_t rate_limit_paused    = 0; // gauge, connections not reading because of their rate limit
+    uint64_t connections          = 0; // live connections in a registry snapshot
+
+    // uncompressed / compressed, 0 when nothing was compressed
+    double CompressRatio() const {
+        return compress_bytes_out ? static_cast<double>(compress_bytes_in) / static_cast<double>(compress_bytes_out)
+                                  : 0;
+    }
+
+    MetricsSnapshot &operator+=(const MetricsSnapshot &other) {
+        for(size_t i = 0; i < OPCODES; ++i) {
+            frames_received[i] += other.frames_received[i];
+            frames_sent[i] += other.frames_sent[i];
+        }
+        wire_bytes_received += other.wire_bytes_received;
+        wire_bytes_sent += other.wire_bytes_sent;
+        message_bytes_received += other.message_bytes_received;
+        message_bytes_sent += other.message_bytes_sent;
+        compress_ns += other.compress_ns;
+        compress_bytes_in += other.compress_bytes_in;
+        compress_bytes_out += other.compress_bytes_out;
+        decompress_ns += other.decompress_ns;
+        decompress_bytes_in += other.decompress_bytes_in;
+        decompress_bytes_out += other.decompress_bytes_out;
+        errors += other.errors;
+        parse_errors += other.parse_errors;
+        keepalive_timeouts += other.keepalive_timeouts;
+        send_queue_drops += other.send_queue_drops;
+        rate_limit_drops += other.rate_limit_drops;
+        rate_limit_pauses += other.rate_limit_pauses;
+        rate_limit_closes += other.rate_limit_closes;
+        send_queue_frames += other.send_queue_frames;
+        send_queue_bytes += other.send_queue_bytes;
+        receive_buffer_bytes += other.receive_buffer_bytes;
+        rate_limit_paused += other.rate_limit_paused;
+        connections += other.connections;
+        return *this;
+    }
+};
+
+/**
+ * Counters of one connection
+ *
+ * Every counter has a single writer at a time (the thread driving the connection), so an update
+ * is a relaxed load and store instead of a locked read-modify-write and costs about as much as
+ * a plain increment. Any thread may call Snapshot() at any time.
+ */
+class ConnectionMetrics {
+    using counter = std::atomic<uint64_t>;
+
+public:
+    static void Add(counter &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void Sub(counter &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) - n, std::memory_order_relaxed);
+    }
+
+    void FrameReceived(uint8_t opcode) { Add(frames_received[opcode & 0xF], 1); }
+    void FrameSent(uint8_t opcode) { Add(frames_sent[opcode & 0xF], 1); }
+
+    MetricsSnapshot Snapshot() const {
+        MetricsSnapshot s;
+        for(size_t i = 0; i < MetricsSnapshot::OPCODES; ++i) {
+            s.frames_received[i] = Load(frames_received[i]);
+            s.frames_sent[i]     = Load(frames_sent[i]);
+        }
+        s.wire_bytes_received    = Load(wire_bytes_received);
+        s.wire_bytes_sent        = Load(wire_bytes_sent);
+        s.message_bytes_received = Load(message_bytes_received);
+        s.message_bytes_sent     = Load(message_bytes_sent);
+        s.compress_ns            = Load(compress_ns);
+        s.compress_bytes_in      = Load(compress_bytes_in);
+        s.compress_bytes_out     = Load(compress_bytes_out);
+        s.decompress_ns          = Load(decompress_ns);
+        s.decompress_bytes_in    = Load(decompress_bytes_in);
+        s.decompress_bytes_out   = Load(decompress_bytes_out);
+        s.errors                 = Load(errors);
+        s.parse_errors           = Load(parse_errors);
+        s.keepalive_timeouts     = Load(keepalive_timeouts);
+        s.send_queue_drops       = Load(send_queue_drops);
+        s.rate_limit_drops       = Load(rate_limit_drops);
+        s.rate_limit_pauses      = Load(rate_limit_pauses);
+        s.rate_limit_closes      = Load(rate_limit_closes);
+        s.send_queue_frames      = Load(send_queue_frames);
+        s.send_queue_bytes       = Load(send_queue_bytes);
+        s.receive_buffer_bytes   = Load(receive_buffer_bytes);
+        s.rate_limit_paused      = Load(rate_limit_paused);
+        s.connections            = 1;
+        return s;
+    }
+
+public:
+    counter frames_received[MetricsSnapshot::OPCODES] = {};
+    counter frames_sent[MetricsSnapshot::OPCODES]     = {};
+
+    counter wire_bytes_received{0};
+    counter wire_bytes_sent{0};
+    counter message_bytes_received{0};
+    counter message_bytes_sent{0};
+
+    counter compress_ns{0};
+    counter compress_bytes_in{0};
+    counter compress_bytes_out{0};
+    counter decompress_ns{0};
+    counter decompress_bytes_in{0};
+    counter decompress_bytes_out{0};
+
+    counter errors{0};
+    counter parse_errors{0};
+    counter keepalive_timeouts{0};
+    counter send_queue_drops{0};
+
+    counter rate_limit_drops{0};
+    counter rate_limit_pauses{0};
+    counter rate_limit_closes{0};
+
+    counter send_queue_frames{0};
+    counter send_queue_bytes{0};
+    counter receive_buffer_bytes{0};
+    counter rate_limit_paused{0};
+
+private:
+    static uint64_t Load(const counter &c) { return c.load(std::memory_order_relaxed); }
+};
+
+/**
+ * Process wide view of all connections
+ *
+ * Contexts register their ConnectionMetrics for their lifetime; on unregister the final values
+ * are folded into a retired total so counters never go backwards. Snapshot() sums both.
+ */
+class MetricsRegistry {
+    MetricsRegistry() = default;
+
+public:
+    static MetricsRegistry &Instance() {
+        static MetricsRegistry instance;
+        return instance;
+    }
+
+    void Register(const ConnectionMetrics *metrics) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        live_.insert(metrics);
+    }
+    void Unregister(const ConnectionMetrics *metrics) {
+        auto s = metrics->Snapshot();
+        // gauges and the connection count describe live connections only
+        s.send_queue_frames    = 0;
+        s.send_queue_bytes     = 0;
+        s.receive_buffer_bytes = 0;
+        s.rate_limit_paused    = 0;
+        s.connections          = 0;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(live_.erase(metrics)) {
+            retired_ += s;
+        }
+    }
+
+    MetricsSnapshot Snapshot() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        MetricsSnapshot             total = retired_;
+        for(auto *metrics : live_) {
+            total += metrics->Snapshot();
+        }
+        return total;
+    }
+
+private:
+    mutable std::mutex                            mutex_;
+    std::unordered_set<const ConnectionMetrics *> live_;
+    MetricsSnapshot                               retired_;
+};
+
+// Render a snapshot in the Prometheus text exposition format, `labels` e.g. `instance="a"`
+inline std::string MetricsToPrometheus(const MetricsSnapshot &s, const std::string &labels = "") {
+    static const char *const opcode_names[MetricsSnapshot::OPCODES] = {
+            "system", "text", "binary", "0x3", "0x4", "0x5", "0x6", "0x7",
+            "close",  "ping", "pong",   "ack", "0xc", "0xd", "0xe", "0xf",
+    };
+
+    std::ostringstream out;
+    auto               with = [&](const std::string &extra) {
+        std::string all = labels.empty() ? extra : (extra.empty() ? labels : labels + "," + extra);
+        return all.empty() ? std::string() : "{" + all + "}";
+    };
+    auto metric = [&](const char *name, const char *type, const char *help, auto value) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n"
+            << name << with("") << " " << value << "\n";
+    };
+    auto frames = [&](const char *name, const char *help, const uint64_t *counts) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " counter\n";
+        for(size_t i = 0; i < MetricsSnapshot::OPCODES; ++i) {
+            if(counts[i] != 0) {
+                out << name << with(std::string("opcode=\"") + opcode_names[i] + "\"") << " " << counts[i] << "\n";
+            }
+        }
+    };
+
+    frames("wsocket_frames_received_total", "Frames received by opcode.", s.frames_received);
+    frames("wsocket_frames_sent_total", "Frames sent by opcode.", s.frames_sent);
+    metric("wsocket_wire_bytes_received_total", "counter", "Bytes read from the transport.", s.wire_bytes_received);
+    metric("wsocket_wire_bytes_sent_total", "counter", "Bytes written to the transport.", s.wire_bytes_sent);
+    metric("wsocket_message_bytes_received_total",
+           "counter",
+           "Text/Binary payload bytes received, after decompression.",
+           s.message_bytes_received);
+    metric("wsocket_message_bytes_sent_total",
+           "counter",
+           "Text/Binary payload bytes sent, before compression.",
+           s.message_bytes_sent);
+    metric("wsocket_compress_seconds_total", "counter", "Time spent compressing.", s.compress_ns / 1e9);
+    metric("wsocket_compress_bytes_in_total", "counter", "Bytes fed to the compressor.", s.compress_bytes_in);
+    metric("wsocket_compress_bytes_out_total", "counter", "Bytes produced by the compressor.", s.compress_bytes_out);
+    metric("wsocket_decompress_seconds_total", "counter", "Time spent decompressing.", s.decompress_ns / 1e9);
+    metric("wsocket_decompress_bytes_in_total", "counter", "Bytes fed to the decompressor.", s.decompress_bytes_in);
+    metric("wsocket_decompress_bytes_out_total",
+           "counter",
+           "Bytes produced by the decompressor.",
+           s.decompress_bytes_out);
+    metric("wsocket_compress_ratio", "gauge", "Uncompressed / compressed bytes sent.", s.CompressRatio());
+    metric("wsocket_errors_total", "counter", "Errors reported to listeners.", s.errors);
+    metric("wsocket_parse_errors_total", "counter", "Received data that could not be decoded.", s.parse_errors);
+    metric("wsocket_keepalive_timeouts_total",
+           "counter",
+           "Connections closed by keep-alive timeout.",
+           s.keepalive_timeouts);
+    metric("wsocket_send_queue_drops_total", "counter", "Queued messages dropped by Close.", s.send_queue_drops);
+    metric("wsocket_rate_limit_drops_total", "counter", "Messages dropped by the rate limit.", s.rate_limit_drops);
+    metric("wsocket_rate_limit_pauses_total",
+           "counter",
+           "Times reading paused by the rate limit.",
+           s.rate_limit_pauses);
+    metric("wsocket_rate_limit_closes_total",
+           "counter",
+           "Connections closed by the rate limit.",
+           s.rate_limit_closes);
+    metric("wsocket_send_queue_frames", "gauge", "Frames waiting to be written.", s.send_queue_frames);
+    metric("wsocket_send_queue_bytes", "gauge", "Bytes waiting to be written.", s.send_queue_bytes);
+    metric("wsocket_receive_buffer_bytes", "gauge", "Receive buffer memory held.", s.receive_buffer_bytes);
+    metric("wsocket_rate_limit_paused",
+           "gauge",
+           "Connections not reading because of their rate limit.",
+           s.rate_limit_paused);
+    metric("wsocket_connections", "gauge", "Live connections.", s.connections);
+    return out.str();
+}
+
+// Prometheus text of every connection in the process
+inline std::string MetricsToPrometheus() { return MetricsToPrometheus(MetricsRegistry::Instance().Snapshot()); }
+
+} // namespace wsocket
+
+#endif // WSOCKET__METRICS_HPP
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef WSOCKET__MPSC_QUEUE_HPP
+#define WSOCKET__MPSC_QUEUE_HPP
+
+#include <atomic>
+
+
+namespace wsocket {
+
+/**
+ * Lock-free multi-producer single-consumer queue of intrusive nodes (`Node *next`)
+ *
+ * Push() is a single CAS on the head, retried only when another producer got in between, and
+ * reports whether the queue was empty so producers wake the consumer once per batch instead of
+ * once per node. The consumer takes the whole batch with one exchange and reverses it into push
+ * order; nodes are never popped one by one, so there is no ABA problem.
+ */
+template <typename Node>
+class MpscQueue {
+public:
+    // Any thread, true when the queue was empty: the caller has to schedule the consumer
+    bool Push(Node *node) {
+        auto *head = head_.load(std::memory_order_relaxed);
+        do {
+            node->next = head;
+        } while(!head_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+
+    // Consumer only: everything pushed so far, oldest first, linked through `next`
+    Node *PopAll() {
+        auto *node = head_.exchange(nullptr, std::memory_order_acquire);
+        Node *fifo = nullptr;
+        while(node) {
+            auto *next = node->next;
+            node->next = fifo;
+            fifo       = node;
+            node       = next;
+        }
+        return fifo;
+    }
+
+    bool Empty() const { return head_.load(std::memory_order_acquire) == nullptr; }
+
+private:
+    alignas(64) std::atomic<Node *> head_{nullptr};
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__MPSC_QUEUE_HPP
@@ -0,0 +1,138 @@
+#pragma once
+#ifndef WSOCKET__RATE_LIMIT_HPP
+#define WSOCKET__RATE_LIMIT_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+
+
+namespace wsocket {
+
+/**
+ * Monotonic time cached per thread
+ *
+ * Tick() reads the clock, Now() returns the last reading: a receive path ticks once per read and
+ * every frame of that read sees the same time for free. Linux reads CLOCK_MONOTONIC_COARSE, a
+ * vDSO load of the last timer tick (1-4 ms resolution) that is much cheaper than the precise clock.
+ */
+class CoarseClock {
+public:
+    // nanoseconds
+    static int64_t Now() { return Cached(); }
+    static int64_t Tick() { return Cached() = Read(); }
+
+private:
+    static int64_t &Cached() {
+        thread_local int64_t now = Read();
+        return now;
+    }
+    static int64_t Read() {
+#ifdef CLOCK_MONOTONIC_COARSE
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+#endif
+    }
+};
+
+/**
+ * Tokens refilled at `rate` per second up to `burst`
+ *
+ * A cost is granted while the tokens cover it, or cover the whole burst for costs above it, and
+ * may take the bucket below zero: a large frame passes once and is paid back by the refill.
+ */
+class TokenBucket {
+public:
+    void Configure(double rate, double burst, int64_t now_ns) {
+        rate_   = std::max(rate, 0.0) / 1e9;
+        burst_  = burst > 0 ? burst : std::max(rate, 1.0);
+        tokens_ = burst_;
+        last_   = now_ns;
+    }
+    bool Enabled() const { return rate_ > 0; }
+
+    void Refill(int64_t now_ns) {
+        if(now_ns > last_) {
+            tokens_ = std::min(burst_, tokens_ + static_cast<double>(now_ns - last_) * rate_);
+            last_   = now_ns;
+        }
+    }
+    bool   Covers(double cost) const { return !Enabled() || tokens_ >= std::min(cost, burst_); }
+    void   Take(double cost) { tokens_ -= Enabled() ? cost : 0; }
+    double Tokens() const { return tokens_; }
+
+    // Nanoseconds until Covers(cost)
+    int64_t WaitNs(double cost) const {
+        auto missing = std::min(cost, burst_) - tokens_;
+        return this->Covers(cost) ? 0 : static_cast<int64_t>(missing / rate_) + 1;
+    }
+
+private:
+    double  rate_   = 0; // tokens per ns, 0 = unlimited
+    double  burst_  = 0;
+    double  tokens_ = 0;
+    int64_t last_   = 0;
+};
+
+// What a connection exceeding its limits gets
+enum class RateLimitPolicy {
+    Pause, // stop parsing and reading until the buckets refill, the peer is slowed by TCP flow control
+    Drop,  // deliver nothing of the messages starting while over the limit, Pause in reliable mode
+    Close, // Close(CLOSE_PROTOCOL_ERROR) and OnError(RateLimitExceeded)
+};
+
+struct RateLimitOptions {
+    double          messages_per_second = 0; // 0 = unlimited
+    double          bytes_per_second    = 0; // received Text/Binary payload, before decompression
+    double          message_burst       = 0; // 0 = one second's worth
+    double          byte_burst          = 0;
+    RateLimitPolicy policy              = RateLimitPolicy::Pause;
+};
+
+/**
+ * Inbound limits of one connection, a message bucket and a byte bucket
+ *
+ * Messages are charged on their first frame, bytes on every frame.
+ */
+class RateLimiter {
+public:
+    void Configure(const RateLimitOptions &options) {
+        auto now = CoarseClock::Tick();
+        messages_.Configure(options.messages_per_second, options.message_burst, now);
+        bytes_.Configure(options.bytes_per_second, options.byte_burst, now);
+        policy_ = options.policy;
+    }
+    bool            Enabled() const { return messages_.Enabled() || bytes_.Enabled(); }
+    RateLimitPolicy Policy() const { return policy_; }
+
+    void Refill(int64_t now_ns) {
+        messages_.Refill(now_ns);
+        bytes_.Refill(now_ns);
+    }
+    // A frame of `bytes` payload, starting a message or not, is within the limits
+    bool Admits(size_t bytes, bool first) const {
+        return (!first || messages_.Covers(1)) && bytes_.Covers(static_cast<double>(bytes));
+    }
+    void Charge(size_t bytes, bool first) {
+        messages_.Take(first ? 1 : 0);
+        bytes_.Take(static_cast<double>(bytes));
+    }
+
+    // Nanoseconds until another message and another byte are within the limits, 0 when they are
+    int64_t WaitNs() const { return std::max(messages_.WaitNs(1), bytes_.WaitNs(1)); }
+
+private:
+    TokenBucket     messages_;
+    TokenBucket     bytes_;
+    RateLimitPolicy policy_ = RateLimitPolicy::Pause;
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__RATE_LIMIT_HPP
@@ -0,0 +1,117 @@
+#pragma once
+#ifndef WSOCKET__RELIABLE_HPP
+#define WSOCKET__RELIABLE_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <optional>
+
+
+namespace wsocket {
+
+// Reliable mode of a connection (see BasicWSocketContext::SetReliable)
+struct ReliableOptions {
+    uint32_t                  ack_every = 32;          // ack once this many messages were processed
+    std::chrono::milliseconds ack_delay{20};           // or this long after the first unacked one
+    size_t                    window    = 1024 * 1024; // unacked payload bytes before sends are queued
+};
+
+/**
+ * Receive side: counts processed messages and decides when the cumulative ack goes out
+ *
+ * An ack is due once `every` messages are pending, or `delay` after the first of them; the
+ * transport asks Deadline() and calls back in time. The clock is read once per batch.
+ */
+class AckBatcher {
+public:
+    using clock = std::chrono::steady_clock;
+
+    void Configure(uint32_t every, std::chrono::milliseconds delay) {
+        every_ = std::max<uint32_t>(every, 1);
+        delay_ = delay;
+    }
+
+    // One more message processed, true when the ack is due right away
+    bool Processed() {
+        ++processed_;
+        if(pending_++ == 0) {
+            first_ = clock::now();
+        }
+        return pending_ >= every_ || delay_.count() <= 0;
+    }
+
+    std::optional<clock::time_point> Deadline() const {
+        if(pending_ == 0) {
+            return std::nullopt;
+        }
+        return first_ + delay_;
+    }
+
+    // Clear the batch, returns the count to acknowledge
+    uint64_t Take() {
+        pending_ = 0;
+        return processed_;
+    }
+    bool Pending() const { return pending_ != 0; }
+
+private:
+    uint32_t                  every_ = 32;
+    std::chrono::milliseconds delay_{20};
+    uint64_t                  processed_ = 0;
+    uint32_t                  pending_   = 0;
+    clock::time_point         first_;
+};
+
+/**
+ * Send side: numbers messages and holds the payload bytes written but not acknowledged
+ *
+ * Messages are numbered from 1 in the order their last frame is written. A message counts against
+ * the window once that frame is out: the peer can only acknowledge whole messages, so a window
+ * that stopped a message halfway would never open again.
+ */
+class SendWindow {
+public:
+    void Sent(size_t bytes, bool finish) {
+        open_bytes_ += bytes;
+        if(finish) {
+            messages_.push_back({++sequence_, open_bytes_});
+            bytes_ += open_bytes_;
+            open_bytes_ = 0;
+        }
+    }
+
+    // Release the messages up to `sequence`, false when it was never sent or goes backwards
+    bool Acknowledge(uint64_t sequence) {
+        if(sequence > sequence_ || sequence < acked_) {
+            return false;
+        }
+        while(!messages_.empty() && messages_.front().sequence <= sequence) {
+            bytes_ -= messages_.front().bytes;
+            messages_.pop_front();
+        }
+        acked_ = sequence;
+        return true;
+    }
+
+    size_t   Bytes() const { return bytes_; }
+    uint64_t Sequence() const { return sequence_; }
+    uint64_t Acked() const { return acked_; }
+
+private:
+    struct Message {
+        uint64_t sequence;
+        size_t   bytes;
+    };
+
+    std::deque<Message> messages_; // complete, not yet acknowledged
+    uint64_t            sequence_   = 0;
+    uint64_t            acked_      = 0;
+    size_t              bytes_      = 0;
+    size_t              open_bytes_ = 0; // written of the message in progress
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__RELIABLE_HPP
@@ -0,0 +1,278 @@
+#pragma once
+#ifndef WSOCKET__SESSION_HPP
+#define WSOCKET__SESSION_HPP
+
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <WinSock2.h>
+#include <bcrypt.h>
+#pragma comment(lib, "bcrypt.lib")
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/random.h>
+#endif
+#endif
+
+#include "FramePool.hpp"
+#include "compress/Compress.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Connection state that outlives the connection, for resuming it on a new one
+ *
+ * Data frames are numbered from 1 in each direction. The session counts the frames received and
+ * keeps the encoded frames sent, up to `window` bytes; the oldest are dropped first. A reconnect
+ * resumes when each side still holds every frame the other one is missing, and replays exactly
+ * those.
+ *
+ * A session belongs to one connection at a time: Attach() hands it to a new one, and the old one
+ * stops recording. All members are thread safe.
+ */
+class Session {
+public:
+    static constexpr size_t WINDOW_DEFAULT = 256 * 1024;
+    static constexpr size_t TOKEN_SIZE     = 16;
+
+    explicit Session(size_t window = WINDOW_DEFAULT) : window_(window) {}
+
+    std::string Token() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return token_;
+    }
+    CompressType GetCompressType() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return compress_type_;
+    }
+    uint64_t Sent() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sent_;
+    }
+    uint64_t Received() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return received_;
+    }
+    // Number of the oldest frame that can still be replayed
+    uint64_t ReplayFrom() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ReplayFromLocked();
+    }
+    size_t WindowBytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return window_bytes_;
+    }
+
+    // The token is all a client needs to take the session over, its bytes come from the system CSPRNG
+    static std::string NewToken() {
+        std::string token(TOKEN_SIZE, '\0');
+        FillRandom(reinterpret_cast<uint8_t *>(token.data()), token.size());
+        return token;
+    }
+
+private:
+    template <typename>
+    friend class BasicWSocketContext;
+    friend class SessionStore;
+
+    // getrandom(2) where there is one, /dev/urandom otherwise; throws std::system_error when neither works
+    static void FillRandom(uint8_t *buf, size_t size) {
+#ifdef _WIN32
+        auto status = BCryptGenRandom(nullptr, buf, static_cast<ULONG>(size), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+        if(!BCRYPT_SUCCESS(status)) {
+            throw std::system_error(static_cast<int>(status), std::system_category(), "BCryptGenRandom");
+        }
+#else
+        size_t filled = 0;
+#ifdef __linux__
+        while(filled < size) {
+            auto n = getrandom(buf + filled, size - filled, 0);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n < 0) {
+                break; // e.g. ENOSYS on old kernels
+            }
+            filled += static_cast<size_t>(n);
+        }
+#endif
+        if(filled == size) {
+            return;
+        }
+        int fd;
+        do {
+            fd = ::open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        } while(fd < 0 && errno == EINTR);
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "open /dev/urandom");
+        }
+        while(filled < size) {
+            auto n = ::read(fd, buf + filled, size - filled);
+            if(n < 0 && errno == EINTR) {
+                continue;
+            }
+            if(n <= 0) {
+                auto error = n < 0 ? errno : EIO;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "read /dev/urandom");
+            }
+            filled += static_cast<size_t>(n);
+        }
+        ::close(fd);
+#endif
+    }
+
+    // Take the session over for a new connection, returns the epoch the connection records with
+    uint64_t Attach() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return ++epoch_;
+    }
+
+    // Start over as a new session, the frames of the old one are gone
+    void Reset(const std::string &token, CompressType type) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        token_         = token;
+        compress_type_ = type;
+        sent_          = 0;
+        received_      = 0;
+        window_bytes_  = 0;
+        frames_.clear();
+    }
+    void Issue(const std::string &token, CompressType type) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        token_         = token;
+        compress_type_ = type;
+    }
+
+    void Record(uint64_t epoch, const FrameBuffer &frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(epoch != epoch_) {
+            return;
+        }
+        frames_.push_back({++sent_, frame});
+        window_bytes_ += frame.Size();
+        while(window_bytes_ > window_ && !frames_.empty()) {
+            window_bytes_ -= frames_.front().data.Size();
+            frames_.pop_front();
+        }
+    }
+    void Receive(uint64_t epoch) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(epoch == epoch_) {
+            ++received_;
+        }
+    }
+
+    // The peer got frames up to `peer_received` and can replay ours from `peer_replay_from`
+    bool CanResume(uint64_t peer_received, uint64_t peer_replay_from) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return peer_received <= sent_ && ReplayFromLocked() <= peer_received + 1 &&
+               peer_replay_from <= received_ + 1;
+    }
+
+    // Frames after `peer_received`, to be written again in order
+    std::vector<FrameBuffer> Missing(uint64_t peer_received) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::vector<FrameBuffer>    frames;
+        for(auto &frame : frames_) {
+            if(frame.seq > peer_received) {
+                frames.push_back(frame.data);
+            }
+        }
+        return frames;
+    }
+
+    uint64_t ReplayFromLocked() const { return frames_.empty() ? sent_ + 1 : frames_.front().seq; }
+
+    struct SentFrame {
+        uint64_t    seq;
+        FrameBuffer data; // encoded frame, shared with the transport
+    };
+
+    mutable std::mutex    mutex_;
+    std::string           token_;
+    CompressType          compress_type_ = CompressType::None;
+    uint64_t              epoch_         = 0;
+    uint64_t              sent_          = 0;
+    uint64_t              received_      = 0;
+    size_t                window_;
+    size_t                window_bytes_ = 0;
+    std::deque<SentFrame> frames_;
+};
+
+/**
+ * Server side sessions by token
+ *
+ * Holds at most `capacity` sessions, creating one more drops the oldest. Connections look their
+ * session up on resume; nothing is removed when a connection ends, Erase() forgets a session the
+ * application knows is finished.
+ */
+class SessionStore {
+public:
+    explicit SessionStore(size_t capacity = 10000, size_t window = Session::WINDOW_DEFAULT) :
+        capacity_(capacity), window_(window) {}
+
+    std::shared_ptr<Session> Create(CompressType type) {
+        auto session = std::make_shared<Session>(window_);
+        auto token   = Session::NewToken();
+        session->Issue(token, type);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        order_.push_back(token);
+        sessions_[token] = {session, std::prev(order_.end())};
+        while(sessions_.size() > capacity_) {
+            sessions_.erase(order_.front());
+            order_.pop_front();
+        }
+        return session;
+    }
+
+    std::shared_ptr<Session> Find(const std::string &token) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        it = sessions_.find(token);
+        return it == sessions_.end() ? nullptr : it->second.session;
+    }
+
+    void Erase(const std::string &token) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto                        it = sessions_.find(token);
+        if(it != sessions_.end()) {
+            order_.erase(it->second.order);
+            sessions_.erase(it);
+        }
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return sessions_.size();
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<Session>         session;
+        std::list<std::string>::iterator order;
+    };
+
+    mutable std::mutex                     mutex_;
+    std::unordered_map<std::string, Entry> sessions_;
+    std::list<std::string>                 order_; // tokens, oldest first
+    size_t                                 capacity_;
+    size_t                                 window_;
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__SESSION_HPP
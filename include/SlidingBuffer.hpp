@@ -40,6 +40,16 @@ public:
         buffer_size_ = len;
     }
 
+    // Free the storage, only possible while no data is buffered
+    bool Release() {
+        if(buffer_used_ > 0) {
+            return false;
+        }
+        buffer_.reset();
+        buffer_size_ = 0;
+        return true;
+    }
+
     Buffer GetData() const { return {buffer_.get(), buffer_used_}; }
     size_t GetDataLen() const { return buffer_used_; }
     size_t GetSize() const { return buffer_size_; }
@@ -62,6 +72,19 @@ public:
         if(buffer_used_ > 0)
             std::memmove(buffer_.get(), buffer_.get() + len, buffer_used_);
     }
+    // Consume `len` bytes without writing over them: the rest moves to a new allocation of the same
+    // size and the old storage is returned untouched, for readers still pointing into it
+    std::unique_ptr<uint8_t[]> Detach(size_t len) {
+        assert(buffer_used_ >= len);
+
+        std::unique_ptr<uint8_t[]> tmp(new uint8_t[buffer_size_]);
+        buffer_used_ -= len;
+        if(buffer_used_ > 0) {
+            std::memcpy(tmp.get(), buffer_.get() + len, buffer_used_);
+        }
+        std::swap(this->buffer_, tmp);
+        return tmp;
+    }
     void Consume(size_t start, size_t len) {
         assert(buffer_used_ >= len);
 
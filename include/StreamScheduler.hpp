@@ -0,0 +1,158 @@
+#pragma once
+#ifndef WSOCKET__STREAM_SCHEDULER_HPP
+#define WSOCKET__STREAM_SCHEDULER_HPP
+
+#include <algorithm>
+#include <deque>
+#include <iterator>
+#include <unordered_map>
+
+#include "Frame.hpp"
+#include "FramePool.hpp"
+
+
+namespace wsocket {
+
+// Priority class of a queued message, Urgent goes first; control frames are never queued
+enum class SendPriority : uint8_t {
+    Urgent,
+    High,
+    Normal,
+    Bulk,
+};
+
+/**
+ * Outbound queue of one connection
+ *
+ * Messages are queued in lanes, one per logical stream plus one for plain messages. A stream lane
+ * keeps its messages in order. In the plain lane a message overtakes the messages of lower classes
+ * that have not started, and stays behind those of its own class; messages sent in parts
+ * (finish=false) neither overtake nor are overtaken. Pop() takes one fragment of at most
+ * `fragment_size` bytes from the lane at the head of the highest non-empty priority class and moves
+ * that lane to the back of the class of its (new) front message. Large messages of one class
+ * interleave fragment by fragment, and a higher class waits for at most one fragment. Classes are
+ * strict: Bulk only moves while nothing else is queued.
+ */
+class StreamScheduler {
+public:
+    static constexpr uint64_t PLAIN_LANE = uint64_t(1) << 32; // messages without a stream id
+
+    // One fragment handed to the emitter, `payload` points into the queued copy
+    struct Fragment {
+        uint64_t               lane; // stream id or PLAIN_LANE
+        FrameHeader::FrameType type;
+        Buffer                 payload;
+        bool                   finish;
+    };
+
+    void Push(uint64_t lane, FrameHeader::FrameType type, FrameBuffer payload, bool finish, SendPriority priority) {
+        auto &queue = queues_[lane];
+        pending_bytes_ += payload.Size();
+        ++pending_messages_;
+
+        bool whole = finish;
+        if(lane == PLAIN_LANE) {
+            whole       = finish && !plain_open_;
+            plain_open_ = !finish;
+        }
+        Message message{type, std::move(payload), 0, finish, priority, whole};
+        if(queue.empty()) {
+            ready_[Class(priority)].push_back(lane);
+            queue.push_back(std::move(message));
+            return;
+        }
+
+        auto pos = queue.end();
+        if(lane == PLAIN_LANE && whole) {
+            while(pos != queue.begin()) {
+                auto prev = std::prev(pos);
+                if(!prev->whole || prev->offset != 0 || Class(prev->priority) <= Class(priority)) {
+                    break;
+                }
+                pos = prev;
+            }
+        }
+        if(pos == queue.begin()) {
+            // the lane now leads with this class
+            auto &lanes = ready_[Class(queue.front().priority)];
+            auto  it    = std::find(lanes.begin(), lanes.end(), lane);
+            if(it != lanes.end()) {
+                lanes.erase(it);
+                ready_[Class(priority)].push_back(lane);
+            }
+        }
+        queue.insert(pos, std::move(message));
+    }
+
+    bool   Empty() const { return pending_messages_ == 0; }
+    bool   Queued(uint64_t lane) const { return queues_.count(lane) != 0; }
+    size_t PendingBytes() const { return pending_bytes_; }
+    size_t PendingMessages() const { return pending_messages_; }
+
+    // Emit the next fragment through emit(const Fragment &), false when nothing is queued
+    template <typename Emit>
+    bool Pop(size_t fragment_size, Emit &&emit) {
+        auto ready = std::find_if(std::begin(ready_), std::end(ready_), [](auto &lanes) { return !lanes.empty(); });
+        if(ready == std::end(ready_)) {
+            return false;
+        }
+        auto  lane    = ready->front();
+        auto &queue   = queues_[lane];
+        auto &message = queue.front();
+
+        // the emitter may Clear() the queue, keep the payload alive on our own reference
+        auto     payload = message.payload;
+        auto     len     = std::min(fragment_size, payload.Size() - message.offset);
+        auto     last    = message.offset + len == payload.Size();
+        Fragment fragment{lane, message.type, {payload.Data() + message.offset, len}, last && message.finish};
+
+        message.offset += len;
+        pending_bytes_ -= len;
+        ready->pop_front();
+        if(last) {
+            queue.pop_front();
+            --pending_messages_;
+        }
+        if(queue.empty()) {
+            queues_.erase(lane);
+        } else {
+            ready_[Class(queue.front().priority)].push_back(lane);
+        }
+
+        emit(fragment);
+        return true;
+    }
+
+    void Clear() {
+        queues_.clear();
+        for(auto &lanes : ready_) {
+            lanes.clear();
+        }
+        pending_bytes_    = 0;
+        pending_messages_ = 0;
+        plain_open_       = false;
+    }
+
+private:
+    static constexpr size_t CLASS_COUNT = 4;
+    static size_t           Class(SendPriority priority) { return static_cast<size_t>(priority); }
+
+    struct Message {
+        FrameHeader::FrameType type;
+        FrameBuffer            payload;
+        size_t                 offset; // bytes already emitted
+        bool                   finish;
+        SendPriority           priority;
+        bool                   whole; // not part of a message sent in parts
+    };
+
+    std::unordered_map<uint64_t, std::deque<Message>> queues_;
+    std::deque<uint64_t>                              ready_[CLASS_COUNT]; // lanes by priority, round robin
+    size_t                                            pending_bytes_    = 0;
+    size_t                                            pending_messages_ = 0;
+    bool                                              plain_open_       = false; // last plain part was not final
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__STREAM_SCHEDULER_HPP
@@ -0,0 +1,189 @@
+#pragma once
+#ifndef WSOCKET__TRACE_HPP
+#define WSOCKET__TRACE_HPP
+
+/**
+ * Hot path tracepoints
+ *
+ *   WSOCKET_TRACE_SCOPE("ParseOne");   // duration of the enclosing scope
+ *   WSOCKET_TRACE_INSTANT("Close");    // a point in time
+ *
+ * Without WSOCKET_TRACING defined the macros expand to nothing. With it, every tracepoint writes
+ * one event (static name, TSC begin/end) into a ring owned by the calling thread: no lock, no
+ * allocation, no shared cache line. TraceCollector::WriteChromeJson() dumps all rings in the
+ * Chrome trace event format, which chrome://tracing and ui.perfetto.dev open directly.
+ */
+#ifdef WSOCKET_TRACING
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+namespace wsocket {
+
+inline uint64_t TraceClock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+}
+
+struct TraceEvent {
+    const char *name;  // string literal
+    uint64_t    begin; // TraceClock ticks
+    uint64_t    end;   // == begin for instant events
+};
+
+/**
+ * Fixed size event ring of one thread, the oldest events are overwritten
+ *
+ * The owner publishes the write position with a release store after each event. A reader copies
+ * the window behind it; events the owner overwrites during the copy are skipped.
+ */
+class TraceRing {
+public:
+    static constexpr size_t CAPACITY = 64 * 1024; // events, power of two
+
+    explicit TraceRing(uint32_t tid) : events_(new TraceEvent[CAPACITY]), tid_(tid) {}
+
+    void Push(const char *name, uint64_t begin, uint64_t end) {
+        auto pos                      = head_.load(std::memory_order_relaxed);
+        events_[pos & (CAPACITY - 1)] = TraceEvent{name, begin, end};
+        head_.store(pos + 1, std::memory_order_release);
+    }
+
+    uint32_t Tid() const { return tid_; }
+
+    std::vector<TraceEvent> Copy() const {
+        auto head  = head_.load(std::memory_order_acquire);
+        auto first = head > CAPACITY ? head - CAPACITY : 0;
+
+        std::vector<TraceEvent> out;
+        out.reserve(head - first);
+        for(auto i = first; i < head; ++i) {
+            out.push_back(events_[i & (CAPACITY - 1)]);
+        }
+
+        // drop whatever the owner may have overwritten while copying
+        auto now     = head_.load(std::memory_order_acquire);
+        auto lost    = now > CAPACITY ? now - CAPACITY : 0;
+        auto skipped = lost > first ? std::min<size_t>(lost - first, out.size()) : 0;
+        out.erase(out.begin(), out.begin() + static_cast<std::ptrdiff_t>(skipped));
+        return out;
+    }
+
+private:
+    std::unique_ptr<TraceEvent[]> events_;
+    std::atomic<uint64_t>         head_{0};
+    uint32_t                      tid_;
+};
+
+// Owner of all thread rings, converts ticks to microseconds when dumping
+class TraceCollector {
+    TraceCollector() : origin_tick_(TraceClock()), origin_time_(std::chrono::steady_clock::now()) {}
+
+public:
+    static TraceCollector &Instance() {
+        static TraceCollector instance;
+        return instance;
+    }
+
+    // Ring of the calling thread, created on first use and kept after the thread exits
+    TraceRing &ThreadRing() {
+        thread_local TraceRing *ring = Instance().NewRing();
+        return *ring;
+    }
+
+    void WriteChromeJson(std::ostream &out) const {
+        // ticks per microsecond, measured over the collector's lifetime
+        auto   ticks = TraceClock() - origin_tick_;
+        auto   us    = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin_time_);
+        double scale = us.count() > 0 ? static_cast<double>(ticks) / us.count() : 1.0;
+
+        std::vector<std::shared_ptr<TraceRing>> rings;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings = rings_;
+        }
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for(auto &ring : rings) {
+            for(auto &e : ring->Copy()) {
+                out << (first ? "" : ",") << "\n{\"name\":\"" << e.name << "\",\"pid\":1,\"tid\":" << ring->Tid()
+                    << ",\"ts\":" << static_cast<double>(e.begin - origin_tick_) / scale;
+                if(e.end == e.begin) {
+                    out << ",\"ph\":\"i\",\"s\":\"t\"}";
+                } else {
+                    out << ",\"ph\":\"X\",\"dur\":" << static_cast<double>(e.end - e.begin) / scale << "}";
+                }
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+    }
+
+private:
+    TraceRing *NewRing() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rings_.push_back(std::make_shared<TraceRing>(static_cast<uint32_t>(rings_.size() + 1)));
+        return rings_.back().get();
+    }
+
+private:
+    uint64_t                              origin_tick_;
+    std::chrono::steady_clock::time_point origin_time_;
+
+    mutable std::mutex                      mutex_;
+    std::vector<std::shared_ptr<TraceRing>> rings_;
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char *name) : name_(name), begin_(TraceClock()) {}
+    ~TraceScope() {
+        auto end = TraceClock();
+        TraceCollector::Instance().ThreadRing().Push(name_, begin_, end == begin_ ? end + 1 : end);
+    }
+
+    TraceScope(const TraceScope &)            = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name_;
+    uint64_t    begin_;
+};
+
+} // namespace wsocket
+
+#define WSOCKET_TRACE_CONCAT_(a, b) a##b
+#define WSOCKET_TRACE_CONCAT(a, b)  WSOCKET_TRACE_CONCAT_(a, b)
+#define WSOCKET_TRACE_SCOPE(name)   ::wsocket::TraceScope WSOCKET_TRACE_CONCAT(wsocket_trace_scope_, __LINE__)(name)
+#define WSOCKET_TRACE_INSTANT(name)                                                                                    \
+    do {                                                                                                               \
+        auto wsocket_trace_now = ::wsocket::TraceClock();                                                              \
+        ::wsocket::TraceCollector::Instance().ThreadRing().Push(name, wsocket_trace_now, wsocket_trace_now);           \
+    } while(0)
+
+#else
+
+#define WSOCKET_TRACE_SCOPE(name)
+#define WSOCKET_TRACE_INSTANT(name)                                                                                    \
+    do {                                                                                                               \
+    } while(0)
+
+#endif // WSOCKET_TRACING
+
+#endif // WSOCKET__TRACE_HPP
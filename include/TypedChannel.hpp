@@ -0,0 +1,161 @@
+#pragma once
+#ifndef WSOCKET__TYPED_CHANNEL_HPP
+#define WSOCKET__TYPED_CHANNEL_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "SlidingBuffer.hpp"
+#include "Frame.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Type id of a message struct on the wire, `T::TYPE_ID` unless specialised
+ *
+ *   struct Position { static constexpr uint16_t TYPE_ID = 1; float x, y; };
+ *   template <> struct TypedMessage<Vendor::Quote> { static constexpr uint16_t ID = 2; };
+ *
+ * Ids index the dispatch table, keep them small and dense.
+ */
+template <typename T>
+struct TypedMessage {
+    static constexpr uint16_t ID = T::TYPE_ID;
+};
+
+/**
+ * Wire layout of a typed message, all of it known at compile time
+ *
+ * One Binary frame, FIN set:
+ *   [frame header][type id, 2 bytes big endian][padding][T, raw bytes]
+ * The padding puts T at a multiple of alignof(T) from the start of the frame and makes the frame a
+ * multiple of FRAME_ALIGN bytes: typed frames read one after another into an aligned buffer keep
+ * each other aligned, whatever their types. HEAD holds the header, id and padding bytes, ready to
+ * be copied in front of T.
+ * Both ends need the same definition of T, including its byte order.
+ */
+template <typename T>
+struct TypedLayout {
+    static_assert(std::is_trivially_copyable_v<T>, "typed messages are sent as their raw bytes");
+
+    static constexpr size_t TYPE_ID_SIZE = 2;
+    static constexpr size_t FRAME_ALIGN  = std::max<size_t>(8, alignof(T));
+
+private:
+    static constexpr size_t HeaderSize(size_t payload) {
+        return static_cast<size_t>(FrameHeader::HeaderLength(FrameHeader::LengthMarker(payload)));
+    }
+    // smallest padding that fits with the header length it leads to, the length marker depends on it
+    static constexpr size_t Padding() {
+        for(size_t pad = 0; pad < 2 * FRAME_ALIGN; ++pad) {
+            auto head = HeaderSize(TYPE_ID_SIZE + pad + sizeof(T)) + TYPE_ID_SIZE + pad;
+            if(head % alignof(T) == 0 && (head + sizeof(T)) % FRAME_ALIGN == 0) {
+                return pad;
+            }
+        }
+        return 2 * FRAME_ALIGN;
+    }
+
+public:
+    static constexpr size_t PAYLOAD_SIZE = TYPE_ID_SIZE + Padding() + sizeof(T); // frame payload
+    static constexpr size_t HEADER_SIZE  = HeaderSize(PAYLOAD_SIZE);             // frame header
+    static constexpr size_t HEAD_SIZE    = PAYLOAD_SIZE - sizeof(T) + HEADER_SIZE; // everything before T
+    static constexpr size_t FRAME_SIZE   = HEAD_SIZE + sizeof(T);
+    static_assert(Padding() < 2 * FRAME_ALIGN && HEAD_SIZE % alignof(T) == 0 && FRAME_SIZE % FRAME_ALIGN == 0);
+
+    // Frame header (see BasicHeader/FrameHeader, extended lengths in network byte order), id, padding
+    static constexpr std::array<uint8_t, HEAD_SIZE> Encode() {
+        std::array<uint8_t, HEAD_SIZE> head{};
+        head[0] = 0x80 | FrameHeader::Binary; // fin, opcode
+        head[1] = FrameHeader::LengthMarker(PAYLOAD_SIZE);
+        for(size_t i = 2; i < HEADER_SIZE; ++i) {
+            head[i] = static_cast<uint8_t>(PAYLOAD_SIZE >> (8 * (HEADER_SIZE - 1 - i)));
+        }
+        head[HEADER_SIZE]     = static_cast<uint8_t>(TypedMessage<T>::ID >> 8);
+        head[HEADER_SIZE + 1] = static_cast<uint8_t>(TypedMessage<T>::ID);
+        return head;
+    }
+    static constexpr std::array<uint8_t, HEAD_SIZE> HEAD = Encode();
+};
+
+/**
+ * Dispatch of typed messages (see WSocketContext::SendTyped) to `handler.OnTyped(const T &)`
+ *
+ *   void OnBinary(Buffer buffer, bool finish) override {
+ *       if(!TypedDispatcher<Position, Quote>::Dispatch(buffer, *this)) { ... }
+ *   }
+ *
+ * The id indexes a table built at compile time, an entry names the payload size and the decoder
+ * of its type. A message whose id is unknown or whose size does not match is not dispatched, nor
+ * are the fragments of a message split by the sender. T is read in place when it is aligned,
+ * otherwise from an aligned copy on the stack (e.g. behind frames of other sizes).
+ */
+template <typename... Ts>
+class TypedDispatcher {
+    static_assert(sizeof...(Ts) > 0);
+
+    static constexpr uint16_t MAX_ID = std::max({TypedMessage<Ts>::ID...});
+
+    static constexpr bool UniqueIds() {
+        uint16_t ids[] = {TypedMessage<Ts>::ID...};
+        for(size_t i = 0; i < sizeof...(Ts); ++i) {
+            for(size_t j = i + 1; j < sizeof...(Ts); ++j) {
+                if(ids[i] == ids[j]) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    static_assert(UniqueIds(), "two message types share an id");
+
+    template <typename Handler>
+    struct Entry {
+        size_t size = 0; // payload, 0 for ids without a type
+        void (*decode)(Handler &, const uint8_t *payload) = nullptr;
+    };
+
+    template <typename Handler>
+    static constexpr std::array<Entry<Handler>, MAX_ID + 1> MakeTable() {
+        std::array<Entry<Handler>, MAX_ID + 1> table{};
+        ((table[TypedMessage<Ts>::ID] = Entry<Handler>{TypedLayout<Ts>::PAYLOAD_SIZE, &Decode<Handler, Ts>}), ...);
+        return table;
+    }
+    template <typename Handler>
+    static constexpr std::array<Entry<Handler>, MAX_ID + 1> TABLE = MakeTable<Handler>();
+
+    template <typename Handler, typename T>
+    static void Decode(Handler &handler, const uint8_t *payload) {
+        auto *data = payload + (TypedLayout<T>::PAYLOAD_SIZE - sizeof(T));
+        if(reinterpret_cast<uintptr_t>(data) % alignof(T) == 0) {
+            handler.OnTyped(*reinterpret_cast<const T *>(data));
+            return;
+        }
+        alignas(T) uint8_t copy[sizeof(T)];
+        memcpy(copy, data, sizeof(T));
+        handler.OnTyped(*reinterpret_cast<const T *>(copy));
+    }
+
+public:
+    // The payload of a whole Binary message, false when it is none of Ts
+    template <typename Handler>
+    static bool Dispatch(Buffer payload, Handler &handler) {
+        if(payload.size < 2) {
+            return false;
+        }
+        uint16_t id = static_cast<uint16_t>(payload.buf[0] << 8 | payload.buf[1]);
+        if(id > MAX_ID || TABLE<Handler>[id].size != payload.size) {
+            return false;
+        }
+        TABLE<Handler>[id].decode(handler, payload.buf);
+        return true;
+    }
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__TYPED_CHANNEL_HPP
@@ -0,0 +1,296 @@
+#pragma once
+#ifndef WSOCKET__UTF8_HPP
+#define WSOCKET__UTF8_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "CpuFeatures.hpp"
+
+
+namespace wsocket {
+
+// What a context does with the payload of Text frames
+enum class Utf8Policy {
+    Off,            // trust the peer, hand bytes through unchecked
+    Validate,       // drop an invalid message and report Error::InvalidUtf8
+    CloseOnInvalid, // as Validate, then close with CLOSE_INVALID_PAYLOAD
+};
+
+/**
+ * UTF-8 validation
+ *
+ * Validate() checks a complete buffer. With AVX2 it runs the lookup-table algorithm of
+ * Keiser & Lemire ("Validating UTF-8 in less than one instruction per byte"): every byte pair is
+ * classified by three 16-entry shuffles and the error bits are OR-ed together, 32 bytes per step,
+ * with pure ASCII blocks skipped after a single movemask. Without AVX2 a scalar decoder with an
+ * 8-byte ASCII fast path is used.
+ *
+ * An instance validates a fragmented message: Feed() every fragment in order, a code point split
+ * across fragments is carried (at most 3 bytes) and checked when its tail arrives.
+ */
+class Utf8Validator {
+public:
+    static bool Validate(const uint8_t *data, size_t len) {
+#ifdef WSOCKET_HAS_X86_SIMD
+        if(CpuHasAvx2()) {
+            return ValidateAvx2(data, len);
+        }
+#endif
+        return ValidateScalar(data, len);
+    }
+
+    // Feed the next fragment of a message, `finish` marks the last one
+    bool Feed(const uint8_t *data, size_t len, bool finish) {
+        if(carry_len_ > 0) {
+            // complete the code point split over the previous fragment
+            size_t need = SequenceLength(carry_[0]) - carry_len_;
+            size_t take = need < len ? need : len;
+            std::memcpy(carry_ + carry_len_, data, take);
+            carry_len_ += take;
+            data += take;
+            len -= take;
+
+            if(take < need) {
+                if(finish) {
+                    Reset();
+                    return false;
+                }
+                return true;
+            }
+            bool ok    = ValidateScalar(carry_, carry_len_);
+            carry_len_ = 0;
+            if(!ok) {
+                return false;
+            }
+        }
+
+        size_t cut = finish ? len : IncompleteTail(data, len);
+        if(!Validate(data, cut)) {
+            return false;
+        }
+        carry_len_ = len - cut;
+        std::memcpy(carry_, data + cut, carry_len_);
+        return true;
+    }
+
+    void Reset() { carry_len_ = 0; }
+    // A code point is split across fragments, the next Feed() depends on this instance
+    bool Carrying() const { return carry_len_ > 0; }
+
+    static bool ValidateScalar(const uint8_t *data, size_t len) {
+        size_t i = 0;
+        while(i < len) {
+            if(i + 8 <= len) {
+                uint64_t word;
+                std::memcpy(&word, data + i, sizeof(word));
+                if((word & 0x8080'8080'8080'8080ULL) == 0) {
+                    i += 8;
+                    continue;
+                }
+            }
+
+            uint8_t lead = data[i];
+            if(lead < 0x80) {
+                ++i;
+                continue;
+            }
+
+            // second byte range depends on the lead (no overlongs, no surrogates, <= U+10FFFF)
+            uint8_t lo = 0x80, hi = 0xBF;
+            size_t  n;
+            if(lead < 0xC2) {
+                return false;
+            } else if(lead < 0xE0) {
+                n = 2;
+            } else if(lead < 0xF0) {
+                n  = 3;
+                lo = lead == 0xE0 ? 0xA0 : 0x80;
+                hi = lead == 0xED ? 0x9F : 0xBF;
+            } else if(lead < 0xF5) {
+                n  = 4;
+                lo = lead == 0xF0 ? 0x90 : 0x80;
+                hi = lead == 0xF4 ? 0x8F : 0xBF;
+            } else {
+                return false;
+            }
+
+            if(i + n > len || data[i + 1] < lo || data[i + 1] > hi) {
+                return false;
+            }
+            for(size_t k = 2; k < n; ++k) {
+                if((data[i + k] & 0xC0) != 0x80) {
+                    return false;
+                }
+            }
+            i += n;
+        }
+        return true;
+    }
+
+#ifdef WSOCKET_HAS_X86_SIMD
+    WSOCKET_TARGET_AVX2 static bool ValidateAvx2(const uint8_t *data, size_t len) {
+        __m256i error      = _mm256_setzero_si256();
+        __m256i prev       = _mm256_setzero_si256();
+        __m256i incomplete = _mm256_setzero_si256();
+
+        size_t i = 0;
+        for(; i + 32 <= len; i += 32) {
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            Avx2Step(input, prev, incomplete, error);
+        }
+        if(i < len) {
+            // zero padding is ASCII and cannot complete a sequence
+            alignas(32) uint8_t tail[32] = {};
+            std::memcpy(tail, data + i, len - i);
+            Avx2Step(_mm256_load_si256(reinterpret_cast<const __m256i *>(tail)), prev, incomplete, error);
+        }
+        error = _mm256_or_si256(error, incomplete);
+        return _mm256_testz_si256(error, error);
+    }
+#endif
+
+private:
+    static size_t SequenceLength(uint8_t lead) { return lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2; }
+
+    // Start of a multi-byte sequence cut off by the end of the buffer, `len` when there is none
+    static size_t IncompleteTail(const uint8_t *data, size_t len) {
+        for(size_t back = 1; back <= 3 && back <= len; ++back) {
+            uint8_t b = data[len - back];
+            if((b & 0xC0) == 0x80) {
+                continue;
+            }
+            // only a valid lead byte is worth carrying, anything else fails right away
+            if(b >= 0xC2 && b <= 0xF4 && SequenceLength(b) > back) {
+                return len - back;
+            }
+            break;
+        }
+        return len;
+    }
+
+#ifdef WSOCKET_HAS_X86_SIMD
+    WSOCKET_TARGET_AVX2 static __m256i Lookup16(__m256i table, __m256i index) {
+        return _mm256_shuffle_epi8(table, index);
+    }
+    WSOCKET_TARGET_AVX2 static __m256i High4(__m256i v) {
+        return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+    }
+    // bytes of `input` shifted right by N, filled from the end of `prev`
+    template <int N>
+    WSOCKET_TARGET_AVX2 static __m256i Prev(__m256i input, __m256i prev) {
+        return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+    }
+
+    WSOCKET_TARGET_AVX2 static void Avx2Step(__m256i input, __m256i &prev, __m256i &incomplete, __m256i &error) {
+        if(_mm256_movemask_epi8(input) == 0) {
+            // ASCII block, only a sequence left open by the previous block can be wrong
+            error = _mm256_or_si256(error, incomplete);
+            prev  = input;
+            return;
+        }
+
+        // error classes of a (previous byte, current byte) pair
+        constexpr uint8_t TOO_SHORT      = 1 << 0; // lead followed by lead / ASCII
+        constexpr uint8_t TOO_LONG       = 1 << 1; // ASCII followed by continuation
+        constexpr uint8_t OVERLONG_3     = 1 << 2;
+        constexpr uint8_t TOO_LARGE      = 1 << 3;
+        constexpr uint8_t SURROGATE      = 1 << 4;
+        constexpr uint8_t OVERLONG_2     = 1 << 5;
+        constexpr uint8_t TOO_LARGE_1000 = 1 << 6;
+        constexpr uint8_t OVERLONG_4     = 1 << 6;
+        constexpr uint8_t TWO_CONTS      = 1 << 7; // continuation after continuation, checked below
+        constexpr uint8_t CARRY          = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+        const __m256i byte_1_high_table = _mm256_setr_epi8(
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, //
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                                     //
+                TOO_SHORT | OVERLONG_2,                                                         //
+                TOO_SHORT,                                                                      //
+                TOO_SHORT | OVERLONG_3 | SURROGATE,                                             //
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,                            //
+                TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, //
+                TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                                     //
+                TOO_SHORT | OVERLONG_2,                                                         //
+                TOO_SHORT,                                                                      //
+                TOO_SHORT | OVERLONG_3 | SURROGATE,                                             //
+                TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+
+        const __m256i byte_1_low_table = _mm256_setr_epi8(
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                CARRY | OVERLONG_2,
+                CARRY,
+                CARRY,
+                CARRY | TOO_LARGE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                CARRY | TOO_LARGE | TOO_LARGE_1000,
+                CARRY | TOO_LARGE | TOO_LARGE_1000);
+
+        constexpr uint8_t CONT_1000 = TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4;
+        constexpr uint8_t CONT_1001 = TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE;
+        constexpr uint8_t CONT_101  = TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE;
+
+        const __m256i byte_2_high_table = _mm256_setr_epi8(
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, //
+                CONT_1000, CONT_1001, CONT_101, CONT_101,                                               //
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,                                             //
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, //
+                CONT_1000, CONT_1001, CONT_101, CONT_101,                                               //
+                TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+        __m256i prev1 = Prev<1>(input, prev);
+        __m256i special =
+                _mm256_and_si256(_mm256_and_si256(Lookup16(byte_1_high_table, High4(prev1)),
+                                                  Lookup16(byte_1_low_table,
+                                                           _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)))),
+                                 Lookup16(byte_2_high_table, High4(input)));
+
+        // the 3rd/4th byte of a sequence must be a continuation, which the pair table flags as TWO_CONTS
+        __m256i third  = _mm256_subs_epu8(Prev<2>(input, prev), _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        __m256i fourth = _mm256_subs_epu8(Prev<3>(input, prev), _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+        error          = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+
+        // a lead byte in the last 1-3 positions needs bytes from the next block
+        const __m256i max_value = _mm256_setr_epi8(
+                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, //
+                -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,             //
+                static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+        incomplete = _mm256_subs_epu8(input, max_value);
+        prev       = input;
+    }
+#endif
+
+private:
+    uint8_t carry_[4];
+    size_t  carry_len_{0};
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__UTF8_HPP
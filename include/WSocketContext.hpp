@@ -9,6 +9,7 @@
 #include <unordered_set>
 #include <functional>
 #include <limits>
+#include <type_traits>
 
 
 #ifdef _WIN32
@@ -26,72 +27,359 @@
 #include "SlidingBuffer.hpp"
 #include "Error.h"
 #include "Frame.hpp"
+#include "FramePool.hpp"
+#include "FrameScanner.hpp"
+#include "Handshake.hpp"
+#include "Metrics.hpp"
+#include "RateLimit.hpp"
+#include "Reliable.hpp"
+#include "Session.hpp"
+#include "StreamScheduler.hpp"
+#include "Trace.hpp"
+#include "TypedChannel.hpp"
+#include "Utf8.hpp"
 #include "compress/Compress.hpp"
 #include "compress/CompressManager.hpp"
 
 
 namespace wsocket {
 
-class FrameParser {
+// OnFrameTooLong is optional for parser handlers
+template <typename Handler, typename = void>
+struct HasOnFrameTooLong : std::false_type {};
+template <typename Handler>
+struct HasOnFrameTooLong<Handler, std::void_t<decltype(std::declval<Handler &>().OnFrameTooLong(size_t{}))>>
+    : std::true_type {};
+
+/**
+ * Frame parser calling Handler::OnFrame(const Frame &) for every complete frame
+ *
+ * The handler is called through its static type, a final handler lets the compiler inline the dispatch.
+ * A frame declaring a payload above SetMaxPayload() is refused as soon as its header is in, before
+ * the buffer grows for it: parsing stops for good and Handler::OnFrameTooLong(size_t length), if
+ * any, is called once.
+ *
+ * The receive buffer adapts to the traffic: PrepareWrite() grows it to hold the pending frame, and
+ * doubles it (up to READ_SIZE_MAX) while reads keep filling it. Once SHRINK_AFTER reads in a row
+ * left it less than a quarter full, it drops back to the base size the next time it is empty.
+ * ReleaseBuffer() frees it entirely, the next PrepareWrite() allocates the base size again.
+ */
+template <typename Handler>
+class BasicFrameParser {
 public:
-    class Listener {
-    public:
-        virtual ~Listener() {}
-        virtual void OnFrame(const Frame &frame) {}
-    };
+    static constexpr size_t READ_SIZE_MAX = 256 * 1024;
+    static constexpr size_t SHRINK_AFTER  = 16; // reads
 
-    explicit FrameParser(Listener *listener = nullptr) : listener_(listener) {}
+    explicit BasicFrameParser(Handler *listener = nullptr) : listener_(listener) {}
 
-    void   SetReceiveBufferSize(size_t len) { buffer_.Resize(len); }
-    Buffer PrepareWrite() const { return buffer_.PrepareWrite(); }
-    void   CommitWrite(size_t len) { buffer_.CommitWrite(len); }
+    // Base size of the receive buffer
+    void SetReceiveBufferSize(size_t len) {
+        base_size_ = len;
+        buffer_.Resize(len);
+    }
+    size_t ReceiveBufferSize() const { return buffer_.GetSize(); }
+    // Largest payload accepted, default unlimited
+    void SetMaxPayload(size_t len) { max_payload_ = len; }
+    // Bytes of incomplete frames waiting for more data
+    size_t Buffered() const { return buffer_.GetDataLen(); }
+    // A frame was refused, nothing is parsed any more
+    bool FrameRefused() const { return refused_; }
+
+    Buffer PrepareWrite() {
+        auto size = buffer_.GetSize();
+        auto want = std::max(this->ShrinkTarget(size), base_size_);
+        if(grow_) {
+            // the last read filled the buffer, more is likely waiting
+            want  = std::max(want, std::min(size * 2, READ_SIZE_MAX));
+            grow_ = false;
+        }
+        want = std::max(want, this->PendingFrameSize());
+        if(want != size) {
+            buffer_.Resize(want);
+        }
 
-    void Feed(const Buffer &buf) { buffer_.Feed(buf); }
+        auto free = buffer_.PrepareWrite();
+        prepared_ = free.size;
+        return free;
+    }
+    void CommitWrite(size_t len) {
+        buffer_.CommitWrite(len);
+        grow_ = len == prepared_ && buffer_.GetSize() < READ_SIZE_MAX;
+        this->CountRead();
+    }
+
+    void Feed(const Buffer &buf) {
+        auto size = buffer_.GetSize();
+        auto want = std::max(this->ShrinkTarget(size), base_size_);
+        if(want != size) {
+            buffer_.Resize(want);
+        }
+        buffer_.Feed(buf);
+        this->CountRead();
+    }
+
+    // Free the receive buffer of an idle connection, false while a partial frame is buffered
+    bool ReleaseBuffer() {
+        small_reads_ = 0;
+        grow_        = false;
+        return buffer_.Release();
+    }
 
     bool ParseOne() {
-        auto raw_data = buffer_.GetData();
+        WSOCKET_TRACE_SCOPE("ParseOne");
+        if(refused_) {
+            return false;
+        }
 
-        if(raw_data.size < 2) {
+        auto raw_data   = buffer_.GetData();
+        auto frame_size = FrameSize(raw_data.buf, raw_data.size);
+        if(frame_size == TOO_LONG) {
+            this->Refuse(raw_data.buf);
+            return false;
+        }
+        if(frame_size == 0 || frame_size > raw_data.size) {
             // need more data
             return false;
         }
 
-        FrameHeader *header = reinterpret_cast<FrameHeader *>(raw_data.buf);
+        auto header_len = static_cast<size_t>(reinterpret_cast<FrameHeader *>(raw_data.buf)->HeaderLength());
+        this->Dispatch(raw_data.buf, header_len, frame_size - header_len);
 
-        if(header->HeaderLength() > raw_data.size) {
-            // need more data
-            return false;
+        this->ConsumeParsed(frame_size);
+
+        return true;
+    }
+
+    /**
+     * Parse every complete frame in the buffer while keep_going() holds, then consume them at once
+     *
+     * Runs of short frames are indexed in bulk by FrameScanner, frames with an extended length are
+     * decoded one by one. Returns the number of frames dispatched.
+     */
+    template <typename Pred>
+    size_t ParseAll(Pred &&keep_going) {
+        WSOCKET_TRACE_SCOPE("ParseAll");
+        auto   raw_data = buffer_.GetData();
+        size_t pos      = 0;
+        size_t count    = 0;
+
+        FrameIndex index[SCAN_BATCH];
+        bool       stopped = refused_;
+        while(!stopped && keep_going()) {
+            const uint8_t *data = raw_data.buf + pos;
+            size_t         size = raw_data.size - pos;
+
+            size_t scanned = 0;
+            auto   n       = FrameScanner::Scan(data, size, index, SCAN_BATCH, &scanned);
+            if(n == 0) {
+                // extended length, or incomplete frame
+                auto frame_size = FrameSize(data, size);
+                if(frame_size == TOO_LONG) {
+                    this->Refuse(data);
+                    break;
+                }
+                if(frame_size == 0 || frame_size > size) {
+                    break;
+                }
+                auto header_len = static_cast<size_t>(reinterpret_cast<const FrameHeader *>(data)->HeaderLength());
+                this->Dispatch(data, header_len, frame_size - header_len);
+                pos += frame_size;
+                ++count;
+                continue;
+            }
+
+            for(size_t i = 0; i < n; ++i) {
+                if(i > 0 && !keep_going()) {
+                    scanned = index[i].offset;
+                    stopped = true;
+                    break;
+                }
+                this->Dispatch(data + index[i].offset, sizeof(BasicHeader), index[i].length);
+                ++count;
+            }
+            pos += scanned;
         }
 
-        if(header->HeaderLength() + header->Length() > raw_data.size) {
-            // need more data
-            return false;
+        if(pos > 0) {
+            this->ConsumeParsed(pos);
+        }
+        return count;
+    }
+
+    void ResetListener(Handler *listener) { listener_ = listener; }
+
+    /**
+     * Lend the frames being parsed to someone reading them later: called from a listener, the
+     * ParseOne()/ParseAll() running consumes them by moving the rest of the buffer to a new
+     * allocation instead of over them, TakeParsed() then hands out the old storage
+     */
+    void KeepParsed() { keep_parsed_ = true; }
+    std::unique_ptr<uint8_t[]> TakeParsed() { return std::move(parsed_); }
+    // `data` points into a buffered frame
+    bool Holds(const uint8_t *data) const {
+        auto raw_data = buffer_.GetData();
+        return data >= raw_data.buf && data < raw_data.buf + raw_data.size;
+    }
+
+private:
+    static constexpr size_t TOO_LONG = std::numeric_limits<size_t>::max();
+
+    // Header plus payload length of the frame at `data`: 0 while its header is incomplete, TOO_LONG
+    // above SetMaxPayload() or when the sum would not fit a size_t
+    size_t FrameSize(const uint8_t *data, size_t size) const {
+        if(size < 2) {
+            return 0;
+        }
+        auto *header     = reinterpret_cast<const FrameHeader *>(data);
+        auto  header_len = static_cast<size_t>(header->HeaderLength());
+        if(header_len > size) {
+            return 0;
+        }
+        if(header->Length() > max_payload_ || header->Length() >= TOO_LONG - header_len) {
+            return TOO_LONG;
+        }
+        return header_len + header->Length();
+    }
+
+    // Header plus payload length of the frame at the front of the buffer, 0 while its header is
+    // incomplete or the frame is refused
+    size_t PendingFrameSize() const {
+        auto raw_data   = buffer_.GetData();
+        auto frame_size = FrameSize(raw_data.buf, raw_data.size);
+        return frame_size == TOO_LONG ? 0 : frame_size;
+    }
+
+    void Refuse(const uint8_t *data) {
+        refused_ = true;
+        if constexpr(HasOnFrameTooLong<Handler>::value) {
+            if(this->listener_) {
+                listener_->OnFrameTooLong(reinterpret_cast<const FrameHeader *>(data)->Length());
+            }
+        }
+    }
+
+    // Size to use while the buffer is empty and has been mostly unused for a while
+    size_t ShrinkTarget(size_t size) const {
+        if(buffer_.GetDataLen() == 0 && size > base_size_ && small_reads_ >= SHRINK_AFTER) {
+            return base_size_;
+        }
+        return size;
+    }
+    void CountRead() {
+        if(buffer_.GetDataLen() * 4 < buffer_.GetSize()) {
+            ++small_reads_;
+        } else {
+            small_reads_ = 0;
         }
+    }
+
+    void ConsumeParsed(size_t len) {
+        if(keep_parsed_) {
+            parsed_      = buffer_.Detach(len);
+            keep_parsed_ = false;
+        } else {
+            buffer_.Consume(len);
+        }
+    }
 
+    void Dispatch(const uint8_t *data, size_t header_len, size_t payload_len) {
         Frame frame;
 
-        frame.header    = *header;
-        frame.data.size = header->Length();
-        frame.data.buf  = raw_data.buf + header->HeaderLength();
+        // copy only the encoded header, the buffer may end right after a short one
+        std::memcpy(static_cast<void *>(&frame.header), data, header_len);
+        frame.data.size = payload_len;
+        frame.data.buf  = const_cast<uint8_t *>(data) + header_len;
 
         if(this->listener_) {
             listener_->OnFrame(frame);
         }
+    }
 
-        buffer_.Consume(header->HeaderLength() + header->Length());
+private:
+    static constexpr size_t SCAN_BATCH = 64;
 
-        return true;
+    SlidingBuffer buffer_;
+    size_t        base_size_   = 0;
+    size_t        max_payload_ = std::numeric_limits<size_t>::max();
+    size_t        prepared_    = 0; // free space handed out by the last PrepareWrite()
+    size_t        small_reads_ = 0; // consecutive reads leaving the buffer less than a quarter full
+    bool          grow_        = false;
+    bool          keep_parsed_ = false;
+    bool          refused_     = false; // a frame was too long, parsing stopped
+    Handler      *listener_{nullptr};
+
+    std::unique_ptr<uint8_t[]> parsed_; // storage lent by the last KeepParsed()
+};
+
+class FrameParserListener {
+public:
+    virtual ~FrameParserListener() {}
+    virtual void OnFrame(const Frame &frame) {}
+    virtual void OnFrameTooLong(size_t length) {}
+};
+
+// Frame parser dispatching through the virtual FrameParser::Listener
+class FrameParser : public BasicFrameParser<FrameParserListener> {
+public:
+    using Listener = FrameParserListener;
+    using BasicFrameParser::BasicFrameParser;
+};
+
+
+// Payload of a received message kept readable after its callback returned, while `owner` is held
+// (see BasicWSocketContext::RetainPayload)
+struct RetainedPayload {
+    Buffer                data;
+    std::shared_ptr<void> owner;
+
+    std::string_view Text() const { return {reinterpret_cast<const char *>(data.buf), data.size}; }
+};
+
+// Virtual listener interface, the handler of WSocketContext
+class WSocketContextListener {
+public:
+    virtual ~WSocketContextListener() = default;
+
+    virtual void OnError(std::error_code code) {}
+
+    virtual CompressType OnHandshake(const std::vector<CompressType> &supported_compress_type) {
+        return CompressType::None;
     }
+    virtual void OnClose(int16_t code, const std::string &reason) {}
+    virtual void OnPing() {}
+    virtual void OnPong() {}
 
-    void ResetListener(Listener *listener) { listener_ = listener; }
+    virtual void OnText(std::string_view text, bool finish) {}
+    virtual void OnBinary(Buffer buffer, bool finish) {}
 
-private:
-    SlidingBuffer buffer_;
-    Listener     *listener_{nullptr};
+    // Reliable mode: the peer processed the messages up to `sequence` (see SetReliable)
+    virtual void OnAck(uint64_t sequence) {}
 };
 
+// OnAck is optional for static handlers
+template <typename Handler, typename = void>
+struct HasOnAck : std::false_type {};
+template <typename Handler>
+struct HasOnAck<Handler, std::void_t<decltype(std::declval<Handler &>().OnAck(uint64_t{}))>> : std::true_type {};
+
+// Receiver of the messages of logical streams (see BasicWSocketContext::SendText(uint32_t, ...))
+class StreamListener {
+public:
+    virtual ~StreamListener() = default;
+
+    virtual void OnText(uint32_t stream, std::string_view text, bool finish) {}
+    virtual void OnBinary(uint32_t stream, Buffer buffer, bool finish) {}
+};
 
-class WSocketContext : public FrameParser::Listener {
+/**
+ * Protocol state machine of one connection
+ *
+ * Handler receives the callbacks of WSocketContextListener (OnError, OnHandshake, OnClose, OnPing,
+ * OnPong, OnText, OnBinary, optionally OnAck) through its static type. WSocketContext uses the virtual
+ * WSocketContextListener, a final concrete Handler gets the whole receive path inlined.
+ */
+template <typename Handler>
+class BasicWSocketContext {
     enum class State {
         Init,
         Closed,
@@ -101,130 +389,431 @@ class WSocketContext : public FrameParser::Listener {
         Error,
     } state_ = State::Init;
 
-    static constexpr int64_t RECEIVE_BUFFER_DEFAULT = 8 * 1024; // 8k
+    // Rate limit decision for the message being received on a lane
+    enum class MessageLane : uint8_t {
+        Idle,
+        Delivering,
+        Dropping,
+    };
+
+    struct StreamState {
+        StreamListener *listener = nullptr;
+        Utf8Validator   utf8_receive;
+        Utf8Validator   utf8_send;
+        bool            utf8_dropping = false;
+        MessageLane     rate_lane     = MessageLane::Idle;
+        bool            receiving     = false; // a message from the peer is open
+    };
+
+    static constexpr int64_t RECEIVE_BUFFER_DEFAULT    = 8 * 1024;         // 8k
+    static constexpr size_t  FRAGMENT_DEFAULT          = 16 * 1024;        // 16k
+    static constexpr size_t  RECEIVE_FRAME_DEFAULT     = 64 * 1024 * 1024; // 64M
+    static constexpr size_t  RECEIVING_STREAMS_DEFAULT = 1024;
 
 public:
-    WSocketContext() : parser_(this) { parser_.SetReceiveBufferSize(RECEIVE_BUFFER_DEFAULT); }
-    ~WSocketContext() override {}
+    BasicWSocketContext() : parser_(this) {
+        parser_.SetReceiveBufferSize(RECEIVE_BUFFER_DEFAULT);
+        this->UpdateReceiveLimit();
+        metrics_.receive_buffer_bytes.store(RECEIVE_BUFFER_DEFAULT, std::memory_order_relaxed);
+        MetricsRegistry::Instance().Register(&metrics_);
+    }
+    ~BasicWSocketContext() { MetricsRegistry::Instance().Unregister(&metrics_); }
+
+    BasicWSocketContext(const BasicWSocketContext &)            = delete;
+    BasicWSocketContext &operator=(const BasicWSocketContext &) = delete;
 
     State GetState() const { return state_; }
 
-    Buffer PrepareWrite() const { return parser_.PrepareWrite(); }
-    void   CommitWrite(size_t len) {
+    // Text/Binary may be sent now. Messages may be pipelined behind our handshake before the
+    // peer's arrives, except while resuming: replayed frames have to go first
+    bool CanSend() const { return state_ == State::Connected || (state_ == State::Connecting && !resuming_); }
+
+    // Counters of this connection, also summed into MetricsRegistry
+    ConnectionMetrics       &Metrics() { return metrics_; }
+    const ConnectionMetrics &Metrics() const { return metrics_; }
+
+    // Check Text payloads as UTF-8, on receive and on SendText (default Utf8Policy::Off)
+    void SetUtf8Policy(Utf8Policy policy) { utf8_policy_ = policy; }
+
+    Buffer PrepareWrite() {
+        auto buf = parser_.PrepareWrite();
+        metrics_.receive_buffer_bytes.store(parser_.ReceiveBufferSize(), std::memory_order_relaxed);
+        return buf;
+    }
+    void CommitWrite(size_t len) {
+        ConnectionMetrics::Add(metrics_.wire_bytes_received, len);
         parser_.CommitWrite(len);
         ParseProcess();
     }
 
     void Feed(const Buffer &buf) {
+        ConnectionMetrics::Add(metrics_.wire_bytes_received, buf.size);
         parser_.Feed(buf);
+        metrics_.receive_buffer_bytes.store(parser_.ReceiveBufferSize(), std::memory_order_relaxed);
         this->ParseProcess();
     }
 
-    void Handshake() {
-        assert(state_ == State::Init);
-        this->state_               = State::Connecting;
-        auto supported_compressors = CompressManager::Instance().GetSupportedCompressors();
+    // Base receive buffer size, it grows for large frames and reads and shrinks back (see BasicFrameParser)
+    void   SetReceiveBufferSize(size_t len) { parser_.SetReceiveBufferSize(len); }
+    size_t ReceiveBufferSize() const { return parser_.ReceiveBufferSize(); }
+    // Bytes of a partial frame waiting for the rest
+    size_t ReceiveBuffered() const { return parser_.Buffered(); }
 
-        // send system handshake frame
-        Frame frame;
-        frame.header.Finished(true);
-        frame.header.Type(FrameHeader::System);
-        frame.header.Length(supported_compressors.size());
+    // Free the receive buffer while the connection is idle, false while a partial frame is buffered.
+    // Nothing may hold the last PrepareWrite() buffer, it is allocated again on the next one.
+    bool ReleaseReceiveBuffer() {
+        if(!parser_.ReleaseBuffer()) {
+            return false;
+        }
+        metrics_.receive_buffer_bytes.store(0, std::memory_order_relaxed);
+        return true;
+    }
 
-        frame.data.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(supported_compressors.c_str()));
-        frame.data.size = supported_compressors.size();
-        this->SendFrame(frame);
+    /**
+     * Keep the payload OnText/OnBinary was called with readable after the callback returns, only
+     * valid inside those callbacks
+     *
+     * A payload in the receive buffer is not copied: the frames parsed from this read are lent to
+     * the returned owner, and the parser moves the bytes following them to a new buffer instead of
+     * over them. A decompressed payload is overwritten by the next frame and is copied.
+     */
+    RetainedPayload RetainPayload(Buffer payload) {
+        if(parser_.Holds(payload.buf)) {
+            if(!lease_) {
+                lease_ = std::make_shared<std::unique_ptr<uint8_t[]>>();
+                parser_.KeepParsed();
+            }
+            return {payload, lease_};
+        }
+        std::shared_ptr<uint8_t[]> copy(new uint8_t[payload.size]);
+        std::memcpy(copy.get(), payload.buf, payload.size);
+        return {{copy.get(), payload.size}, std::move(copy)};
+    }
+
+    /**
+     * Start the connection: send the handshake frame (codecs, SetMaxFrameSize(), receive buffer size)
+     *
+     * Until the peer answers the state is Connecting. Text/Binary messages may already be sent
+     * then (0-RTT); they go out uncompressed since no codec is agreed yet, and need a peer that
+     * understands the binary handshake. The smaller MaxFrameSize() of both ends applies to both
+     * directions, queued fragments are capped at the peer's receive buffer size.
+     */
+    void Handshake() {
+        assert(state_ == State::Init);
+        this->state_ = State::Connecting;
+        this->SendHandshake(CompressManager::Instance().GetSupportedCompressTypes());
     }
     void Handshake(const std::vector<CompressType> &compressors) {
         assert(state_ == State::Init);
-        this->state_               = State::Connecting;
-        auto supported_compressors = CompressManager::Instance().GetSupportedCompressors(compressors);
-
-        // send system handshake frame
-        Frame frame;
-        frame.header.Finished(true);
-        frame.header.Type(FrameHeader::System);
-        frame.header.Length(supported_compressors.size());
-
-        frame.data.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(supported_compressors.c_str()));
-        frame.data.size = supported_compressors.size();
-        this->SendFrame(frame);
+        this->state_ = State::Connecting;
+        this->SendHandshake(compressors);
     }
 
+    /**
+     * Graceful close: queued messages are written first, up to the flush budget (SetFlushBudget());
+     * the ones that do not fit it or the reliable window are dropped, reported as MessagesDropped
+     * and counted in send_queue_drops. Nothing may follow the Close frame.
+     */
     void Close(CloseCode code) { this->Close(static_cast<int16_t>(code), CloseMessage(code)); }
-    void Close(int16_t code, const std::string &reason) {
-        assert(state_ != State::Closed);
+    void Close(int16_t code, const std::string &reason) { this->Close(code, reason, flush_budget_); }
+    // Close without writing queued messages first, they are all dropped: for a connection on its
+    // way out anyway (errors, a peer that stopped reading, load shedding)
+    void CloseNow(CloseCode code) { this->Close(static_cast<int16_t>(code), CloseMessage(code), 0); }
 
-        state_ = State::Closing;
+    void SendText(std::string_view text, bool finish = true) {
+        assert(this->CanSend());
 
-        if(reason.size() + 2 > Frame::ShortPayload()) {
-            this->NotifyError(Error::ErrorReasonTooLong);
-            this->Close(CloseCode::INTERNAL_ERROR);
+        if(text.empty()) {
+            this->NotifyError(Error::MessageEmpty);
             return;
         }
-        Frame frame;
-        frame.header.Finished(true);
-        frame.header.Type(FrameHeader::Close);
 
-        // set body
-        auto total_len = 2 + reason.size();
-        frame.header.Length(total_len);
-        std::unique_ptr<uint8_t[]> buffer = std::make_unique<uint8_t[]>(total_len);
-        memcpy(buffer.get(), &code, 2);
-        memcpy(buffer.get() + 2, reason.c_str(), reason.size());
+        Buffer buffer;
+        buffer.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(text.data()));
+        buffer.size = text.size();
 
-        frame.data.buf  = buffer.get();
-        frame.data.size = 2 + reason.size();
+        if(utf8_policy_ != Utf8Policy::Off && !utf8_send_.Feed(buffer.buf, buffer.size, finish)) {
+            utf8_send_.Reset();
+            this->NotifyError(Error::InvalidUtf8);
+            return;
+        }
+        if(stream_scheduler_.Queued(StreamScheduler::PLAIN_LANE) || this->Throttled()) {
+            // behind queued plain messages, a fragment of one may be on the wire already
+            this->QueueMessage(StreamScheduler::PLAIN_LANE, FrameHeader::Text, buffer, finish, SendPriority::Urgent);
+            return;
+        }
+        ConnectionMetrics::Add(metrics_.message_bytes_sent, buffer.size);
 
-        this->SendFrame(frame);
+        this->SendFragments(FrameHeader::Text, buffer, finish, this->compress_context_ != nullptr);
     }
+    void SendBinary(Buffer buffer, bool finish = true) {
+        assert(this->CanSend());
 
-    void SendText(std::string_view text, bool finish = true) {
-        assert(state_ == State::Connected);
-
-        if(text.empty()) {
+        if(buffer.size == 0) {
             this->NotifyError(Error::MessageEmpty);
             return;
         }
+        if(stream_scheduler_.Queued(StreamScheduler::PLAIN_LANE) || this->Throttled()) {
+            this->QueueMessage(StreamScheduler::PLAIN_LANE, FrameHeader::Binary, buffer, finish, SendPriority::Urgent);
+            return;
+        }
+        ConnectionMetrics::Add(metrics_.message_bytes_sent, buffer.size);
 
-        Buffer buffer;
-        buffer.buf  = reinterpret_cast<uint8_t *>(const_cast<char *>(text.data()));
-        buffer.size = text.size();
+        this->SendFragments(FrameHeader::Binary, buffer, finish, false);
+    }
 
-        if(this->compress_context_) {
-            buffer = this->compress_context_->Compress(buffer);
-            if(buffer.buf == nullptr || buffer.size == 0) {
-                this->NotifyError(Error::CompressError);
-                Close(CloseCode::INTERNAL_ERROR);
-                return;
-            }
+    // Split messages above `size` payload bytes (before compression) into FIN=0 frames, default
+    // unlimited; set it before Handshake() to announce it to the peer
+    void SetMaxFrameSize(size_t size) {
+        max_frame_size_ = std::max<size_t>(size, 1);
+        this->UpdateReceiveLimit();
+    }
+    size_t MaxFrameSize() const { return max_frame_size_; }
+    // Largest frame payload taken from the peer whatever MaxFrameSize() allows, default 64M. A frame
+    // declaring more is refused before it is buffered (PayloadTooLong, CLOSE_PROTOCOL_ERROR)
+    void SetMaxReceiveFrameSize(size_t size) {
+        max_receive_frame_size_ = size;
+        this->UpdateReceiveLimit();
+    }
+    size_t MaxReceiveFrameSize() const { return max_receive_frame_size_; }
+
+    /**
+     * Sessions survive the connection: a client that reconnects with UseSession(GetSession()) of
+     * the lost one skips codec negotiation, and each side writes again the data frames the other
+     * one did not receive.
+     *
+     * Server: ResetSessionStore() before the peer's handshake arrives, every client asking for a
+     * session gets one from the store. Client: UseSession() before Handshake(), with a fresh
+     * Session to ask for one. Until the server answers a resuming client cannot send; when the
+     * session could not be resumed a new one starts and OnHandshake() negotiates as usual.
+     */
+    void ResetSessionStore(SessionStore *store) { session_store_ = store; }
+    void UseSession(std::shared_ptr<Session> session) {
+        assert(state_ == State::Init && session);
+        session_       = std::move(session);
+        session_epoch_ = session_->Attach();
+        resuming_      = !session_->Token().empty();
+    }
+    // nullptr without a session, the token is empty until the server issued one
+    const std::shared_ptr<Session> &GetSession() const { return session_; }
+    // The handshake continued an earlier session instead of negotiating
+    bool SessionResumed() const { return resumed_; }
+
+    /**
+     * Limit the messages and payload bytes received per second (see RateLimitOptions)
+     *
+     * Time comes from CoarseClock, read once per CommitWrite()/Feed(). Over the limit, Drop skips
+     * whole messages and Close closes the connection. Pause stops parsing after the frame that
+     * emptied a bucket and keeps the rest buffered: the transport stops reading for ReceivePause()
+     * and then calls ResumeReceive(). In reliable mode Drop acts as Pause, every message acknowledged
+     * has to reach the listener. The rate_limit_* metrics count each case.
+     */
+    void SetRateLimit(const RateLimitOptions &options) { rate_limiter_.Configure(options); }
+    // While RateLimitPolicy::Pause holds back parsing: time until the limits allow the next frame,
+    // at least the 1 ms the coarse clock can see
+    std::optional<std::chrono::nanoseconds> ReceivePause() const {
+        if(!rate_paused_) {
+            return std::nullopt;
+        }
+        return std::chrono::nanoseconds(std::max<int64_t>(rate_limiter_.WaitNs(), 1'000'000));
+    }
+    // Parse the frames held back once ReceivePause() elapsed, nothing while the limits still do not allow it
+    void ResumeReceive() {
+        if(!rate_paused_) {
+            return;
+        }
+        rate_limiter_.Refill(CoarseClock::Tick());
+        if(rate_limiter_.WaitNs() > 0) {
+            return;
         }
+        rate_paused_ = false;
+        metrics_.rate_limit_paused.store(0, std::memory_order_relaxed);
+        this->ParseProcess();
+    }
 
-        Frame frame;
-        frame.header.Type(FrameHeader::Text);
-        frame.header.Length(buffer.size);
-        frame.header.Finished(finish);
+    /**
+     * Reliable mode: messages are numbered and the peer acknowledges them once its listener
+     * returned from their last OnText/OnBinary, with one cumulative Ack frame per `ack_every`
+     * messages or after `ack_delay` (see ReliableOptions). OnAck() reports the progress.
+     *
+     * Once `window` payload bytes are unacknowledged SendText/SendBinary queue their messages, as
+     * behind queued plain messages, until acks make room. Both ends enable it before Handshake(),
+     * it is off when the peer does not announce it. Counts are per connection. The transport
+     * calls SendAck() at AckDeadline() for the delayed acks.
+     */
+    void SetReliable(const ReliableOptions &options = {}) {
+        assert(state_ == State::Init);
+        reliable_         = true;
+        reliable_options_ = options;
+        acks_.Configure(options.ack_every, options.ack_delay);
+    }
+    bool Reliable() const { return reliable_; }
+    // Messages sent / acknowledged by the peer so far, in the numbering of OnAck()
+    uint64_t SentSequence() const { return send_window_.Sequence(); }
+    uint64_t AckedSequence() const { return send_window_.Acked(); }
+    size_t   UnackedBytes() const { return send_window_.Bytes(); }
+
+    // When the batched ack is due, nullopt while there is nothing to acknowledge
+    std::optional<std::chrono::steady_clock::time_point> AckDeadline() const {
+        return reliable_ ? acks_.Deadline() : std::nullopt;
+    }
+    // Write the ack of the messages processed so far, if any
+    void SendAck() {
+        if(!reliable_ || !acks_.Pending() || (state_ != State::Connected && state_ != State::Connecting)) {
+            return;
+        }
+        uint64_t sequence = htonll(acks_.Take());
 
-        frame.data = buffer;
+        Frame frame;
+        frame.header.Type(FrameHeader::Ack);
+        frame.header.Finished(true);
+        frame.header.Length(sizeof(sequence));
 
+        frame.data.buf  = reinterpret_cast<uint8_t *>(&sequence);
+        frame.data.size = sizeof(sequence);
         this->SendFrame(frame);
     }
-    void SendBinary(Buffer buffer, bool finish = true) {
-        assert(state_ == State::Connected);
 
-        if(buffer.size == 0) {
+    /**
+     * Send only the header of a Binary frame, the caller writes the `len` payload bytes to the
+     * transport itself right after it (sendfile, a mapped region, ...)
+     *
+     * Returns false without sending anything on a compressed connection, while plain messages are
+     * queued, when `len` exceeds MaxFrameSize(), with a session (the frame could not be replayed)
+     * or while the reliable window is full; the payload has to go through SendBinary then.
+     */
+    bool SendBinaryHeader(size_t len, bool finish = true) {
+        assert(this->CanSend());
+
+        if(this->compress_context_ || stream_scheduler_.Queued(StreamScheduler::PLAIN_LANE) ||
+           len > max_frame_size_ || session_ || this->Throttled()) {
+            return false;
+        }
+        if(len == 0) {
             this->NotifyError(Error::MessageEmpty);
-            return;
+            return false;
         }
+        ConnectionMetrics::Add(metrics_.message_bytes_sent, len);
+        ConnectionMetrics::Add(metrics_.wire_bytes_sent, len);
 
         Frame frame;
         frame.header.Type(FrameHeader::Binary);
-        frame.header.Length(buffer.size);
+        frame.header.Length(len);
         frame.header.Finished(finish);
 
-        frame.data = buffer;
-        this->SendFrame(frame);
+        auto data = this->AllocateFrame(frame.header.HeaderLength());
+        memcpy(data.Data(), &frame.header, frame.header.HeaderLength());
+
+        metrics_.FrameSent(frame.header.Type());
+        if(reliable_) {
+            send_window_.Sent(len, finish);
+        }
+        SendRawData(data);
+        return true;
+    }
+
+    /**
+     * Send `message` as its raw bytes behind a type id (see TypedLayout), the peer hands it to its
+     * handler through TypedDispatcher
+     *
+     * The frame header and id are constants of T: they are copied in front of the message and the
+     * frame goes out without encoding anything. While plain messages are queued or the reliable
+     * window is full the same payload goes through SendBinary instead. A message above
+     * MaxFrameSize() is not sent (PayloadTooLong), typed messages are never fragmented.
+     */
+    template <typename T>
+    void SendTyped(const T &message) {
+        assert(this->CanSend());
+        using Layout = TypedLayout<T>;
+
+        if(Layout::PAYLOAD_SIZE > max_frame_size_) {
+            this->NotifyError(Error::PayloadTooLong);
+            return;
+        }
+        auto data = this->AllocateFrame(Layout::FRAME_SIZE);
+        memcpy(data.Data(), Layout::HEAD.data(), Layout::HEAD_SIZE);
+        memcpy(data.Data() + Layout::HEAD_SIZE, &message, sizeof(T));
+
+        if(stream_scheduler_.Queued(StreamScheduler::PLAIN_LANE) || this->Throttled()) {
+            this->SendBinary({data.Data() + Layout::HEADER_SIZE, Layout::PAYLOAD_SIZE});
+            return;
+        }
+        ConnectionMetrics::Add(metrics_.message_bytes_sent, Layout::PAYLOAD_SIZE);
+        metrics_.FrameSent(FrameHeader::Binary);
+        this->RecordSent(FrameHeader::Binary, Layout::PAYLOAD_SIZE, true, data);
+        SendRawData(data);
+    }
+
+    /**
+     * Queued messages
+     *
+     * SendText/SendBinary with a stream id or a priority queue a copy of the message (see
+     * StreamScheduler). Queued messages go out in fragments of SetFragmentSize() bytes: higher
+     * priorities first, lanes of the same priority interleaved. Up to SetFlushBudget() payload bytes
+     * are written before the call returns, Flush() writes the rest. Control frames are never queued.
+     * Plain messages sent without a priority while plain messages are queued join the queue as
+     * Urgent, behind the Urgent ones. A queued plain message overtakes plain messages of lower
+     * priorities that have not started.
+     *
+     * Frames of a logical stream carry its id (RSV2). The peer delivers them to the StreamListener
+     * registered for the stream, or to the default one. Both ends must use streams.
+     */
+    void SendText(std::string_view text, bool finish, SendPriority priority) {
+        this->QueueText(StreamScheduler::PLAIN_LANE, text, finish, priority, utf8_send_);
     }
+    void SendBinary(Buffer buffer, bool finish, SendPriority priority) {
+        this->QueueBinary(StreamScheduler::PLAIN_LANE, buffer, finish, priority);
+    }
+    void SendText(uint32_t         stream,
+                  std::string_view text,
+                  bool             finish   = true,
+                  SendPriority     priority = SendPriority::Normal) {
+        this->QueueText(stream, text, finish, priority, streams_[stream].utf8_send);
+    }
+    void SendBinary(uint32_t stream, Buffer buffer, bool finish = true, SendPriority priority = SendPriority::Normal) {
+        this->QueueBinary(stream, buffer, finish, priority);
+    }
+
+    // Send queued fragments until about `budget` payload bytes went out, returns the bytes sent
+    size_t Flush(size_t budget = std::numeric_limits<size_t>::max()) {
+        WSOCKET_TRACE_SCOPE("Flush");
+        size_t sent = 0;
+        while(sent < budget && this->CanSend() && !this->Throttled()) {
+            auto size    = std::min(fragment_size_, max_frame_size_);
+            auto emitted = stream_scheduler_.Pop(size, [&](const StreamScheduler::Fragment &fragment) {
+                sent += fragment.payload.size;
+                this->SendQueuedFragment(fragment);
+            });
+            if(!emitted) {
+                break;
+            }
+        }
+        this->UpdateQueueGauges();
+        return sent;
+    }
+    size_t PendingSendBytes() const { return stream_scheduler_.PendingBytes(); }
+
+    void   SetFragmentSize(size_t size) { fragment_size_ = std::max<size_t>(size, 1); }
+    size_t FragmentSize() const { return fragment_size_; }
+    // Default unlimited: queued messages are written before SendText/SendBinary return
+    void SetFlushBudget(size_t budget) { flush_budget_ = budget; }
+
+    // Listener of one stream, nullptr removes it
+    void ResetStreamListener(uint32_t stream, StreamListener *listener) { streams_[stream].listener = listener; }
+    // Listener of the streams without their own
+    void ResetStreamListener(StreamListener *listener) { default_stream_listener_ = listener; }
+    // Forget the listener and UTF-8 state of a stream that will not be used again
+    void CloseStream(uint32_t stream) {
+        auto it = streams_.find(stream);
+        if(it != streams_.end()) {
+            receiving_streams_ -= it->second.receiving ? 1 : 0;
+            streams_.erase(it);
+        }
+    }
+    // Streams the peer may have a fragmented message open on at once, default 1024
+    void   SetMaxReceivingStreams(size_t count) { max_receiving_streams_ = count; }
+    size_t MaxReceivingStreams() const { return max_receiving_streams_; }
+    size_t ReceivingStreams() const { return receiving_streams_; }
 
     void Ping() {
         Frame frame;
@@ -248,14 +837,80 @@ public:
 
 private:
     void ParseProcess() {
-        while(state_ != State::Closed && state_ != State::Error && parser_.ParseOne()) {
+        if(rate_limiter_.Enabled()) {
+            rate_limiter_.Refill(CoarseClock::Tick()); // every frame of this read sees the same time
+        }
+        parser_.ParseAll([this] { return state_ != State::Closed && state_ != State::Error && !rate_paused_; });
+        if(lease_) {
+            // payloads were retained, their storage now belongs to the owners handed out
+            *lease_ = parser_.TakeParsed();
+            lease_.reset();
         }
     }
 
-    void OnFrame(const Frame &frame) override {
+    friend class BasicFrameParser<BasicWSocketContext>;
+    template <typename, typename>
+    friend struct HasOnFrameTooLong;
+
+    void Close(int16_t code, const std::string &reason, size_t flush_budget) {
+        assert(state_ != State::Closed);
+
+        this->Flush(flush_budget);
+        state_ = State::Closing;
+        if(auto dropped = stream_scheduler_.PendingMessages()) {
+            stream_scheduler_.Clear();
+            this->UpdateQueueGauges();
+            ConnectionMetrics::Add(metrics_.send_queue_drops, dropped);
+            this->NotifyError(Error::MessagesDropped);
+        }
+
+        if(reason.size() + 2 > Frame::ShortPayload()) {
+            this->NotifyError(Error::ErrorReasonTooLong);
+            this->CloseNow(CloseCode::INTERNAL_ERROR);
+            return;
+        }
+        Frame frame;
+        frame.header.Finished(true);
+        frame.header.Type(FrameHeader::Close);
+
+        // set body, the reason fits a short frame
+        uint8_t body[0b1111'1110];
+        auto    total_len = 2 + reason.size();
+        frame.header.Length(total_len);
+        memcpy(body, &code, 2);
+        memcpy(body + 2, reason.c_str(), reason.size());
+
+        frame.data.buf  = body;
+        frame.data.size = total_len;
+
+        this->SendFrame(frame);
+    }
+
+    // The peer slices messages at MaxFrameSize(), a frame may add a stream id and what compression
+    // adds to its slice
+    void UpdateReceiveLimit() {
+        auto limit = max_receive_frame_size_;
+        if(max_frame_size_ < limit) {
+            auto slack = FrameHeader::STREAM_ID_SIZE + max_frame_size_ / 128 + 1024;
+            limit      = limit - max_frame_size_ > slack ? max_frame_size_ + slack : limit;
+        }
+        parser_.SetMaxPayload(limit);
+    }
+
+    // The peer declared a frame we will not buffer, the parser stopped
+    void OnFrameTooLong(size_t length) {
+        ConnectionMetrics::Add(metrics_.parse_errors, 1);
+        this->NotifyError(Error::PayloadTooLong);
+        if(state_ != State::Closing && state_ != State::Closed && state_ != State::Error) {
+            this->CloseNow(CloseCode::CLOSE_PROTOCOL_ERROR);
+        }
+    }
+
+    void OnFrame(const Frame &frame) {
         if(state_ == State::Closed || state_ == State::Error) {
             return;
         }
+        metrics_.FrameReceived(frame.header.Type());
 
         switch(frame.header.Type()) {
         case FrameHeader::System:
@@ -276,17 +931,45 @@ private:
         case FrameHeader::Pong:
             this->OnPongFrame(frame);
             break;
+        case FrameHeader::Ack:
+            this->OnAckFrame(frame);
+            break;
         }
     }
 
     void OnSystemFrame(const Frame &frame) {
-        auto str            = std::string(reinterpret_cast<const char *>(frame.data.buf), frame.data.size);
-        auto compress_types = CompressManager::Instance().GetSupportedCompressTypes(str);
+        HandshakeInfo peer;
+        if(!peer.Decode(frame.data)) {
+            ConnectionMetrics::Add(metrics_.parse_errors, 1);
+            this->NotifyError(Error::SysFrameError);
+            this->CloseNow(CloseCode::CLOSE_PROTOCOL_ERROR);
+            return;
+        }
+        legacy_peer_ = peer.legacy;
+        if(peer.max_frame_size) {
+            max_frame_size_ = std::min<size_t>(max_frame_size_, peer.max_frame_size);
+            this->UpdateReceiveLimit();
+        }
+        if(peer.receive_buffer) {
+            fragment_size_ = std::min<size_t>(fragment_size_, peer.receive_buffer);
+        }
+        if(!peer.reliable && reliable_) {
+            // the peer will not acknowledge, release messages held back by the window
+            reliable_ = false;
+            this->Flush(flush_budget_);
+        }
+
+        bool server = this->state_ == State::Init;
+        if(this->ResumableSession(peer, server)) {
+            this->ResumeSession(peer.received, server);
+            return;
+        }
 
-        auto type               = NotifyHandshake(compress_types);
+        auto type               = NotifyHandshake(peer.compress_types);
         this->compress_context_ = CompressManager::Instance().GetCompressContext(type);
+        this->StartSession(peer, type, server);
 
-        if(this->state_ == State::Init) {
+        if(server) {
             if(this->compress_context_) {
                 this->Handshake({this->compress_context_->Type()});
             } else {
@@ -296,9 +979,221 @@ private:
         this->state_ = State::Connected;
     }
 
-    void OnTextFrame(const Frame &frame) { this->NotifyText(frame); }
+    // Attach the session named in the peer's handshake, true when it can be resumed
+    bool ResumableSession(const HandshakeInfo &peer, bool server) {
+        if(!peer.session || peer.session_token.empty()) {
+            return false;
+        }
+        if(server) {
+            auto session = session_store_ ? session_store_->Find(peer.session_token) : nullptr;
+            if(!session || !session->CanResume(peer.received, peer.replay_from)) {
+                return false;
+            }
+            session_       = std::move(session);
+            session_epoch_ = session_->Attach();
+            return true;
+        }
+        return resuming_ && session_ && peer.session_token == session_->Token() &&
+               session_->CanResume(peer.received, peer.replay_from);
+    }
+
+    // Continue the session on this connection: keep its codec, write the frames the peer is missing
+    void ResumeSession(uint64_t peer_received, bool server) {
+        resumed_  = true;
+        resuming_ = false;
+
+        // listeners still learn that the connection is up, the codec is not negotiated again
+        auto type = session_->GetCompressType();
+        this->NotifyHandshake(type == CompressType::None ? std::vector<CompressType>{} : std::vector{type});
+        this->compress_context_ = CompressManager::Instance().GetCompressContext(type);
+
+        if(server) {
+            this->Handshake({type});
+        }
+        this->state_ = State::Connected;
+
+        for(auto &frame : session_->Missing(peer_received)) {
+            if(reliable_) {
+                FrameHeader header;
+                memcpy(static_cast<void *>(&header), frame.Data(), std::min(sizeof(header), frame.Size()));
+                send_window_.Sent(header.Length(), header.Finished());
+            }
+            this->SendRawData(frame);
+        }
+    }
+
+    // New session for a connection that asked for one (or for a resume that failed)
+    void StartSession(const HandshakeInfo &peer, CompressType type, bool server) {
+        if(server) {
+            if(session_store_ && peer.session) {
+                session_       = session_store_->Create(type);
+                session_epoch_ = session_->Attach();
+            }
+            return;
+        }
+        if(session_ && !(peer.session && !peer.session_token.empty())) {
+            session_.reset(); // the server does not keep sessions
+        } else if(session_ && resuming_) {
+            session_->Reset(peer.session_token, type);
+        } else if(session_) {
+            session_->Issue(peer.session_token, type); // frames pipelined so far are already counted
+        }
+        resuming_ = false;
+    }
 
-    void OnBinaryFrame(const Frame &frame) { this->NotifyBinary(frame); }
+    void OnTextFrame(const Frame &frame) {
+        this->CountReceived();
+        if(frame.header.HasStream()) {
+            this->OnStreamFrame(frame);
+        } else if(this->RateLimitAdmits(frame, rate_lane_)) {
+            this->NotifyText(frame);
+        }
+        // outside reliable mode messages dropped by the rate limit count as processed for acks
+        this->MessageProcessed(frame.header);
+    }
+
+    void OnBinaryFrame(const Frame &frame) {
+        this->CountReceived();
+        if(frame.header.HasStream()) {
+            this->OnStreamFrame(frame);
+        } else if(this->RateLimitAdmits(frame, rate_lane_)) {
+            this->NotifyBinary(frame);
+        }
+        // outside reliable mode messages dropped by the rate limit count as processed for acks
+        this->MessageProcessed(frame.header);
+    }
+
+    void OnStreamFrame(const Frame &frame) {
+        if(frame.data.size <= FrameHeader::STREAM_ID_SIZE) {
+            ConnectionMetrics::Add(metrics_.parse_errors, 1);
+            this->NotifyError(Error::InvalidStreamFrame);
+            return;
+        }
+        uint32_t stream = 0;
+        memcpy(&stream, frame.data.buf, FrameHeader::STREAM_ID_SIZE);
+        stream = ntohl(stream);
+
+        auto *state = this->ReceivingStream(stream, frame.header.Finished());
+        if(state == nullptr) {
+            return;
+        }
+        if(this->RateLimitAdmits(frame, state->rate_lane)) {
+            this->NotifyStream(frame, stream, *state);
+        }
+        if(frame.header.Finished()) {
+            this->StreamReceived(stream);
+        }
+    }
+
+    /**
+     * State of a stream the peer writes into. Ids are the peer's to choose: a message completed by
+     * its first frame on a stream we keep nothing for uses a scratch state, and an entry created for
+     * an open message is erased by StreamReceived() on its last frame. Opening more than
+     * MaxReceivingStreams() messages at once is refused (TooManyStreams, CLOSE_PROTOCOL_ERROR)
+     */
+    StreamState *ReceivingStream(uint32_t stream, bool finish) {
+        auto it   = streams_.find(stream);
+        bool open = it != streams_.end() && it->second.receiving;
+        if(!finish && !open && receiving_streams_ >= max_receiving_streams_) {
+            ConnectionMetrics::Add(metrics_.parse_errors, 1);
+            this->NotifyError(Error::TooManyStreams);
+            if(state_ != State::Closing && state_ != State::Closed && state_ != State::Error) {
+                this->CloseNow(CloseCode::CLOSE_PROTOCOL_ERROR);
+            }
+            return nullptr;
+        }
+        if(it == streams_.end()) {
+            if(finish) {
+                scratch_stream_ = StreamState{};
+                return &scratch_stream_;
+            }
+            it = streams_.emplace(stream, StreamState{}).first;
+        }
+        if(!finish && !open) {
+            it->second.receiving = true;
+            ++receiving_streams_;
+        }
+        return &it->second;
+    }
+    // The last frame of a message on `stream` was handled
+    void StreamReceived(uint32_t stream) {
+        auto it = streams_.find(stream); // the listener may have closed the stream
+        if(it == streams_.end()) {
+            return;
+        }
+        auto &state = it->second;
+        if(state.receiving) {
+            state.receiving = false;
+            --receiving_streams_;
+        }
+        if(state.listener == nullptr && !state.utf8_send.Carrying()) {
+            streams_.erase(it);
+        }
+    }
+
+    // Charge a Text/Binary frame to the rate limit, false when it is not to be delivered
+    bool RateLimitAdmits(const Frame &frame, MessageLane &lane) {
+        if(!rate_limiter_.Enabled()) {
+            return true;
+        }
+        auto policy = rate_limiter_.Policy();
+        if(policy == RateLimitPolicy::Drop && reliable_) {
+            policy = RateLimitPolicy::Pause; // the ack would report a dropped message as delivered
+        }
+        bool first = lane == MessageLane::Idle;
+        bool last  = frame.header.Finished();
+
+        if(lane == MessageLane::Dropping ||
+           (first && policy == RateLimitPolicy::Drop && !rate_limiter_.Admits(frame.data.size, true))) {
+            // the decision taken on the first frame holds for the whole message
+            if(first) {
+                ConnectionMetrics::Add(metrics_.rate_limit_drops, 1);
+            }
+            lane = last ? MessageLane::Idle : MessageLane::Dropping;
+            return false;
+        }
+        if(policy == RateLimitPolicy::Close && !rate_limiter_.Admits(frame.data.size, first)) {
+            if(state_ != State::Closing) {
+                ConnectionMetrics::Add(metrics_.rate_limit_closes, 1);
+                this->NotifyError(Error::RateLimitExceeded);
+                this->CloseNow(CloseCode::CLOSE_PROTOCOL_ERROR);
+            }
+            return false;
+        }
+
+        rate_limiter_.Charge(frame.data.size, first);
+        lane = last ? MessageLane::Idle : MessageLane::Delivering;
+        if(policy == RateLimitPolicy::Pause && rate_limiter_.WaitNs() > 0) {
+            // this frame is delivered, ParseAll() stops before the next one
+            rate_paused_ = true;
+            ConnectionMetrics::Add(metrics_.rate_limit_pauses, 1);
+            metrics_.rate_limit_paused.store(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    // The listener returned from the last frame of a message, count it for the next ack
+    void MessageProcessed(const FrameHeader &header) {
+        if(reliable_ && header.Finished() && acks_.Processed()) {
+            this->SendAck();
+        }
+    }
+
+    void OnAckFrame(const Frame &frame) {
+        uint64_t sequence = 0;
+        if(frame.data.size == sizeof(sequence)) {
+            memcpy(&sequence, frame.data.buf, sizeof(sequence));
+            sequence = ntohll(sequence);
+        }
+        if(frame.data.size != sizeof(sequence) || !send_window_.Acknowledge(sequence)) {
+            ConnectionMetrics::Add(metrics_.parse_errors, 1);
+            this->NotifyError(Error::InvalidAckFrame);
+            return;
+        }
+        this->NotifyAck(sequence);
+        // room in the window for queued messages
+        this->Flush(flush_budget_);
+    }
 
     void OnPingFrame(const Frame &frame) { this->NotifyPing(); }
 
@@ -326,137 +1221,443 @@ private:
     }
 
 private:
-    FrameParser parser_;
+    BasicFrameParser<BasicWSocketContext> parser_;
 
 
 public:
-    class Listener {
-    public:
-        virtual ~Listener() = default;
-
-        virtual void OnError(std::error_code code) {}
+    using Listener = Handler;
 
-        virtual CompressType OnHandshake(const std::vector<CompressType> &supported_compress_type) {
-            return CompressType::None;
-        }
-        virtual void OnClose(int16_t code, const std::string &reason) {}
-        virtual void OnPing() {}
-        virtual void OnPong() {}
-
-        virtual void OnText(std::string_view text, bool finish) {}
-        virtual void OnBinary(Buffer buffer, bool finish) {}
-    };
     void ResetListener(Listener *listener) { listener_ = listener; }
 
     void NotifyError(std::error_code code) {
+        ConnectionMetrics::Add(metrics_.errors, 1);
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnError");
             listener_->OnError(code);
         }
     }
     CompressType NotifyHandshake(const std::vector<CompressType> &supported_compress_type) {
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnHandshake");
             return listener_->OnHandshake(supported_compress_type);
         }
         return CompressType::None;
     }
     void NotifyClose(int16_t code, const std::string &reason) {
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnClose");
             listener_->OnClose(code, reason);
         }
     }
     void NotifyPing() {
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnPing");
             listener_->OnPing();
         }
     }
     void NotifyPong() {
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnPong");
             listener_->OnPong();
         }
     }
+    void NotifyAck(uint64_t sequence) {
+        if constexpr(HasOnAck<Handler>::value) {
+            if(listener_) {
+                WSOCKET_TRACE_SCOPE("OnAck");
+                listener_->OnAck(sequence);
+            }
+        }
+    }
     void NotifyText(Frame frame) {
         auto buf = frame.data;
 
-        if(this->compress_context_) {
-            buf = this->compress_context_->Decompress(buf);
+        if(this->PayloadCompressed(frame.header)) {
+            buf = this->Decompress(buf);
             if(buf.buf == nullptr || buf.size == 0) {
+                ConnectionMetrics::Add(metrics_.parse_errors, 1);
                 this->NotifyError(Error::DecompressError);
                 return;
             }
         }
+        ConnectionMetrics::Add(metrics_.message_bytes_received, buf.size);
+
+        if(utf8_policy_ != Utf8Policy::Off &&
+           !this->CheckReceivedText(buf, frame.header.Finished(), utf8_receive_, utf8_dropping_)) {
+            return;
+        }
 
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnText");
             listener_->OnText(std::string_view(reinterpret_cast<char *>(buf.buf), buf.size), frame.header.Finished());
         }
     }
     void NotifyBinary(Frame frame) {
         auto buf = frame.data;
 
-        if(this->compress_context_) {
-            buf = this->compress_context_->Decompress(buf);
+        if(this->PayloadCompressed(frame.header)) {
+            buf = this->Decompress(buf);
             if(buf.buf == nullptr || buf.size == 0) {
+                ConnectionMetrics::Add(metrics_.parse_errors, 1);
                 this->NotifyError(Error::DecompressError);
                 return;
             }
         }
+        ConnectionMetrics::Add(metrics_.message_bytes_received, buf.size);
 
         if(listener_) {
+            WSOCKET_TRACE_SCOPE("OnBinary");
             listener_->OnBinary(buf, frame.header.Finished());
         }
     }
+    void NotifyStream(const Frame &frame, uint32_t stream, StreamState &state) {
+        Buffer buf{frame.data.buf + FrameHeader::STREAM_ID_SIZE, frame.data.size - FrameHeader::STREAM_ID_SIZE};
+        if(this->PayloadCompressed(frame.header)) {
+            buf = this->Decompress(buf);
+            if(buf.buf == nullptr || buf.size == 0) {
+                ConnectionMetrics::Add(metrics_.parse_errors, 1);
+                this->NotifyError(Error::DecompressError);
+                return;
+            }
+        }
+        ConnectionMetrics::Add(metrics_.message_bytes_received, buf.size);
+
+        StreamListener *listener = state.listener ? state.listener : default_stream_listener_;
+        if(frame.header.Type() == FrameHeader::Text) {
+            if(utf8_policy_ != Utf8Policy::Off) {
+                if(!this->CheckReceivedText(buf, frame.header.Finished(), state.utf8_receive, state.utf8_dropping)) {
+                    return;
+                }
+            }
+            if(listener) {
+                WSOCKET_TRACE_SCOPE("OnStreamText");
+                listener->OnText(stream,
+                                 std::string_view(reinterpret_cast<char *>(buf.buf), buf.size),
+                                 frame.header.Finished());
+            }
+        } else if(listener) {
+            WSOCKET_TRACE_SCOPE("OnStreamBinary");
+            listener->OnBinary(stream, buf, frame.header.Finished());
+        }
+    }
 
 
+private:
+    bool CheckReceivedText(const Buffer &buf, bool finish, Utf8Validator &validator, bool &dropping) {
+        if(dropping) {
+            // remaining fragments of a message already rejected
+            dropping = !finish;
+            return false;
+        }
+        if(validator.Feed(buf.buf, buf.size, finish)) {
+            return true;
+        }
+
+        validator.Reset();
+        dropping = !finish;
+        ConnectionMetrics::Add(metrics_.parse_errors, 1);
+        this->NotifyError(Error::InvalidUtf8);
+        if(utf8_policy_ == Utf8Policy::CloseOnInvalid && state_ == State::Connected) {
+            this->CloseNow(CloseCode::CLOSE_INVALID_PAYLOAD);
+        }
+        return false;
+    }
+
 private:
     Listener *listener_{nullptr};
 
+    Utf8Policy    utf8_policy_{Utf8Policy::Off};
+    Utf8Validator utf8_receive_;
+    Utf8Validator utf8_send_;
+    bool          utf8_dropping_{false};
+
+    std::unordered_map<uint32_t, StreamState> streams_;
+    StreamState                               scratch_stream_;
+    size_t                                    receiving_streams_      = 0;
+    size_t                                    max_receiving_streams_  = RECEIVING_STREAMS_DEFAULT;
+    StreamListener                           *default_stream_listener_{nullptr};
+    StreamScheduler                           stream_scheduler_;
+    size_t                                    fragment_size_          = FRAGMENT_DEFAULT;
+    size_t                                    flush_budget_           = std::numeric_limits<size_t>::max();
+    size_t                                    max_frame_size_         = std::numeric_limits<size_t>::max();
+    size_t                                    max_receive_frame_size_ = RECEIVE_FRAME_DEFAULT;
+    bool                                      legacy_peer_            = false;
+
+    std::shared_ptr<Session> session_;
+    SessionStore            *session_store_ = nullptr;
+    uint64_t                 session_epoch_ = 0;
+    bool                     resuming_      = false; // client, waiting to learn whether the session resumes
+    bool                     resumed_       = false;
+
+    bool            reliable_ = false; // enabled here, and announced by the peer once it answered
+    ReliableOptions reliable_options_;
+    AckBatcher      acks_;
+    SendWindow      send_window_;
+
+    RateLimiter rate_limiter_;
+    MessageLane rate_lane_   = MessageLane::Idle; // plain messages, streams have their own
+    bool        rate_paused_ = false;
+
+    // receive storage shared by the payloads retained during the running ParseProcess()
+    std::shared_ptr<std::unique_ptr<uint8_t[]>> lease_;
+
 public:
-    using SendHandler = std::function<void(const Buffer &data)>;
+    // Receives every encoded frame; a handler taking Buffer works too, keep the FrameBuffer to write later
+    using SendHandler = std::function<void(const FrameBuffer &data)>;
 
     void ResetSendHandler(SendHandler &&handler) { send_handler_ = std::move(handler); }
 
+    // Allocator for outbound frames, FramePool::Allocate (thread-local size classes) by default
+    void ResetFrameAllocator(FrameAllocator &&allocator) { frame_allocator_ = std::move(allocator); }
+
 private:
     void SendFrame(const Frame &frame) {
+        WSOCKET_TRACE_SCOPE("SendFrame");
         assert(frame.header.Length() == frame.data.size);
         size_t total_len = frame.header.HeaderLength() + frame.header.Length();
 
-        std::unique_ptr<uint8_t[]> data(new uint8_t[total_len]);
+        auto data = this->AllocateFrame(total_len);
 
-        memcpy(data.get(), &frame.header, frame.header.HeaderLength());
-        memcpy(data.get() + frame.header.HeaderLength(), frame.data.buf, frame.header.Length());
+        memcpy(data.Data(), &frame.header, frame.header.HeaderLength());
+        memcpy(data.Data() + frame.header.HeaderLength(), frame.data.buf, frame.header.Length());
 
-        SendRawData({data.get(), total_len});
+        metrics_.FrameSent(frame.header.Type());
+        this->RecordSent(frame.header, data);
+        SendRawData(data);
     }
     void SendFrames(const std::vector<Frame> &frames) {
+        WSOCKET_TRACE_SCOPE("SendFrames");
         size_t total_len = 0;
         for(auto &frame : frames) {
             assert(frame.header.Length() == frame.data.size);
             total_len += (frame.header.HeaderLength() + frame.data.size);
         }
-        std::unique_ptr<uint8_t[]> data(new uint8_t[total_len]);
-        size_t                     pos = 0;
+        auto   data = this->AllocateFrame(total_len);
+        size_t pos  = 0;
 
         for(auto &frame : frames) {
-            memcpy(&data[pos], &frame.header, frame.header.HeaderLength());
+            memcpy(data.Data() + pos, &frame.header, frame.header.HeaderLength());
             pos += frame.header.HeaderLength();
 
-            memcpy(&data[pos], frame.data.buf, frame.data.size);
+            memcpy(data.Data() + pos, frame.data.buf, frame.data.size);
             pos += frame.data.size;
+
+            metrics_.FrameSent(frame.header.Type());
         }
         assert(pos == total_len);
-        SendRawData({data.get(), total_len});
+        SendRawData(data);
+    }
+
+    // One frame per MaxFrameSize() slice of `buffer`, each compressed on its own so the peer can
+    // decode every frame as it arrives; the slices go straight from `buffer` into the frames
+    void SendFragments(FrameHeader::FrameType type, const Buffer &buffer, bool finish, bool compress) {
+        size_t pos = 0;
+        do {
+            auto   len   = std::min(max_frame_size_, buffer.size - pos);
+            bool   last  = pos + len == buffer.size;
+            Buffer piece = {buffer.buf + pos, len};
+            if(compress) {
+                piece = this->Compress(piece);
+                if(piece.buf == nullptr || piece.size == 0) {
+                    this->NotifyError(Error::CompressError);
+                    this->CloseNow(CloseCode::INTERNAL_ERROR);
+                    return;
+                }
+            }
+
+            Frame frame;
+            frame.header.Type(type);
+            frame.header.Length(piece.size);
+            frame.header.Finished(last && finish);
+            frame.header.Compressed(compress);
+            frame.data = piece;
+            this->SendFrame(frame);
+
+            pos += len;
+        } while(pos < buffer.size);
+    }
+
+    void CountReceived() {
+        if(session_) {
+            session_->Receive(session_epoch_);
+        }
+    }
+    void RecordSent(const FrameHeader &header, const FrameBuffer &data) {
+        this->RecordSent(header.Type(), header.Length(), header.Finished(), data);
+    }
+    void RecordSent(FrameHeader::FrameType type, size_t len, bool finish, const FrameBuffer &data) {
+        if(type != FrameHeader::Text && type != FrameHeader::Binary) {
+            return;
+        }
+        if(session_) {
+            session_->Record(session_epoch_, data);
+        }
+        if(reliable_) {
+            send_window_.Sent(len, finish);
+        }
     }
+    // The unacknowledged bytes filled the window, new messages wait in the queue
+    bool Throttled() const { return reliable_ && send_window_.Bytes() >= reliable_options_.window; }
 
-    void SendRawData(const Buffer &data) {
+    // RSV1 marks compressed payloads, legacy peers compress every Text frame without marking it
+    bool PayloadCompressed(const FrameHeader &header) const {
+        return header.Compressed() || (legacy_peer_ && this->compress_context_);
+    }
+
+    void SendHandshake(const std::vector<CompressType> &compressors) {
+        std::string payload;
+        if(legacy_peer_) {
+            payload = CompressManager::Instance().GetSupportedCompressors(compressors);
+        } else {
+            HandshakeInfo info;
+            for(auto type : compressors) {
+                if(CompressManager::Instance().IsSupported(type)) {
+                    info.compress_types.push_back(type);
+                }
+            }
+            constexpr size_t u32_max = std::numeric_limits<uint32_t>::max();
+            info.max_frame_size = max_frame_size_ > u32_max ? 0 : static_cast<uint32_t>(max_frame_size_);
+            info.receive_buffer = static_cast<uint32_t>(std::min(parser_.ReceiveBufferSize(), u32_max));
+            if(session_) {
+                info.session       = true;
+                info.session_token = session_->Token();
+                info.received      = session_->Received();
+                info.replay_from   = session_->ReplayFrom();
+            }
+            info.reliable = reliable_;
+            payload = info.Encode();
+        }
+
+        Frame frame;
+        frame.header.Finished(true);
+        frame.header.Type(FrameHeader::System);
+        frame.header.Length(payload.size());
+
+        frame.data.buf  = reinterpret_cast<uint8_t *>(payload.data());
+        frame.data.size = payload.size();
+        this->SendFrame(frame);
+    }
+
+    void QueueText(uint64_t lane, std::string_view text, bool finish, SendPriority priority, Utf8Validator &utf8) {
+        assert(this->CanSend());
+
+        if(text.empty()) {
+            this->NotifyError(Error::MessageEmpty);
+            return;
+        }
+        Buffer buffer{reinterpret_cast<uint8_t *>(const_cast<char *>(text.data())), text.size()};
+
+        if(utf8_policy_ != Utf8Policy::Off && !utf8.Feed(buffer.buf, buffer.size, finish)) {
+            utf8.Reset();
+            this->NotifyError(Error::InvalidUtf8);
+            return;
+        }
+        this->QueueMessage(lane, FrameHeader::Text, buffer, finish, priority);
+    }
+    void QueueBinary(uint64_t lane, Buffer buffer, bool finish, SendPriority priority) {
+        assert(this->CanSend());
+
+        if(buffer.size == 0) {
+            this->NotifyError(Error::MessageEmpty);
+            return;
+        }
+        this->QueueMessage(lane, FrameHeader::Binary, buffer, finish, priority);
+    }
+    void QueueMessage(
+            uint64_t lane, FrameHeader::FrameType type, const Buffer &buffer, bool finish, SendPriority priority) {
+        ConnectionMetrics::Add(metrics_.message_bytes_sent, buffer.size);
+
+        auto payload = this->AllocateFrame(buffer.size);
+        memcpy(payload.Data(), buffer.buf, buffer.size);
+        stream_scheduler_.Push(lane, type, std::move(payload), finish, priority);
+
+        this->Flush(flush_budget_);
+    }
+    void SendQueuedFragment(const StreamScheduler::Fragment &fragment) {
+        auto payload = fragment.payload;
+        if(this->compress_context_) {
+            payload = this->Compress(payload);
+            if(payload.buf == nullptr || payload.size == 0) {
+                this->NotifyError(Error::CompressError);
+                this->CloseNow(CloseCode::INTERNAL_ERROR);
+                return;
+            }
+        }
+        bool   has_stream = fragment.lane != StreamScheduler::PLAIN_LANE;
+        size_t id_len     = has_stream ? FrameHeader::STREAM_ID_SIZE : 0;
+
+        FrameHeader header;
+        header.Type(fragment.type);
+        header.Compressed(this->compress_context_ != nullptr);
+        header.HasStream(has_stream);
+        header.Length(id_len + payload.size);
+        header.Finished(fragment.finish);
+
+        size_t   header_len = header.HeaderLength();
+        uint32_t stream     = htonl(static_cast<uint32_t>(fragment.lane));
+        auto     data       = this->AllocateFrame(header_len + header.Length());
+        memcpy(data.Data(), &header, header_len);
+        memcpy(data.Data() + header_len, &stream, id_len);
+        memcpy(data.Data() + header_len + id_len, payload.buf, payload.size);
+
+        metrics_.FrameSent(header.Type());
+        this->RecordSent(header, data);
+        SendRawData(data);
+    }
+    void UpdateQueueGauges() {
+        metrics_.send_queue_frames.store(stream_scheduler_.PendingMessages(), std::memory_order_relaxed);
+        metrics_.send_queue_bytes.store(stream_scheduler_.PendingBytes(), std::memory_order_relaxed);
+    }
+
+    FrameBuffer AllocateFrame(size_t size) {
+        if(frame_allocator_) {
+            return frame_allocator_(size);
+        }
+        return FramePool::Allocate(size);
+    }
+
+    void SendRawData(const FrameBuffer &data) {
+        ConnectionMetrics::Add(metrics_.wire_bytes_sent, data.Size());
         if(send_handler_) {
             send_handler_(data);
         }
     }
 
+    // compress/decompress through compress_context_, timed
+    Buffer Compress(const Buffer &in) {
+        WSOCKET_TRACE_SCOPE("Compress");
+        auto start = std::chrono::steady_clock::now();
+        auto out   = this->compress_context_->Compress(in);
+        ConnectionMetrics::Add(metrics_.compress_ns, ElapsedNs(start));
+        ConnectionMetrics::Add(metrics_.compress_bytes_in, in.size);
+        ConnectionMetrics::Add(metrics_.compress_bytes_out, out.size);
+        return out;
+    }
+    Buffer Decompress(const Buffer &in) {
+        if(!this->compress_context_) {
+            return {}; // RSV1 set although no codec was agreed
+        }
+        WSOCKET_TRACE_SCOPE("Decompress");
+        auto start = std::chrono::steady_clock::now();
+        auto out   = this->compress_context_->Decompress(in);
+        ConnectionMetrics::Add(metrics_.decompress_ns, ElapsedNs(start));
+        ConnectionMetrics::Add(metrics_.decompress_bytes_in, in.size);
+        ConnectionMetrics::Add(metrics_.decompress_bytes_out, out.size);
+        return out;
+    }
+    static uint64_t ElapsedNs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
 private:
     SendHandler                      send_handler_;
+    FrameAllocator                   frame_allocator_;
     std::shared_ptr<CompressContext> compress_context_;
+    ConnectionMetrics                metrics_;
 };
 
+using WSocketContext = BasicWSocketContext<WSocketContextListener>;
+
 } // namespace wsocket
 
 #endif // WSOCKET__WSOCKET_CONTEXT_HPP
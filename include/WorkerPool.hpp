@@ -0,0 +1,216 @@
+#pragma once
+#ifndef WSOCKET__WORKER_POOL_HPP
+#define WSOCKET__WORKER_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "MpscQueue.hpp"
+
+
+namespace wsocket {
+
+/**
+ * Fixed set of threads running submitted tasks, with work stealing
+ *
+ * Every worker has its own deque: Submit() from a worker appends to that worker's deque, from any
+ * other thread the deques take turns. A worker runs its own tasks oldest first and, once they are
+ * gone, steals the newest task of another worker before going to sleep. The destructor runs what
+ * is still queued, then joins the threads.
+ */
+class WorkerPool {
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkerPool(size_t threads = std::max(1u, std::thread::hardware_concurrency())) :
+        queues_(std::max<size_t>(threads, 1)) {
+        for(size_t i = 0; i < queues_.size(); ++i) {
+            threads_.emplace_back([this, i] { this->Run(i); });
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for(auto &thread : threads_) {
+            thread.join();
+        }
+    }
+
+    WorkerPool(const WorkerPool &)            = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Any thread
+    void Submit(Task task) {
+        auto  index = Current() == this ? CurrentIndex() : next_.fetch_add(1, std::memory_order_relaxed);
+        auto &queue = queues_[index % queues_.size()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        queued_.fetch_add(1);
+        if(sleeping_.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex_);
+            wake_.notify_one();
+        }
+    }
+
+    size_t Threads() const { return threads_.size(); }
+    // Tasks waiting for a worker
+    size_t Queued() const {
+        return static_cast<size_t>(std::max<int64_t>(0, queued_.load(std::memory_order_relaxed)));
+    }
+    // Tasks run by a worker other than the one they were submitted to
+    uint64_t Steals() const { return steals_.load(std::memory_order_relaxed); }
+
+private:
+    struct alignas(64) Queue {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    static WorkerPool *&Current() {
+        thread_local WorkerPool *pool = nullptr;
+        return pool;
+    }
+    static size_t &CurrentIndex() {
+        thread_local size_t index = 0;
+        return index;
+    }
+
+    void Run(size_t index) {
+        Current()      = this;
+        CurrentIndex() = index;
+
+        Task task;
+        while(true) {
+            if(this->Take(index, task)) {
+                task();
+                task = nullptr; // release captures before sleeping
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex_);
+            // seq_cst against Submit(): it sees the sleeper or the sleeper sees its task
+            sleeping_.fetch_add(1);
+            wake_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+            sleeping_.fetch_sub(1);
+            if(stop_ && queued_.load() <= 0) {
+                return;
+            }
+        }
+    }
+
+    bool Take(size_t index, Task &task) {
+        for(size_t i = 0; i < queues_.size(); ++i) {
+            auto &queue = queues_[(index + i) % queues_.size()];
+
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if(queue.tasks.empty()) {
+                continue;
+            }
+            if(i == 0) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            } else {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                steals_.fetch_add(1, std::memory_order_relaxed);
+            }
+            queued_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::vector<Queue>       queues_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t>      next_{0};
+    std::atomic<int64_t>     queued_{0}; // below zero while a Submit() has pushed and not counted yet
+    std::atomic<size_t>      sleeping_{0};
+    std::atomic<uint64_t>    steals_{0};
+
+    std::mutex              sleep_mutex_;
+    std::condition_variable wake_;
+    bool                    stop_ = false;
+};
+
+/**
+ * Tasks of one owner (e.g. a connection) run one after another, in the order they were posted, on
+ * any thread of a WorkerPool; different serial queues run in parallel
+ *
+ * Post() pushes onto a lock-free MpscQueue and counts the task. The post that finds nothing
+ * counted submits the queue to the pool; a run takes everything pushed so far and submits it again
+ * when more was counted meanwhile, so at most one run is in flight and tasks never overtake each
+ * other. Instances come from Create(), a submitted run holds a reference that keeps the queue alive.
+ */
+class SerialQueue : public std::enable_shared_from_this<SerialQueue> {
+    explicit SerialQueue(WorkerPool &pool) : pool_(pool) {}
+
+public:
+    static std::shared_ptr<SerialQueue> Create(WorkerPool &pool) {
+        return std::shared_ptr<SerialQueue>(new SerialQueue(pool));
+    }
+    ~SerialQueue() {
+        for(auto *node = queue_.PopAll(); node;) {
+            delete std::exchange(node, node->next);
+        }
+    }
+
+    SerialQueue(const SerialQueue &)            = delete;
+    SerialQueue &operator=(const SerialQueue &) = delete;
+
+    // Any thread
+    void Post(WorkerPool::Task task) {
+        queue_.Push(new Node{nullptr, std::move(task)});
+        if(pending_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            this->Schedule();
+        }
+    }
+
+    // Tasks posted and not finished yet, once it reads 0 the effects of the finished ones are visible
+    int64_t Pending() const { return std::max<int64_t>(0, pending_.load(std::memory_order_acquire)); }
+
+private:
+    struct Node {
+        Node            *next;
+        WorkerPool::Task task;
+    };
+
+    void Schedule() {
+        pool_.Submit([self = this->shared_from_this()] { self->Drain(); });
+    }
+
+    void Drain() {
+        int64_t done = 0;
+        for(auto *node = queue_.PopAll(); node; ++done) {
+            node->task();
+            delete std::exchange(node, node->next);
+        }
+        // a task pushed but not counted yet may have run in this batch, the count goes negative
+        // until its Post() catches up, and that Post() does not schedule
+        if(pending_.fetch_sub(done, std::memory_order_acq_rel) > done) {
+            this->Schedule();
+        }
+    }
+
+private:
+    WorkerPool          &pool_;
+    MpscQueue<Node>      queue_;
+    std::atomic<int64_t> pending_{0};
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__WORKER_POOL_HPP
@@ -2,9 +2,14 @@
 #ifndef WSOCKET__COMPRESS_MANAGER_HPP
 #define WSOCKET__COMPRESS_MANAGER_HPP
 
+#include <cassert>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
+
+#include "Compress.hpp"
 
 #ifdef WITH_ZSTD
 #include "Zstd.hpp"
@@ -59,6 +64,10 @@ public:
         return it->second->Create();
     }
 
+    // Registered types, in registration order
+    std::vector<CompressType> GetSupportedCompressTypes() const { return compress_types_; }
+    bool                      IsSupported(CompressType type) const { return compress_ctxs_.count(type) != 0; }
+
     std::vector<CompressType> GetSupportedCompressTypes(const std::string &message) {
         std::vector<CompressType> types;
 
@@ -81,12 +90,14 @@ private:
         assert(!cxt->Name().empty());
         supported_compressors_ += cxt->Name();
 
+        compress_types_.push_back(cxt->Type());
         compress_names_.insert(std::make_pair(cxt->Name(), cxt->Type()));
         compress_ctxs_.insert(std::make_pair(cxt->Type(), cxt));
     }
 
 private:
     std::string                                                        supported_compressors_;
+    std::vector<CompressType>                                          compress_types_;
     std::unordered_map<std::string, CompressType>                      compress_names_;
     std::unordered_map<CompressType, std::shared_ptr<CompressContext>> compress_ctxs_;
 };
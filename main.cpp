@@ -1,9 +1,23 @@
 #include <bitset>
 #include <cassert>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <set>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
 
 #include "include/WSocketContext.hpp"
+#include "include/Capture.hpp"
 #include "include/ASIO_WSocket.hpp"
+#include "include/LoopbackPipe.hpp"
+#include "include/ASIO_AwaitableWSocket.hpp"
+#include "include/ASIO_WSocketClientPool.hpp"
+#include "include/WorkerPool.hpp"
+#include "include/ASIO_LoopMonitor.hpp"
 
 void testBasicHeader() {
     wsocket::BasicHeader header;
@@ -218,6 +232,81 @@ void testFrameHeader() {
     }
 }
 
+void test_FrameScanner() {
+    std::cout << "================== test_FrameScanner ==================" << std::endl;
+    assert(wsocket::FrameHeader::HeaderLength(253) == 2);
+    assert(wsocket::FrameHeader::HeaderLength(254) == 4);
+    assert(wsocket::FrameHeader::HeaderLength(255) == 10);
+
+    // uniform runs, mixed short frames, extended lengths and a partial tail
+    std::vector<uint8_t> stream;
+    auto                 append = [&](wsocket::FrameHeader::FrameType type, size_t len) {
+        wsocket::FrameHeader header;
+        header.Finished(true);
+        header.Type(type);
+        header.Length(len);
+        auto pos = stream.size();
+        stream.resize(pos + header.HeaderLength() + len, static_cast<uint8_t>(len));
+        memcpy(&stream[pos], &header, header.HeaderLength());
+    };
+    for(int i = 0; i < 100; ++i) {
+        append(wsocket::FrameHeader::Binary, 8);
+    }
+    for(int i = 0; i < 100; ++i) {
+        append(i % 3 ? wsocket::FrameHeader::Text : wsocket::FrameHeader::Binary, i);
+    }
+    append(wsocket::FrameHeader::Binary, 300);
+    append(wsocket::FrameHeader::Binary, 70000);
+    for(int i = 0; i < 20; ++i) {
+        append(wsocket::FrameHeader::Text, 0);
+    }
+    append(wsocket::FrameHeader::Text, 100);
+    auto full = stream;
+    stream.resize(stream.size() - 10);
+
+    std::vector<wsocket::FrameIndex> fast(stream.size()), scalar(stream.size());
+    size_t                           fast_scanned = 0, scalar_scanned = 0;
+    auto fast_n   = wsocket::FrameScanner::Scan(stream.data(), stream.size(), fast.data(), fast.size(), &fast_scanned);
+    auto scalar_n = wsocket::FrameScanner::ScanScalar(
+            stream.data(), stream.size(), scalar.data(), scalar.size(), &scalar_scanned);
+    assert(fast_n == 200 && scalar_n == 200 && fast_scanned == scalar_scanned);
+    for(size_t i = 0; i < fast_n; ++i) {
+        assert(fast[i].offset == scalar[i].offset && fast[i].length == scalar[i].length);
+    }
+
+    struct Collector {
+        void                OnFrame(const wsocket::Frame &frame) { lengths.push_back(frame.data.size); }
+        std::vector<size_t> lengths;
+    };
+    Collector                            one, all;
+    wsocket::BasicFrameParser<Collector> parser_one(&one);
+    wsocket::BasicFrameParser<Collector> parser_all(&all);
+    parser_one.Feed({stream.data(), stream.size()});
+    parser_all.Feed({stream.data(), stream.size()});
+    while(parser_one.ParseOne()) {
+    }
+    auto count = parser_all.ParseAll([] { return true; });
+    assert(count == 222 && one.lengths == all.lengths);
+    assert(all.lengths[200] == 300 && all.lengths[201] == 70000);
+
+    // the partial frame completes later
+    parser_all.Feed({full.data() + stream.size(), 10});
+    assert(parser_all.ParseAll([] { return true; }) == 1 && all.lengths.back() == 100);
+
+    // a 64 bit length that wraps around once the header is added is refused, not dispatched
+    const uint8_t huge[] = {0x82, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFB};
+    Collector     refused;
+    for(bool parse_all : {false, true}) {
+        wsocket::BasicFrameParser<Collector> parser(&refused);
+        parser.Feed({const_cast<uint8_t *>(huge), sizeof(huge)});
+        assert(parse_all ? parser.ParseAll([] { return true; }) == 0 : !parser.ParseOne());
+        assert(parser.FrameRefused() && refused.lengths.empty() && parser.Buffered() == sizeof(huge));
+        parser.PrepareWrite();
+        assert(parser.ReceiveBufferSize() < 1024); // the buffer does not grow for it
+    }
+    std::cout << "================== test_FrameScanner ==================" << std::endl;
+}
+
 std::string to_string(const wsocket::Buffer &buffer) {
     return std::string(reinterpret_cast<char *>(buffer.buf), buffer.size);
 }
@@ -310,6 +399,1513 @@ void test_WSocketContext() {
     ctx2.Close(wsocket::CloseCode::CLOSE_NORMAL);
     std::cout << "================== test_WSocketContext ==================" << std::endl;
 }
+class CountingClient : public wsocket::WSocketContext::Listener {
+public:
+    void OnText(std::string_view text, bool finish) override {
+        ++texts;
+        bytes += text.size();
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        ++binaries;
+        bytes += buffer.size;
+    }
+
+    size_t texts    = 0;
+    size_t binaries = 0;
+    size_t bytes    = 0;
+};
+
+void test_LoopbackPipe() {
+    std::cout << "================== test_LoopbackPipe ==================" << std::endl;
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        CountingClient          client1;
+        CountingClient          client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        // small ring forces the writer to drain inline
+        wsocket::LoopbackPipe pipe(ctx1, ctx2, wsocket::LoopbackPipe::Mode::Inline, 4096);
+
+        ctx1.Handshake();
+        pipe.Run();
+
+        constexpr size_t count = 1000 * 1000;
+        auto             start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i) {
+            ctx1.SendText("abcdefghijklmnopqrst");
+            ctx2.SendBinary(wsocket::Buffer({reinterpret_cast<uint8_t *>(const_cast<char *>("zxc")), 3}));
+        }
+        pipe.Run();
+        auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        assert(client2.texts == count);
+        assert(client2.bytes == count * 20);
+        assert(client1.binaries == count);
+        assert(client1.bytes == count * 3);
+        std::cout << "inline: " << static_cast<size_t>(2 * count / cost) << " msg/s" << std::endl;
+    }
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        CountingClient          client1;
+        CountingClient          client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2, wsocket::LoopbackPipe::Mode::Threaded);
+
+        // the handshake reply is written by ctx2 from the reader thread, poll it here before sending
+        ctx1.Handshake();
+        while(pipe.PollSecond() == 0) {
+        }
+        while(pipe.PollFirst() == 0) {
+        }
+
+        constexpr size_t  count = 1000 * 1000;
+        std::atomic<bool> done{false};
+        std::thread       reader([&] {
+            while(client2.texts < count) {
+                pipe.PollSecond();
+            }
+            done = true;
+        });
+
+        auto start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < count; ++i) {
+            ctx1.SendText("abcdefghijklmnopqrst");
+        }
+        reader.join();
+        auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        assert(done);
+        assert(client2.bytes == count * 20);
+        std::cout << "threaded: " << static_cast<size_t>(count / cost) << " msg/s" << std::endl;
+    }
+    {
+        // both sides fill the other's ring at once, a writer waiting on a full ring keeps its own moving
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        CountingClient          client1;
+        CountingClient          client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2, wsocket::LoopbackPipe::Mode::Threaded, 4096);
+        ctx1.Handshake();
+        while(pipe.PollSecond() == 0) {
+        }
+        while(pipe.PollFirst() == 0) {
+        }
+
+        constexpr size_t count = 1000;
+        std::string      text(1000, 'x');
+        std::thread      second([&] {
+            for(size_t i = 0; i < count; ++i) {
+                ctx2.SendText(text);
+            }
+            while(client2.texts < count) {
+                pipe.PollSecond();
+            }
+        });
+        for(size_t i = 0; i < count; ++i) {
+            ctx1.SendText(text);
+        }
+        while(client1.texts < count) {
+            pipe.PollFirst();
+        }
+        second.join();
+        assert(client1.bytes == count * text.size() && client2.bytes == count * text.size());
+    }
+    std::cout << "================== test_LoopbackPipe ==================" << std::endl;
+}
+
+// handler called statically by BasicWSocketContext, no virtual call on the receive path
+class StaticClient final {
+public:
+    void                  OnError(std::error_code code) {}
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) {
+        return wsocket::CompressType::None;
+    }
+    void OnClose(int16_t code, const std::string &reason) {}
+    void OnPing() {}
+    void OnPong() {}
+    void OnText(std::string_view text, bool finish) {
+        ++texts;
+        bytes += text.size();
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) {
+        ++binaries;
+        bytes += buffer.size;
+    }
+
+    size_t texts    = 0;
+    size_t binaries = 0;
+    size_t bytes    = 0;
+};
+
+void test_BasicWSocketContext() {
+    std::cout << "================== test_BasicWSocketContext ==================" << std::endl;
+    using Context = wsocket::BasicWSocketContext<StaticClient>;
+
+    Context      ctx1;
+    Context      ctx2;
+    StaticClient client1;
+    StaticClient client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+
+    wsocket::BasicLoopbackPipe<Context> pipe(ctx1, ctx2);
+
+    ctx1.Handshake();
+    pipe.Run();
+
+    constexpr size_t count = 1000 * 1000;
+    auto             start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < count; ++i) {
+        ctx1.SendText("abcdefghijklmnopqrst");
+    }
+    pipe.Run();
+    auto cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    assert(client2.texts == count);
+    assert(client2.bytes == count * 20);
+    std::cout << "static dispatch: " << static_cast<size_t>(count / cost) << " msg/s" << std::endl;
+    std::cout << "================== test_BasicWSocketContext ==================" << std::endl;
+}
+
+class Utf8Client : public CountingClient {
+public:
+    void OnError(std::error_code code) override { errors += code == wsocket::Error::InvalidUtf8; }
+    void OnClose(int16_t code, const std::string &reason) override { close_code = code; }
+
+    size_t  errors     = 0;
+    int16_t close_code = 0;
+};
+
+void test_Utf8() {
+    std::cout << "================== test_Utf8 ==================" << std::endl;
+    auto valid = [](std::string_view s) {
+        auto data   = reinterpret_cast<const uint8_t *>(s.data());
+        bool scalar = wsocket::Utf8Validator::ValidateScalar(data, s.size());
+        assert(scalar == wsocket::Utf8Validator::Validate(data, s.size()));
+        return scalar;
+    };
+    assert(valid("hello"));
+    assert(valid("h\xc3\xa9llo \xe6\x97\xa5\xe6\x9c\xac \xf0\x9f\x98\x80"));
+    assert(!valid("\xc0\xaf"));             // overlong
+    assert(!valid("\xe0\x80\xaf"));         // overlong
+    assert(!valid("\xed\xa0\x80"));         // surrogate
+    assert(!valid("\xf4\x90\x80\x80"));     // > U+10FFFF
+    assert(!valid("abc\xe6\x97"));          // truncated
+    assert(!valid("abc\x80"));              // stray continuation
+
+    // long inputs cross the 32 byte blocks at every offset
+    std::string text;
+    while(text.size() < 4096) {
+        text += "ab\xc3\xa9\xe6\x97\xa5\xf0\x9f\x98\x80";
+    }
+    assert(valid(text));
+    for(size_t i = 0; i < 200; ++i) {
+        auto broken = text;
+        broken[i]   = static_cast<char>(0xFF);
+        assert(!valid(broken));
+        broken = text.substr(0, text.size() - 1 - i % 3);
+        valid(broken);
+    }
+
+    // a code point split over fragments
+    {
+        wsocket::Utf8Validator validator;
+        auto                   data = reinterpret_cast<const uint8_t *>(text.data());
+        assert(validator.Feed(data, 3, false));
+        assert(validator.Feed(data + 3, 4, false));
+        assert(validator.Feed(data + 7, 1, false));
+        assert(validator.Feed(data + 8, text.size() - 8, true));
+        assert(!validator.Feed(data, 3, true));
+    }
+
+    // receive side policies
+    for(auto policy : {wsocket::Utf8Policy::Validate, wsocket::Utf8Policy::CloseOnInvalid}) {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        Utf8Client              client1;
+        Utf8Client              client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        ctx2.SetUtf8Policy(policy);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+
+        ctx1.SendText("\xe6\x97", false);
+        ctx1.SendText("\xa5", true);
+        ctx1.SendText("\xe6\x97\xa5\xff", false);
+        ctx1.SendText("dropped", true);
+        pipe.Run();
+
+        assert(client2.texts == 2 && client2.errors == 1);
+        if(policy == wsocket::Utf8Policy::CloseOnInvalid) {
+            assert(client1.close_code == static_cast<int16_t>(wsocket::CloseCode::CLOSE_INVALID_PAYLOAD));
+        } else {
+            assert(client1.close_code == 0);
+        }
+    }
+
+    // send side
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        Utf8Client              client1;
+        Utf8Client              client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        ctx1.SetUtf8Policy(wsocket::Utf8Policy::Validate);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+
+        ctx1.SendText("\xed\xa0\x80");
+        ctx1.SendText("ok");
+        pipe.Run();
+        assert(client1.errors == 1 && client2.texts == 1);
+    }
+    std::cout << "================== test_Utf8 ==================" << std::endl;
+}
+
+void test_Metrics() {
+    std::cout << "================== test_Metrics ==================" << std::endl;
+    auto before = wsocket::MetricsRegistry::Instance().Snapshot();
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        Utf8Client              client1;
+        Utf8Client              client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        ctx2.SetUtf8Policy(wsocket::Utf8Policy::Validate);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+
+        for(int i = 0; i < 10; ++i) {
+            ctx1.SendText("abcdefghijklmnopqrst");
+            ctx1.SendBinary(wsocket::Buffer({reinterpret_cast<uint8_t *>(const_cast<char *>("zxc")), 3}));
+        }
+        ctx1.SendText("\xff");
+        ctx1.Ping();
+        pipe.Run();
+
+        auto sent     = ctx1.Metrics().Snapshot();
+        auto received = ctx2.Metrics().Snapshot();
+        assert(sent.frames_sent[wsocket::FrameHeader::Text] == 11);
+        assert(sent.frames_sent[wsocket::FrameHeader::Binary] == 10);
+        assert(received.frames_received[wsocket::FrameHeader::Text] == 11);
+        assert(received.frames_received[wsocket::FrameHeader::Ping] == 1);
+        assert(received.frames_sent[wsocket::FrameHeader::Pong] == 0); // WSocketContext leaves Pong to its owner
+        assert(sent.message_bytes_sent == 10 * 23 + 1);
+        assert(received.message_bytes_received == sent.message_bytes_sent);
+        assert(received.wire_bytes_received == sent.wire_bytes_sent);
+        assert(received.parse_errors == 1 && received.errors == 1);
+
+        auto live = wsocket::MetricsRegistry::Instance().Snapshot();
+        assert(live.connections == before.connections + 2);
+    }
+    auto after = wsocket::MetricsRegistry::Instance().Snapshot();
+    assert(after.connections == before.connections);
+    assert(after.frames_received[wsocket::FrameHeader::Binary] ==
+           before.frames_received[wsocket::FrameHeader::Binary] + 10);
+
+    auto text = wsocket::MetricsToPrometheus(after, "instance=\"test\"");
+    assert(text.find("# TYPE wsocket_frames_received_total counter") != std::string::npos);
+    assert(text.find("wsocket_frames_received_total{instance=\"test\",opcode=\"binary\"}") != std::string::npos);
+    assert(text.find("wsocket_connections{instance=\"test\"}") != std::string::npos);
+    std::cout << wsocket::MetricsToPrometheus(after).substr(0, 300) << "..." << std::endl;
+    std::cout << "================== test_Metrics ==================" << std::endl;
+}
+
+void test_Trace() {
+    std::cout << "================== test_Trace ==================" << std::endl;
+#ifdef WSOCKET_TRACING
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        CountingClient          client1;
+        CountingClient          client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+        for(int i = 0; i < 100; ++i) {
+            ctx1.SendText("abcdefghijklmnopqrst");
+        }
+        WSOCKET_TRACE_INSTANT("sent");
+        pipe.Run();
+    }
+
+    std::ostringstream out;
+    wsocket::TraceCollector::Instance().WriteChromeJson(out);
+    auto json = out.str();
+    assert(json.find("\"name\":\"SendFrame\"") != std::string::npos);
+    assert(json.find("\"name\":\"OnText\"") != std::string::npos);
+    assert(json.find("\"name\":\"ParseAll\"") != std::string::npos);
+    assert(json.find("\"ph\":\"i\"") != std::string::npos);
+    std::ofstream("wsocket_trace.json") << json;
+    std::cout << "trace written to wsocket_trace.json" << std::endl;
+#else
+    std::cout << "built without WSOCKET_TRACING" << std::endl;
+#endif
+    std::cout << "================== test_Trace ==================" << std::endl;
+}
+
+void test_FramePool() {
+    std::cout << "================== test_FramePool ==================" << std::endl;
+    {
+        // a released block is reused by the next allocation of its class
+        uint8_t *first = nullptr;
+        {
+            auto buffer = wsocket::FramePool::Allocate(100);
+            assert(buffer.Size() == 100 && buffer.Capacity() == 256);
+            first = buffer.Data();
+        }
+        auto cached = wsocket::FramePool::CachedBlocks();
+        assert(cached >= 1);
+        auto again = wsocket::FramePool::Allocate(200);
+        assert(again.Data() == first);
+        assert(wsocket::FramePool::CachedBlocks() == cached - 1);
+
+        // copies share the block, the last one returns it
+        {
+            auto copy = again;
+            again.Reset();
+            assert(copy.Data() == first && !again);
+            assert(wsocket::FramePool::CachedBlocks() == cached - 1);
+        }
+        assert(wsocket::FramePool::CachedBlocks() == cached);
+
+        // above the largest class comes from the heap and is not cached
+        {
+            auto large = wsocket::FramePool::Allocate(1024 * 1024);
+            assert(large.Size() == 1024 * 1024 && large.Capacity() == 1024 * 1024);
+        }
+        assert(wsocket::FramePool::CachedBlocks() == cached);
+    }
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        CountingClient          client1;
+        CountingClient          client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        size_t allocations = 0;
+        ctx1.ResetFrameAllocator([&](size_t size) {
+            ++allocations;
+            return wsocket::FrameBuffer::Heap(size);
+        });
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+        allocations = 0;
+        for(int i = 0; i < 100; ++i) {
+            ctx1.SendText("abcdefghijklmnopqrst");
+        }
+        pipe.Run();
+        assert(allocations == 100);
+        assert(client2.texts == 100 && client2.bytes == 100 * 20);
+
+        // a transport may keep frames past the send call
+        std::vector<wsocket::FrameBuffer> held;
+        ctx2.ResetSendHandler([&](const wsocket::FrameBuffer &data) { held.push_back(data); });
+        ctx2.SendText("hold");
+        ctx2.SendText("these");
+        assert(held.size() == 2);
+        for(auto &frame : held) {
+            ctx1.Feed(frame);
+        }
+        assert(client1.texts == 2 && client1.bytes == 9);
+    }
+    std::cout << "================== test_FramePool ==================" << std::endl;
+}
+
+void test_ReceiveBuffer() {
+    std::cout << "================== test_ReceiveBuffer ==================" << std::endl;
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+    CountingClient          client1;
+    CountingClient          client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+
+    wsocket::LoopbackPipe pipe(ctx1, ctx2);
+    ctx1.Handshake();
+    pipe.Run();
+    auto base = ctx2.ReceiveBufferSize();
+    assert(base == 8 * 1024);
+
+    // grows to hold a large frame
+    std::vector<uint8_t> large(300 * 1024, 'x');
+    ctx1.SendBinary({large.data(), large.size()});
+    pipe.Run();
+    assert(client2.binaries == 1 && client2.bytes == large.size());
+    assert(ctx2.ReceiveBufferSize() >= large.size() + 10);
+    assert(ctx2.Metrics().Snapshot().receive_buffer_bytes == ctx2.ReceiveBufferSize());
+
+    // and shrinks back once small messages were all it saw for a while
+    for(size_t i = 0; i < 2 * wsocket::BasicFrameParser<wsocket::WSocketContext>::SHRINK_AFTER; ++i) {
+        ctx1.SendText("abcdefghijklmnopqrst");
+        pipe.Run();
+    }
+    assert(ctx2.ReceiveBufferSize() == base);
+
+    // an idle connection can drop it entirely
+    assert(ctx2.ReleaseReceiveBuffer());
+    assert(ctx2.ReceiveBufferSize() == 0 && ctx2.Metrics().Snapshot().receive_buffer_bytes == 0);
+    ctx1.SendText("again");
+    pipe.Run();
+    assert(client2.texts == 2 * wsocket::BasicFrameParser<wsocket::WSocketContext>::SHRINK_AFTER + 1);
+    assert(ctx2.ReceiveBufferSize() == base);
+
+    // but not in the middle of a frame
+    ctx2.Feed({large.data(), 2});
+    assert(ctx2.ReceiveBuffered() == 2 && !ctx2.ReleaseReceiveBuffer());
+
+    // frames above the receive limit are refused from their header, the buffer does not grow for them
+    class ErrorLog : public CountingClient {
+    public:
+        void OnError(std::error_code code) override { last_error = code; }
+
+        std::error_code last_error;
+    };
+    auto feed_header = [](wsocket::WSocketContext &ctx, uint64_t len) {
+        wsocket::FrameHeader header;
+        header.Type(wsocket::FrameHeader::Binary);
+        header.Finished(true);
+        header.Length(len);
+        auto buf = ctx.PrepareWrite();
+        memcpy(buf.buf, &header, header.HeaderLength());
+        ctx.CommitWrite(header.HeaderLength());
+    };
+    for(uint64_t len : {uint64_t(1) << 46, uint64_t(64 * 1024 * 1024 + 1)}) {
+        wsocket::WSocketContext ctx;
+        ErrorLog                client;
+        std::string             sent;
+        ctx.ResetListener(&client);
+        ctx.ResetSendHandler([&](wsocket::Buffer buffer) { sent.append(to_string(buffer)); });
+        feed_header(ctx, len);
+        assert(client.last_error == wsocket::Error::PayloadTooLong && ctx.ReceiveBufferSize() == base);
+        assert(reinterpret_cast<const wsocket::FrameHeader *>(sent.data())->Type() == wsocket::FrameHeader::Close);
+    }
+    {
+        // MaxFrameSize() bounds what the peer sends, with room for a stream id and compression
+        wsocket::WSocketContext ctx;
+        ErrorLog                client;
+        ctx.ResetListener(&client);
+        ctx.SetMaxFrameSize(1000);
+        feed_header(ctx, 1100);
+        assert(!client.last_error && ctx.ReceiveBufferSize() == base);
+
+        wsocket::WSocketContext larger;
+        larger.ResetListener(&client);
+        larger.SetMaxFrameSize(1000);
+        feed_header(larger, 4000);
+        assert(client.last_error == wsocket::Error::PayloadTooLong);
+
+        client.last_error = {};
+        wsocket::WSocketContext capped;
+        capped.ResetListener(&client);
+        capped.SetMaxFrameSize(1000);
+        capped.SetMaxReceiveFrameSize(1050);
+        feed_header(capped, 1100);
+        assert(client.last_error == wsocket::Error::PayloadTooLong);
+    }
+    std::cout << "================== test_ReceiveBuffer ==================" << std::endl;
+}
+
+class StreamLog : public wsocket::StreamListener {
+public:
+    void OnText(uint32_t stream, std::string_view text, bool finish) override {
+        order.push_back(stream);
+        messages[stream].append(text);
+        finished[stream] += finish;
+    }
+    void OnBinary(uint32_t stream, wsocket::Buffer buffer, bool finish) override {
+        order.push_back(stream);
+        messages[stream].append(reinterpret_cast<const char *>(buffer.buf), buffer.size);
+        finished[stream] += finish;
+    }
+
+    std::vector<uint32_t>                     order;
+    std::unordered_map<uint32_t, std::string> messages;
+    std::unordered_map<uint32_t, int>         finished;
+};
+
+void test_Streams() {
+    std::cout << "================== test_Streams ==================" << std::endl;
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+    Utf8Client              client1;
+    Utf8Client              client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+    ctx2.SetUtf8Policy(wsocket::Utf8Policy::Validate);
+
+    StreamLog one;
+    StreamLog others;
+    ctx2.ResetStreamListener(1, &one);
+    ctx2.ResetStreamListener(&others);
+
+    wsocket::LoopbackPipe pipe(ctx1, ctx2);
+    ctx1.Handshake();
+    pipe.Run();
+
+    // queue everything, then flush: the large message is interleaved with the small ones
+    ctx1.SetFragmentSize(1024);
+    ctx1.SetFlushBudget(0);
+    std::string large(10 * 1024, 'L');
+    ctx1.SendBinary(1, {reinterpret_cast<uint8_t *>(large.data()), large.size()});
+    ctx1.SendText(2, "small");
+    // a code point split across fragments of stream 3, interleaved with stream 2
+    ctx1.SendText(3, "caf\xc3", false);
+    ctx1.SendText(2, " again");
+    ctx1.SendText(3, "\xa9");
+    ctx1.SendText("plain");
+    assert(ctx1.PendingSendBytes() == large.size() + 5 + 4 + 6 + 1);
+
+    assert(ctx1.Flush(2048) >= 2048);
+    ctx1.Flush();
+    assert(ctx1.PendingSendBytes() == 0);
+    pipe.Run();
+
+    assert(one.messages[1] == large && one.finished[1] == 1);
+    assert(one.order.size() == 10);
+    assert(others.messages[2] == "small again" && others.finished[2] == 2);
+    assert(others.messages[3] == "caf\xc3\xa9" && others.finished[3] == 1);
+    assert(others.order.size() == 4 && others.order[0] == 2 && others.order[1] == 3);
+    assert(client2.texts == 1 && client2.errors == 0);
+
+    // stream frames are ordinary Text/Binary frames on the wire
+    assert(ctx2.Metrics().Snapshot().frames_received[wsocket::FrameHeader::Text] == 5);
+
+    // ids are the peer's to choose: only messages still open on a stream are kept, and their number is bounded
+    ctx2.SetMaxReceivingStreams(2);
+    for(uint32_t stream = 100; stream < 1100; ++stream) {
+        ctx1.SendText(stream, "x");
+    }
+    ctx1.SendText(10, "a", false);
+    ctx1.SendText(11, "b", false);
+    ctx1.Flush();
+    pipe.Run();
+    assert(others.messages[1099] == "x" && ctx2.ReceivingStreams() == 2);
+    ctx1.SendText(10, "c");
+    ctx1.SendText(12, "d", false);
+    ctx1.Flush();
+    pipe.Run();
+    assert(others.finished[10] == 1 && ctx2.ReceivingStreams() == 2);
+    auto parse_errors = ctx2.Metrics().Snapshot().parse_errors;
+    ctx1.SendText(13, "e", false);
+    ctx1.Flush();
+    pipe.Run();
+    assert(others.messages.count(13) == 0 && ctx2.Metrics().Snapshot().parse_errors == parse_errors + 1);
+    assert(!ctx2.CanSend() && client1.close_code == static_cast<int16_t>(wsocket::CloseCode::CLOSE_PROTOCOL_ERROR));
+    std::cout << "================== test_Streams ==================" << std::endl;
+}
+
+class ArrivalLog : public wsocket::WSocketContext::Listener, public wsocket::StreamListener {
+public:
+    void OnPing() override { arrivals.emplace_back("ping"); }
+    void OnText(std::string_view text, bool finish) override { arrivals.emplace_back(text); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { arrivals.emplace_back("binary"); }
+    void OnText(uint32_t stream, std::string_view text, bool finish) override {
+        arrivals.push_back(std::to_string(stream) + ":" + std::string(text));
+    }
+
+    std::vector<std::string> arrivals;
+};
+
+void test_SendPriority() {
+    std::cout << "================== test_SendPriority ==================" << std::endl;
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+    ArrivalLog              log1;
+    ArrivalLog              log2;
+    ctx1.ResetListener(&log1);
+    ctx2.ResetListener(&log2);
+    ctx2.ResetStreamListener(&log2);
+
+    wsocket::LoopbackPipe pipe(ctx1, ctx2);
+    ctx1.Handshake();
+    pipe.Run();
+
+    ctx1.SetFragmentSize(1000);
+    ctx1.SetFlushBudget(0);
+    std::vector<uint8_t> bulk(5000, 'b');
+    ctx1.SendBinary({bulk.data(), bulk.size()}, true, wsocket::SendPriority::Bulk);
+    ctx1.SendText(1, "normal");
+    ctx1.SendText(2, "urgent", true, wsocket::SendPriority::Urgent);
+    // plain messages overtake the queued Bulk one, in order within their class; a plain message
+    // without a priority joins as Urgent
+    ctx1.SendText("high1", true, wsocket::SendPriority::High);
+    ctx1.SendText("high2", true, wsocket::SendPriority::High);
+    ctx1.SendText("after");
+    // control frames are never queued
+    ctx1.Ping();
+
+    auto queued = ctx1.Metrics().Snapshot();
+    assert(queued.send_queue_frames == 6 && queued.send_queue_bytes == 5000 + 6 + 6 + 5 + 5 + 5);
+
+    ctx1.Flush();
+    pipe.Run();
+    std::vector<std::string> expected = {"ping",
+                                         "2:urgent",
+                                         "after",
+                                         "high1",
+                                         "high2",
+                                         "1:normal",
+                                         "binary",
+                                         "binary",
+                                         "binary",
+                                         "binary",
+                                         "binary"};
+    assert(log2.arrivals == expected);
+
+    // a message that started, or one sent in parts, is not overtaken
+    log2.arrivals.clear();
+    ctx1.SendBinary({bulk.data(), bulk.size()}, true, wsocket::SendPriority::Bulk);
+    ctx1.Flush(1000);
+    ctx1.SendText("urgent1", true, wsocket::SendPriority::Urgent);
+    ctx1.SendText("part1", false, wsocket::SendPriority::Bulk);
+    ctx1.SendText("part2", true, wsocket::SendPriority::Bulk);
+    ctx1.SendText("urgent2", true, wsocket::SendPriority::Urgent);
+    ctx1.Flush();
+    pipe.Run();
+    expected = {"binary", "binary", "binary", "binary", "binary", "urgent1", "part1", "part2", "urgent2"};
+    assert(log2.arrivals == expected);
+
+    auto flushed = ctx1.Metrics().Snapshot();
+    assert(flushed.send_queue_frames == 0 && flushed.send_queue_bytes == 0);
+    std::cout << "================== test_SendPriority ==================" << std::endl;
+}
+
+class FragmentLog : public Utf8Client {
+public:
+    void OnText(std::string_view text, bool finish) override {
+        Utf8Client::OnText(text, finish);
+        finished.push_back(finish);
+        sizes.push_back(text.size());
+        message.append(text);
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        Utf8Client::OnBinary(buffer, finish);
+        finished.push_back(finish);
+        sizes.push_back(buffer.size);
+    }
+
+    std::vector<bool>   finished;
+    std::vector<size_t> sizes;
+    std::string         message;
+};
+
+void test_Fragmentation() {
+    std::cout << "================== test_Fragmentation ==================" << std::endl;
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+    Utf8Client              client1;
+    FragmentLog             client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+    ctx2.SetUtf8Policy(wsocket::Utf8Policy::Validate);
+
+    wsocket::LoopbackPipe pipe(ctx1, ctx2);
+    ctx1.Handshake();
+    pipe.Run();
+
+    ctx1.SetMaxFrameSize(1000);
+    std::vector<uint8_t> binary(4500, 'x');
+    ctx1.SendBinary({binary.data(), binary.size()});
+    pipe.Run();
+    assert((client2.sizes == std::vector<size_t>{1000, 1000, 1000, 1000, 500}));
+    assert((client2.finished == std::vector<bool>{false, false, false, false, true}));
+
+    // multibyte characters cut at frame boundaries still validate across the continuation frames
+    std::string text;
+    while(text.size() < 2500) {
+        text += "\xe6\x97\xa5\xf0\x9f\x98\x80";
+    }
+    client2.finished.clear();
+    ctx1.SendText(text);
+    pipe.Run();
+    assert(client2.message == text && client2.errors == 0);
+    assert(client2.finished.size() == 3 && client2.finished.back());
+
+    // a message the caller leaves open keeps its last frame open as well
+    client2.finished.clear();
+    ctx1.SendBinary({binary.data(), 1500}, false);
+    ctx1.SendBinary({binary.data(), 10});
+    pipe.Run();
+    assert((client2.finished == std::vector<bool>{false, false, true}));
+
+    // frames at the limit go out whole
+    client2.sizes.clear();
+    ctx1.SendBinary({binary.data(), 1000});
+    pipe.Run();
+    assert(client2.sizes == std::vector<size_t>{1000});
+    assert(client2.close_code == 0);
+    std::cout << "================== test_Fragmentation ==================" << std::endl;
+}
+
+class NegotiatingClient : public FragmentLog {
+public:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) override {
+        offered = supported_compress_type;
+        return supported_compress_type.empty() ? wsocket::CompressType::None : supported_compress_type[0];
+    }
+    void OnError(std::error_code code) override {
+        FragmentLog::OnError(code);
+        last_error = code;
+    }
+
+    std::vector<wsocket::CompressType> offered;
+    std::error_code                    last_error;
+};
+
+// Feed one System frame with `payload` to `ctx`
+void FeedSystemFrame(wsocket::WSocketContext &ctx, const std::string &payload) {
+    wsocket::FrameHeader header;
+    header.Type(wsocket::FrameHeader::System);
+    header.Finished(true);
+    header.Length(payload.size());
+
+    std::string frame(reinterpret_cast<const char *>(&header), header.HeaderLength());
+    frame += payload;
+    ctx.Feed({reinterpret_cast<uint8_t *>(frame.data()), frame.size()});
+}
+
+void test_Handshake() {
+    std::cout << "================== test_Handshake ==================" << std::endl;
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        NegotiatingClient       client1;
+        NegotiatingClient       client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.SetMaxFrameSize(1000);
+        ctx2.SetReceiveBufferSize(4096);
+        ctx1.Handshake();
+        // pipelined behind the handshake, before the peer answered
+        ctx1.SendText("early");
+        pipe.Run();
+        assert(client2.message == "early");
+        assert(ctx1.MaxFrameSize() == 1000 && ctx2.MaxFrameSize() == 1000);
+        assert(ctx1.FragmentSize() == 4096);
+        assert(client1.offered == client2.offered);
+
+#ifdef WITH_ZSTD
+        assert(client2.offered == std::vector<wsocket::CompressType>{wsocket::CompressType::Zstd});
+        // compressed Text is marked (RSV1), Binary goes out as is and must not be decompressed
+        std::string text(3000, 'z');
+        uint8_t     binary[4] = {1, 2, 3, 4};
+        ctx1.SendText(text);
+        ctx2.SendBinary({binary, sizeof(binary)});
+        pipe.Run();
+        assert(client2.message == "early" + text);
+        assert(client1.sizes == std::vector<size_t>{4});
+        assert(ctx1.Metrics().Snapshot().compress_bytes_in == text.size());
+#endif
+        assert(!client1.last_error && !client2.last_error);
+    }
+    {
+        // a peer sending the legacy codec names gets them back
+        wsocket::WSocketContext ctx;
+        NegotiatingClient       client;
+        std::string             reply;
+        ctx.ResetListener(&client);
+        ctx.ResetSendHandler(
+                [&](wsocket::Buffer buffer) { reply.assign(reinterpret_cast<const char *>(buffer.buf), buffer.size); });
+
+        auto names = wsocket::CompressManager::Instance().GetSupportedCompressors();
+        FeedSystemFrame(ctx, names);
+        assert(reply.substr(2) == names);
+        assert(client.offered == wsocket::CompressManager::Instance().GetSupportedCompressTypes());
+    }
+    {
+        // truncated field
+        wsocket::WSocketContext ctx;
+        NegotiatingClient       client;
+        ctx.ResetListener(&client);
+        FeedSystemFrame(ctx, std::string("\x01\x02\x04\x00", 4));
+        assert(client.last_error == wsocket::Error::SysFrameError);
+    }
+    {
+        // a frame length that wraps around is a protocol error
+        wsocket::WSocketContext ctx;
+        NegotiatingClient       client;
+        ctx.ResetListener(&client);
+        std::string sent;
+        ctx.ResetSendHandler([&](wsocket::Buffer buffer) { sent.append(to_string(buffer)); });
+
+        uint8_t huge[] = {0x82, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFB};
+        ctx.Feed({huge, sizeof(huge)});
+        assert(client.last_error == wsocket::Error::PayloadTooLong && client.sizes.empty());
+        assert(!ctx.CanSend());
+        auto *close = reinterpret_cast<const wsocket::FrameHeader *>(sent.data());
+        assert(close->Type() == wsocket::FrameHeader::Close);
+        assert(ctx.Metrics().Snapshot().parse_errors == 1);
+        // later data is not parsed either
+        ctx.Feed({huge, sizeof(huge)});
+        assert(client.sizes.empty() && ctx.Metrics().Snapshot().parse_errors == 1);
+    }
+    std::cout << "================== test_Handshake ==================" << std::endl;
+}
+
+void test_Session() {
+    std::cout << "================== test_Session ==================" << std::endl;
+    wsocket::SessionStore store;
+    auto                  session = std::make_shared<wsocket::Session>();
+    {
+        wsocket::WSocketContext client;
+        wsocket::WSocketContext server;
+        NegotiatingClient       client_log;
+        NegotiatingClient       server_log;
+        client.ResetListener(&client_log);
+        server.ResetListener(&server_log);
+        client.UseSession(session);
+        server.ResetSessionStore(&store);
+        {
+            wsocket::LoopbackPipe pipe(client, server);
+            client.Handshake();
+            client.SendText("a"); // pipelined, counted before the token is known
+            pipe.Run();
+            server.SendText("b");
+            pipe.Run();
+            assert(session->Token().size() == wsocket::Session::TOKEN_SIZE && store.Size() == 1);
+            assert(server.GetSession()->Token() == session->Token());
+            assert(wsocket::Session::NewToken() != session->Token());
+            assert(!client.SessionResumed() && !server.SessionResumed());
+
+            client.SendText("lost1");
+            server.SendText("lost2");
+        } // the link drops with both messages in flight
+        assert(server_log.message == "a" && client_log.message == "b");
+        assert(session->Sent() == 2 && session->Received() == 1);
+    }
+    {
+        // reconnect: the handshake resumes and each side writes again what the other one missed
+        wsocket::WSocketContext client;
+        wsocket::WSocketContext server;
+        NegotiatingClient       client_log;
+        NegotiatingClient       server_log;
+        client.ResetListener(&client_log);
+        server.ResetListener(&server_log);
+        client.UseSession(session);
+        server.ResetSessionStore(&store);
+
+        wsocket::LoopbackPipe pipe(client, server);
+        client.Handshake();
+        pipe.Run();
+        assert(client.SessionResumed() && server.SessionResumed());
+        assert(server_log.message == "lost1" && client_log.message == "lost2");
+#ifdef WITH_ZSTD
+        // the codec of the session is kept instead of negotiated
+        assert(client_log.offered == std::vector<wsocket::CompressType>{wsocket::CompressType::Zstd});
+        assert(server_log.offered == client_log.offered);
+#endif
+        client.SendText("c");
+        pipe.Run();
+        assert(server_log.message == "lost1c" && store.Size() == 1);
+        assert(!client_log.last_error && !server_log.last_error);
+    }
+    {
+        // a session the server forgot starts over
+        auto token = session->Token();
+        store.Erase(token);
+
+        wsocket::WSocketContext client;
+        wsocket::WSocketContext server;
+        NegotiatingClient       client_log;
+        NegotiatingClient       server_log;
+        client.ResetListener(&client_log);
+        server.ResetListener(&server_log);
+        client.UseSession(session);
+        server.ResetSessionStore(&store);
+
+        wsocket::LoopbackPipe pipe(client, server);
+        client.Handshake();
+        pipe.Run();
+        assert(!client.SessionResumed() && !server.SessionResumed());
+        assert(session->Token() != token && session->Sent() == 0 && store.Size() == 1);
+        assert(client_log.message.empty() && server_log.message.empty());
+    }
+    {
+        // the message the client missed fell out of the server's replay window
+        wsocket::SessionStore small(10, 8);
+        auto                  lost = std::make_shared<wsocket::Session>();
+        {
+            wsocket::WSocketContext client;
+            wsocket::WSocketContext server;
+            NegotiatingClient       client_log;
+            NegotiatingClient       server_log;
+            client.ResetListener(&client_log);
+            server.ResetListener(&server_log);
+            client.UseSession(lost);
+            server.ResetSessionStore(&small);
+
+            wsocket::LoopbackPipe pipe(client, server);
+            client.Handshake();
+            pipe.Run();
+            server.SendText("a message longer than the window");
+        }
+        wsocket::WSocketContext client;
+        wsocket::WSocketContext server;
+        NegotiatingClient       client_log;
+        NegotiatingClient       server_log;
+        client.ResetListener(&client_log);
+        server.ResetListener(&server_log);
+        client.UseSession(lost);
+        server.ResetSessionStore(&small);
+
+        wsocket::LoopbackPipe pipe(client, server);
+        client.Handshake();
+        pipe.Run();
+        assert(!client.SessionResumed() && client_log.message.empty());
+        assert(small.Size() == 2);
+    }
+    std::cout << "================== test_Session ==================" << std::endl;
+}
+
+class AckLog : public NegotiatingClient {
+public:
+    void OnAck(uint64_t sequence) override { acks.push_back(sequence); }
+
+    std::vector<uint64_t> acks;
+};
+
+void test_Reliable() {
+    std::cout << "================== test_Reliable ==================" << std::endl;
+    {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        AckLog                  client1;
+        AckLog                  client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        wsocket::ReliableOptions options;
+        options.ack_every = 4;
+        options.ack_delay = std::chrono::milliseconds(1000);
+        options.window    = 64;
+        ctx1.SetReliable(options);
+        ctx2.SetReliable(options);
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+        assert(ctx1.Reliable() && ctx2.Reliable());
+
+        // below ack_every the ack waits for its deadline
+        uint8_t binary[40] = {};
+        ctx1.SendText("one");
+        ctx1.SendText("two", false);
+        ctx1.SendText("!");
+        pipe.Run();
+        assert(ctx1.SentSequence() == 2 && ctx1.AckedSequence() == 0 && client1.acks.empty());
+        assert(ctx2.AckDeadline().has_value());
+        ctx2.SendAck();
+        pipe.Run();
+        assert(client1.acks == std::vector<uint64_t>{2} && ctx1.UnackedBytes() == 0);
+        assert(!ctx2.AckDeadline());
+
+        // one ack per ack_every messages
+        for(int i = 0; i < 8; ++i) {
+            ctx1.SendText("batch");
+        }
+        pipe.Run();
+        assert((client1.acks == std::vector<uint64_t>{2, 6, 10}));
+        assert(ctx2.Metrics().Snapshot().frames_sent[wsocket::FrameHeader::Ack] == 3);
+
+        // a full window holds new messages back until the ack arrives
+        ctx1.SendBinary({binary, sizeof(binary)});
+        ctx1.SendBinary({binary, sizeof(binary)});
+        ctx1.SendBinary({binary, sizeof(binary)});
+        assert(ctx1.UnackedBytes() == 80 && ctx1.PendingSendBytes() == sizeof(binary));
+        pipe.Run();
+        assert(client2.sizes.size() == 13 && ctx1.PendingSendBytes() == sizeof(binary));
+        ctx2.SendAck();
+        pipe.Run();
+        assert(client2.sizes.size() == 14 && ctx1.PendingSendBytes() == 0);
+        assert(ctx1.AckedSequence() == 12 && ctx1.UnackedBytes() != 0); // the queued copy may be compressed
+        assert(!client1.last_error && !client2.last_error);
+    }
+    {
+        // a peer that does not acknowledge turns it off
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        AckLog                  client1;
+        AckLog                  client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        ctx1.SetReliable();
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake();
+        pipe.Run();
+        assert(!ctx1.Reliable());
+        ctx1.SendText("plain");
+        ctx2.SendText("plain");
+        pipe.Run();
+        assert(client1.message == "plain" && client2.message == "plain" && !ctx2.AckDeadline());
+    }
+    {
+        // an ack for messages never sent
+        wsocket::WSocketContext ctx;
+        AckLog                  client;
+        ctx.ResetListener(&client);
+        ctx.SetReliable();
+
+        uint64_t             sequence = htonll(5);
+        wsocket::FrameHeader header;
+        header.Type(wsocket::FrameHeader::Ack);
+        header.Finished(true);
+        header.Length(sizeof(sequence));
+        std::string frame(reinterpret_cast<const char *>(&header), header.HeaderLength());
+        frame.append(reinterpret_cast<const char *>(&sequence), sizeof(sequence));
+        wsocket::HandshakeInfo peer;
+        peer.reliable = true;
+        FeedSystemFrame(ctx, peer.Encode());
+        assert(ctx.Reliable());
+        ctx.Feed({reinterpret_cast<uint8_t *>(frame.data()), frame.size()});
+        assert(client.last_error == wsocket::Error::InvalidAckFrame && client.acks.empty());
+    }
+    // Close writes the queued messages the window and the flush budget allow, CloseNow() none; the
+    // ones left are reported
+    struct CloseCase {
+        bool   reliable;
+        size_t budget;
+        bool   now;
+        size_t delivered;
+    };
+    for(auto test : {CloseCase{true, SIZE_MAX, false, 2},
+                     CloseCase{false, 40, false, 1},
+                     CloseCase{false, SIZE_MAX, true, 0}}) {
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        AckLog                  client1;
+        AckLog                  client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+
+        if(test.reliable) {
+            wsocket::ReliableOptions options;
+            options.ack_delay = std::chrono::milliseconds(1000);
+            options.window    = 64;
+            ctx1.SetReliable(options);
+            ctx2.SetReliable(options);
+        }
+
+        wsocket::LoopbackPipe pipe(ctx1, ctx2);
+        ctx1.Handshake({}); // uncompressed, the window counts the payload bytes
+        pipe.Run();
+
+        uint8_t binary[40] = {};
+        ctx1.SetFlushBudget(0);
+        ctx1.SendBinary(1, {binary, sizeof(binary)});
+        ctx1.SendBinary(1, {binary, sizeof(binary)});
+        ctx1.SendBinary(1, {binary, sizeof(binary)});
+        assert(ctx1.PendingSendBytes() == 3 * sizeof(binary));
+        ctx1.SetFlushBudget(test.budget);
+        if(test.now) {
+            ctx1.CloseNow(wsocket::CloseCode::CLOSE_PROTOCOL_ERROR);
+        } else {
+            ctx1.Close(wsocket::CloseCode::CLOSE_NORMAL);
+        }
+        pipe.Run();
+        assert(ctx2.Metrics().Snapshot().frames_received[wsocket::FrameHeader::Binary] == test.delivered);
+        assert(ctx2.Metrics().Snapshot().frames_received[wsocket::FrameHeader::Close] == 1);
+        assert(ctx1.PendingSendBytes() == 0);
+        assert(client1.last_error == wsocket::Error::MessagesDropped);
+        auto snapshot = ctx1.Metrics().Snapshot();
+        assert(snapshot.send_queue_drops == 3 - test.delivered && snapshot.send_queue_frames == 0);
+    }
+    std::cout << "================== test_Reliable ==================" << std::endl;
+}
+
+// ctx1 writes into `wire` (FeedWire() hands it to ctx2 as one read), ctx2 answers ctx1 directly
+void ConnectThroughWire(wsocket::WSocketContext &ctx1, wsocket::WSocketContext &ctx2, std::string &wire) {
+    ctx1.ResetSendHandler(
+            [&](wsocket::Buffer buffer) { wire.append(reinterpret_cast<char *>(buffer.buf), buffer.size); });
+    ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+}
+void FeedWire(wsocket::WSocketContext &ctx, std::string &wire) {
+    std::string data;
+    std::swap(data, wire);
+    ctx.Feed({reinterpret_cast<uint8_t *>(data.data()), data.size()});
+}
+
+void test_RateLimit() {
+    std::cout << "================== test_RateLimit ==================" << std::endl;
+    {
+        // Drop: whole messages, fragmented ones included
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        NegotiatingClient       client1;
+        NegotiatingClient       client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        std::string wire;
+        ConnectThroughWire(ctx1, ctx2, wire);
+        ctx1.Handshake({wsocket::CompressType::None}); // byte limits count the payload on the wire
+        FeedWire(ctx2, wire);
+
+        wsocket::RateLimitOptions options;
+        options.messages_per_second = 1;
+        options.message_burst       = 5;
+        options.policy              = wsocket::RateLimitPolicy::Drop;
+        ctx2.SetRateLimit(options);
+        for(int i = 0; i < 5; ++i) {
+            ctx1.SendText("m");
+        }
+        ctx1.SendText("frag", false);
+        ctx1.SendText("ment");
+        ctx1.SendText("last");
+        FeedWire(ctx2, wire);
+        assert(client2.texts == 5 && client2.message == "mmmmm");
+        assert(ctx2.Metrics().Snapshot().rate_limit_drops == 2);
+
+        // the byte bucket lets a message through as long as it covers it
+        options.messages_per_second = 0;
+        options.bytes_per_second    = 100;
+        options.byte_burst          = 100;
+        ctx2.SetRateLimit(options);
+        std::string sixty(60, 'b');
+        for(int i = 0; i < 3; ++i) {
+            ctx1.SendText(sixty);
+        }
+        FeedWire(ctx2, wire);
+        assert(client2.texts == 6 && ctx2.Metrics().Snapshot().rate_limit_drops == 4);
+    }
+    {
+        // Drop in reliable mode pauses: an ack would report the dropped messages as delivered
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        NegotiatingClient       client1;
+        NegotiatingClient       client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        wsocket::ReliableOptions reliable;
+        reliable.ack_every = 1;
+        ctx1.SetReliable(reliable);
+        ctx2.SetReliable(reliable);
+        std::string wire;
+        ConnectThroughWire(ctx1, ctx2, wire);
+        ctx1.Handshake();
+        FeedWire(ctx2, wire);
+        assert(ctx1.Reliable() && ctx2.Reliable());
+
+        wsocket::RateLimitOptions options;
+        options.messages_per_second = 1;
+        options.message_burst       = 2;
+        options.policy              = wsocket::RateLimitPolicy::Drop;
+        ctx2.SetRateLimit(options);
+        for(int i = 0; i < 4; ++i) {
+            ctx1.SendText("r");
+        }
+        FeedWire(ctx2, wire);
+        assert(client2.texts == 2 && ctx2.ReceivePause() && ctx2.ReceiveBuffered() > 0);
+        assert(ctx1.SentSequence() == 4 && ctx1.AckedSequence() == 2);
+        assert(ctx2.Metrics().Snapshot().rate_limit_drops == 0 && ctx2.Metrics().Snapshot().rate_limit_pauses == 1);
+    }
+    {
+        // Close
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        NegotiatingClient       client1;
+        NegotiatingClient       client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        std::string wire;
+        ConnectThroughWire(ctx1, ctx2, wire);
+        ctx1.Handshake();
+        FeedWire(ctx2, wire);
+
+        wsocket::RateLimitOptions options;
+        options.messages_per_second = 1;
+        options.message_burst       = 2;
+        options.policy              = wsocket::RateLimitPolicy::Close;
+        ctx2.SetRateLimit(options);
+        for(int i = 0; i < 4; ++i) {
+            ctx1.SendText("c");
+        }
+        FeedWire(ctx2, wire);
+        assert(client2.texts == 2 && client2.last_error == wsocket::Error::RateLimitExceeded);
+        assert(client1.close_code == static_cast<int16_t>(wsocket::CloseCode::CLOSE_PROTOCOL_ERROR));
+        assert(ctx2.Metrics().Snapshot().rate_limit_closes == 1);
+    }
+    {
+        // Pause: the rest stays buffered until the transport resumes
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        NegotiatingClient       client1;
+        NegotiatingClient       client2;
+        ctx1.ResetListener(&client1);
+        ctx2.ResetListener(&client2);
+        std::string wire;
+        ConnectThroughWire(ctx1, ctx2, wire);
+        ctx1.Handshake();
+        FeedWire(ctx2, wire);
+
+        wsocket::RateLimitOptions options;
+        options.messages_per_second = 200;
+        options.message_burst       = 10;
+        ctx2.SetRateLimit(options);
+        for(int i = 0; i < 30; ++i) {
+            ctx1.SendText("p");
+        }
+        auto start = std::chrono::steady_clock::now();
+        FeedWire(ctx2, wire);
+        assert(client2.texts == 10 && ctx2.ReceivePause() && ctx2.ReceiveBuffered() > 0);
+        assert(ctx2.Metrics().Snapshot().rate_limit_paused == 1);
+
+        while(client2.texts < 30 && std::chrono::steady_clock::now() - start < std::chrono::seconds(2)) {
+            if(auto pause = ctx2.ReceivePause()) {
+                std::this_thread::sleep_for(*pause);
+            }
+            ctx2.ResumeReceive();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "30 messages at 200/s after a burst of 10: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << "ms, "
+                  << ctx2.Metrics().Snapshot().rate_limit_pauses << " pauses" << std::endl;
+        assert(client2.texts == 30 && client2.message == std::string(30, 'p'));
+        assert(elapsed >= std::chrono::milliseconds(80));
+        assert(ctx2.Metrics().Snapshot().rate_limit_pauses >= 2);
+    }
+    std::cout << "================== test_RateLimit ==================" << std::endl;
+}
+
+struct TypedPosition {
+    static constexpr uint16_t TYPE_ID = 1;
+    double                    x, y;
+    uint32_t                  tick;
+};
+struct TypedTrade {
+    static constexpr uint16_t TYPE_ID = 3;
+    uint64_t                  id;
+    int32_t                   quantity;
+    char                      side;
+};
+struct TypedSnapshot { // 16 bit length
+    static constexpr uint16_t TYPE_ID = 4;
+    uint32_t                  levels[100];
+};
+struct TypedBlob { // 64 bit length
+    static constexpr uint16_t TYPE_ID = 5;
+    uint64_t                  words[9000];
+};
+struct VendorQuote { // cannot be given a TYPE_ID
+    int32_t bid, ask;
+};
+namespace wsocket {
+template <>
+struct TypedMessage<VendorQuote> {
+    static constexpr uint16_t ID = 2;
+};
+} // namespace wsocket
+
+// The precomputed head matches what FrameHeader encodes at runtime
+template <typename T>
+void CheckTypedHead() {
+    using Layout = wsocket::TypedLayout<T>;
+    static_assert(Layout::HEAD_SIZE % alignof(T) == 0 && Layout::FRAME_SIZE % 8 == 0);
+
+    wsocket::FrameHeader header;
+    header.Type(wsocket::FrameHeader::Binary);
+    header.Finished(true);
+    header.Length(Layout::PAYLOAD_SIZE);
+    assert(static_cast<size_t>(header.HeaderLength()) == Layout::HEADER_SIZE);
+    assert(memcmp(&header, Layout::HEAD.data(), Layout::HEADER_SIZE) == 0);
+    assert(Layout::HEAD[Layout::HEADER_SIZE] == 0);
+    assert(Layout::HEAD[Layout::HEADER_SIZE + 1] == wsocket::TypedMessage<T>::ID);
+}
+
+class TypedReceiver : public NegotiatingClient {
+    using Dispatcher = wsocket::TypedDispatcher<TypedPosition, VendorQuote, TypedTrade, TypedSnapshot, TypedBlob>;
+
+public:
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        payload_ = buffer;
+        if(!Dispatcher::Dispatch(buffer, *this)) {
+            ++untyped;
+        }
+    }
+
+    void OnTyped(const TypedPosition &position) { this->Received(position, positions); }
+    void OnTyped(const VendorQuote &quote) { this->Received(quote, quotes); }
+    void OnTyped(const TypedTrade &trade) { this->Received(trade, trades); }
+    void OnTyped(const TypedSnapshot &snapshot) { this->Received(snapshot, snapshots); }
+    void OnTyped(const TypedBlob &blob) { this->Received(blob, blobs); }
+
+    std::vector<TypedPosition> positions;
+    std::vector<VendorQuote>   quotes;
+    std::vector<TypedTrade>    trades;
+    std::vector<TypedSnapshot> snapshots;
+    std::vector<TypedBlob>     blobs;
+    size_t                     untyped  = 0;
+    size_t                     in_place = 0; // read straight from the receive buffer
+
+private:
+    template <typename T>
+    void Received(const T &message, std::vector<T> &into) {
+        auto *at = reinterpret_cast<const uint8_t *>(&message);
+        assert(reinterpret_cast<uintptr_t>(at) % alignof(T) == 0);
+        in_place += at >= payload_.buf && at + sizeof(T) <= payload_.buf + payload_.size;
+        into.push_back(message);
+    }
+
+    wsocket::Buffer payload_;
+};
+
+void test_TypedChannel() {
+    std::cout << "================== test_TypedChannel ==================" << std::endl;
+    CheckTypedHead<TypedPosition>();
+    CheckTypedHead<VendorQuote>();
+    CheckTypedHead<TypedTrade>();
+    CheckTypedHead<TypedSnapshot>();
+    CheckTypedHead<TypedBlob>();
+    static_assert(wsocket::TypedLayout<TypedPosition>::HEAD_SIZE == 8);
+    static_assert(wsocket::TypedLayout<VendorQuote>::HEAD_SIZE == 8);
+    static_assert(wsocket::TypedLayout<TypedSnapshot>::HEADER_SIZE == 4);
+    static_assert(wsocket::TypedLayout<TypedBlob>::HEADER_SIZE == 10);
+
+    wsocket::WSocketContext ctx1;
+    wsocket::WSocketContext ctx2;
+    NegotiatingClient       client1;
+    TypedReceiver           client2;
+    ctx1.ResetListener(&client1);
+    ctx2.ResetListener(&client2);
+    std::string wire;
+    ConnectThroughWire(ctx1, ctx2, wire);
+    ctx1.Handshake();
+    FeedWire(ctx2, wire);
+
+    // typed frames keep each other aligned in the receive buffer: every struct is read in place
+    auto blob = std::make_unique<TypedBlob>();
+    for(size_t i = 0; i < std::size(blob->words); ++i) {
+        blob->words[i] = i * i;
+    }
+    TypedSnapshot snapshot{};
+    snapshot.levels[99] = 99;
+    for(uint32_t i = 0; i < 10; ++i) {
+        ctx1.SendTyped(TypedPosition{i * 1.5, -1.0 * i, i});
+        ctx1.SendTyped(VendorQuote{static_cast<int32_t>(i), static_cast<int32_t>(i) + 1});
+    }
+    ctx1.SendTyped(TypedTrade{42, -7, 'S'});
+    ctx1.SendTyped(snapshot);
+    ctx1.SendTyped(*blob);
+    FeedWire(ctx2, wire);
+    assert(client2.positions.size() == 10 && client2.quotes.size() == 10 && client2.untyped == 0);
+    for(uint32_t i = 0; i < 10; ++i) {
+        auto &position = client2.positions[i];
+        assert(position.x == i * 1.5 && position.y == -1.0 * i && position.tick == i);
+        auto &quote = client2.quotes[i];
+        assert(quote.bid == static_cast<int32_t>(i) && quote.ask == static_cast<int32_t>(i) + 1);
+    }
+    assert(client2.trades.size() == 1 && client2.trades[0].id == 42 && client2.trades[0].quantity == -7);
+    assert(client2.snapshots.size() == 1 && client2.snapshots[0].levels[99] == 99);
+    assert(client2.blobs.size() == 1 && memcmp(&client2.blobs[0], blob.get(), sizeof(TypedBlob)) == 0);
+    assert(client2.in_place == 23);
+    auto metrics = ctx1.Metrics().Snapshot();
+    assert(metrics.frames_sent[wsocket::FrameHeader::Binary] == 23);
+
+    // behind a frame of another size the struct is copied out; unknown ids and sizes are left alone
+    ctx1.SendBinary({reinterpret_cast<uint8_t *>(const_cast<char *>("odd")), 3});
+    ctx1.SendTyped(TypedPosition{1, 2, 3});
+    uint8_t unknown[] = {0, 9, 1, 2, 3, 4};
+    ctx1.SendBinary({unknown, sizeof(unknown)});
+    uint8_t short_quote[] = {0, 2, 1, 2, 3};
+    ctx1.SendBinary({short_quote, sizeof(short_quote)});
+    FeedWire(ctx2, wire);
+    assert(client2.positions.size() == 11 && client2.positions[10].tick == 3);
+    assert(client2.in_place == 23 && client2.untyped == 3);
+
+    // typed messages are not fragmented
+    ctx1.SetMaxFrameSize(64);
+    ctx1.SendTyped(snapshot);
+    assert(client1.last_error == wsocket::Error::PayloadTooLong && wire.empty());
+    std::cout << "================== test_TypedChannel ==================" << std::endl;
+}
+
+void test_Capture() {
+    std::cout << "================== test_Capture ==================" << std::endl;
+    const char *path = "wsocket_capture.wscap";
+    std::string big(4000, 'c');
+    {
+        // record what a client writes, in the records its transport would have seen
+        auto writer = wsocket::CaptureWriter::Open(path);
+        assert(writer);
+        auto id = writer->NewConnection();
+
+        wsocket::WSocketContext ctx;
+        ctx.ResetSendHandler([&](const wsocket::Buffer &data) {
+            writer->Append(id, wsocket::CaptureDirection::Sent, data.buf, data.size);
+        });
+        ctx.Handshake();
+        ctx.SendText("hello");
+        ctx.SendText(big);
+        writer->Append(id, wsocket::CaptureDirection::Received, reinterpret_cast<const uint8_t *>("x"), 1);
+    }
+
+    wsocket::CaptureReader reader;
+    assert(reader.Open(path) && reader.StartTimeNs() > 0);
+    for(int loop = 0; loop < 2; ++loop) {
+        // replayed into a fresh context, the stream decodes as it did live
+        wsocket::WSocketContext ctx;
+        NegotiatingClient       client;
+        ctx.ResetListener(&client);
+
+        wsocket::CaptureRecord record{};
+        std::vector<uint64_t>  times;
+        size_t                 sent = 0;
+        reader.Rewind();
+        while(reader.Next(record)) {
+            times.push_back(record.time_ns);
+            if(record.direction == wsocket::CaptureDirection::Sent) {
+                ++sent;
+                ctx.Feed(record.data);
+            }
+        }
+        assert(sent == 3 && times.size() == 4 && std::is_sorted(times.begin(), times.end()));
+        assert(client.message == "hello" + big && !client.last_error && !reader.Truncated());
+    }
+
+    // a capture cut off mid-record reads up to the last complete one
+    std::string bytes;
+    {
+        std::ifstream in(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), {});
+    }
+    std::ofstream(path, std::ios::binary) << bytes.substr(0, bytes.size() - 2);
+    assert(reader.Open(path));
+    wsocket::CaptureRecord record{};
+    size_t                 records = 0;
+    while(reader.Next(record)) {
+        ++records;
+    }
+    assert(records == 3 && reader.Truncated());
+    std::remove(path);
+    assert(!reader.Open(path));
+    std::cout << "================== test_Capture ==================" << std::endl;
+}
+
 #ifdef WITH_ASIO
 class TestWSocket : public wsocket::WSocket {
 protected:
@@ -457,6 +2053,564 @@ void test_asio_unix_wsocket() {
 }
 #endif
 
+#ifdef ASIO_HAS_CO_AWAIT
+asio::awaitable<void> awaitable_echo_server(asio::ip::tcp::acceptor &server) {
+    auto peer = co_await server.async_accept(asio::use_awaitable);
+    auto ws   = wsocket::AwaitableWSocket::Create(std::move(peer));
+    ws->Start();
+    while(true) {
+        auto msg = co_await ws->Read();
+        if(msg.error) {
+            std::cout << "server closed: " << msg.error.message() << std::endl;
+            break;
+        }
+        // delivered inline from the receive buffer
+        assert(!msg.Owned());
+        co_await ws->Send(msg.Text());
+    }
+}
+
+asio::awaitable<void> awaitable_echo_client(std::shared_ptr<wsocket::AwaitableWSocket> client,
+                                            asio::ip::tcp::endpoint                    endpoint) {
+    auto ec = co_await client->Handshake(endpoint);
+    assert(!ec);
+
+    for(int i = 0; i < 3; ++i) {
+        auto text = "hello " + std::to_string(i);
+        co_await client->Send(text);
+        auto msg = co_await client->Read();
+        assert(!msg.error);
+        std::cout << "echo: " << msg.Text() << std::endl;
+        assert(msg.Text() == text);
+    }
+    client->Close(wsocket::CloseCode::CLOSE_NORMAL);
+    auto msg = co_await client->Read();
+    assert(msg.error);
+}
+
+void test_awaitable_wsocket() {
+    std::cout << "================== test_awaitable_wsocket ==================" << std::endl;
+    asio::io_context io_executor;
+
+    using tcp = asio::ip::tcp;
+    tcp::acceptor server(io_executor, tcp::endpoint(asio::ip::tcp::v4(), 12001));
+    asio::co_spawn(io_executor, awaitable_echo_server(server), asio::detached);
+
+    auto client = wsocket::AwaitableWSocket::Create(asio::make_strand(io_executor));
+    asio::co_spawn(client->GetExecutor(),
+                   awaitable_echo_client(client, tcp::endpoint(asio::ip::make_address_v4("127.0.0.1"), 12001)),
+                   [&](std::exception_ptr) { io_executor.stop(); });
+
+    io_executor.run();
+    std::cout << "================== test_awaitable_wsocket ==================" << std::endl;
+}
+#endif
+
+#if defined(WITH_ASIO) && !defined(_WIN32)
+class FileReceiver : public wsocket::WSocket {
+    using wsocket::WSocket::WSocket;
+
+public:
+    static std::shared_ptr<FileReceiver> Create(asio::any_io_executor io_executor) {
+        return std::shared_ptr<FileReceiver>(new FileReceiver(std::move(io_executor)));
+    }
+    static std::shared_ptr<FileReceiver> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<FileReceiver>(new FileReceiver(std::move(socket)));
+    }
+
+    std::vector<std::string> messages;
+    size_t                   empty = 0; // MessageEmpty errors
+
+protected:
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        if(!open_) {
+            messages.emplace_back();
+        }
+        messages.back().append(reinterpret_cast<const char *>(buffer.buf), buffer.size);
+        open_ = !finish;
+    }
+    void OnError(std::error_code code) override {
+        std::cout << "OnError: " << code << " " << code.message() << std::endl;
+        empty += code == wsocket::Error::MessageEmpty;
+    }
+
+private:
+    bool open_ = false;
+};
+
+void test_SendFile() {
+    std::cout << "================== test_SendFile ==================" << std::endl;
+    const char *path = "wsocket_sendfile.bin";
+    std::string content(300 * 1024, 0);
+    for(size_t i = 0; i < content.size(); ++i) {
+        content[i] = static_cast<char>('a' + i % 26);
+    }
+    std::ofstream(path, std::ios::binary) << content;
+    int fd = ::open(path, O_RDONLY);
+    assert(fd >= 0);
+
+    asio::io_context        io_executor;
+    asio::ip::tcp::acceptor acceptor(io_executor, {asio::ip::tcp::v4(), 0});
+
+    std::shared_ptr<FileReceiver> server;
+    acceptor.async_accept([&](std::error_code ec, asio::ip::tcp::socket socket) {
+        server = FileReceiver::Create(std::move(socket));
+        server->Start();
+    });
+    auto client = FileReceiver::Create(asio::make_strand(io_executor));
+    client->Handshake({asio::ip::make_address_v4("127.0.0.1"), acceptor.local_endpoint().port()});
+
+    asio::steady_timer timer(io_executor);
+    timer.expires_after(std::chrono::milliseconds(100));
+    timer.async_wait([&](std::error_code) {
+        // the file goes out in three frames
+        client->SetMaxFrameSize(128 * 1024);
+        client->SendFile(fd, 0, content.size());
+        client->SendFile(fd, 100, 1000);
+        client->SendMapped({reinterpret_cast<uint8_t *>(content.data()), 4096});
+        // nothing to send, reported once
+        client->SendMapped({reinterpret_cast<uint8_t *>(content.data()), 0});
+
+        timer.expires_after(std::chrono::milliseconds(200));
+        timer.async_wait([&](std::error_code) { io_executor.stop(); });
+    });
+    io_executor.run();
+
+    assert(server && server->messages.size() == 3);
+    assert(server->messages[0] == content);
+    assert(server->messages[1] == content.substr(100, 1000));
+    assert(server->messages[2] == content.substr(0, 4096));
+    assert(client->empty == 1);
+    assert(client->GetMetrics().message_bytes_sent == content.size() + 1000 + 4096);
+
+    ::close(fd);
+    std::remove(path);
+    std::cout << "================== test_SendFile ==================" << std::endl;
+}
+#endif
+
+#ifdef WITH_ASIO
+class TextReceiver : public wsocket::WSocket {
+    using wsocket::WSocket::WSocket;
+
+public:
+    static std::shared_ptr<TextReceiver> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<TextReceiver>(new TextReceiver(std::move(socket)));
+    }
+
+    std::vector<std::string> texts;
+
+protected:
+    void OnText(std::string_view text, bool finish) override { texts.emplace_back(text); }
+};
+
+void test_ClientPool() {
+    std::cout << "================== test_ClientPool ==================" << std::endl;
+    asio::io_context        io_executor;
+    asio::ip::tcp::acceptor acceptor(io_executor, {asio::ip::tcp::v4(), 0});
+
+    std::vector<std::shared_ptr<TextReceiver>> servers;
+    std::function<void()>                      accept = [&] {
+        acceptor.async_accept([&](std::error_code ec, asio::ip::tcp::socket socket) {
+            if(ec) {
+                return;
+            }
+            servers.push_back(TextReceiver::Create(std::move(socket)));
+            servers.back()->Start();
+            accept();
+        });
+    };
+    accept();
+
+    asio::ip::tcp::endpoint   endpoint(asio::ip::make_address_v4("127.0.0.1"), acceptor.local_endpoint().port());
+    wsocket::WSocketClientPool pool(io_executor.get_executor(), endpoint, 2);
+    pool.Start();
+
+    auto run_for = [&](int ms) {
+        io_executor.restart();
+        io_executor.run_for(std::chrono::milliseconds(ms));
+    };
+    run_for(100);
+    auto stats = pool.Stats();
+    assert(stats.ready == 2 && stats.connects == 2 && stats.misses == 0);
+
+    // the connection with a backlog is skipped
+    auto busy = pool.Acquire();
+    busy->Text(std::string(256 * 1024, 'x'), true, wsocket::SendPriority::Bulk);
+    assert(busy->PendingSendBytes() > 0);
+    auto idle = pool.Acquire();
+    assert(idle && idle != busy);
+    assert(pool.Text("pooled"));
+    run_for(100);
+    size_t pooled = 0;
+    for(auto &server : servers) {
+        pooled += std::count(server->texts.begin(), server->texts.end(), "pooled");
+    }
+    assert(pooled == 1);
+
+    // a connection closed by the server is replaced
+    servers[0]->Close(wsocket::CloseCode::CLOSE_NORMAL);
+    run_for(200);
+    stats = pool.Stats();
+    assert(stats.ready == 2 && stats.connects == 3 && stats.failures == 1 && stats.hits == 3);
+
+    // nothing listening: every Acquire() misses while the pool keeps retrying
+    {
+        acceptor.close();
+        wsocket::WSocketClientPool dead(io_executor.get_executor(), endpoint, 1);
+        dead.Start();
+        run_for(50);
+        assert(!dead.Acquire() && !dead.Text("lost"));
+        auto dead_stats = dead.Stats();
+        assert(dead_stats.misses == 2 && dead_stats.ready == 0 && dead_stats.failures >= 1);
+    }
+    std::cout << "================== test_ClientPool ==================" << std::endl;
+}
+
+void test_PostFromThreads() {
+    std::cout << "================== test_PostFromThreads ==================" << std::endl;
+    asio::io_context        io_executor;
+    asio::ip::tcp::acceptor acceptor(io_executor, {asio::ip::tcp::v4(), 0});
+
+    std::shared_ptr<TextReceiver> server;
+    acceptor.async_accept([&](std::error_code ec, asio::ip::tcp::socket socket) {
+        assert(!ec);
+        server = TextReceiver::Create(std::move(socket));
+        server->Start();
+    });
+    auto client = wsocket::WSocket::Create(io_executor.get_executor());
+    client->Handshake({asio::ip::make_address_v4("127.0.0.1"), acceptor.local_endpoint().port()});
+    io_executor.run_for(std::chrono::milliseconds(100));
+
+    // producers push while the io thread drains into the connection
+    constexpr int PRODUCERS = 4;
+    constexpr int MESSAGES  = 2000;
+    io_executor.restart();
+    auto        work = asio::make_work_guard(io_executor);
+    std::thread io([&] { io_executor.run(); });
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < PRODUCERS; ++p) {
+        producers.emplace_back([&, p] {
+            for(int i = 0; i < MESSAGES; ++i) {
+                auto text = std::to_string(p) + ":" + std::to_string(i);
+                if(i % 100 == 0) {
+                    text.append(2 * 1024, ' '); // too large for the connection's cached blocks
+                }
+                client->PostText(text);
+            }
+        });
+    }
+    for(auto &producer : producers) {
+        producer.join();
+    }
+    client->PostClose(wsocket::CloseCode::CLOSE_NORMAL);
+    client->PostText("after close"); // dropped, the connection is closing
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    work.reset();
+    io_executor.stop();
+    io.join();
+
+    assert(server->texts.size() == PRODUCERS * MESSAGES);
+    std::vector<int> next(PRODUCERS, 0);
+    for(auto &text : server->texts) {
+        auto colon = text.find(':');
+        auto p     = std::stoi(text.substr(0, colon));
+        assert(std::stoi(text.substr(colon + 1)) == next[p]++);
+    }
+    auto metrics = client->GetMetrics();
+    assert(metrics.frames_sent[wsocket::FrameHeader::Close] == 1);
+    assert(metrics.frames_sent[wsocket::FrameHeader::Text] == PRODUCERS * MESSAGES);
+    assert(metrics.send_queue_drops == 1);
+    std::cout << "================== test_PostFromThreads ==================" << std::endl;
+}
+
+class SlowReceiver : public wsocket::WSocket {
+    using wsocket::WSocket::WSocket;
+
+public:
+    static std::shared_ptr<SlowReceiver> Create(asio::ip::tcp::socket &&socket) {
+        return std::shared_ptr<SlowReceiver>(new SlowReceiver(std::move(socket)));
+    }
+
+    std::vector<std::string> texts; // written by one handler at a time, read once `received` says all are in
+    std::atomic<size_t>      received{0};
+    std::atomic<int>         on_io_thread{0};
+
+    inline static std::atomic<int> running{0};
+    inline static std::atomic<int> max_running{0};
+    inline static std::thread::id  io_thread;
+
+protected:
+    void OnText(std::string_view text, bool finish) override {
+        auto now = ++running;
+        for(auto max = max_running.load(); now > max && !max_running.compare_exchange_weak(max, now);) {
+        }
+        on_io_thread += std::this_thread::get_id() == io_thread;
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+        texts.emplace_back(text);
+        --running;
+        ++received;
+    }
+};
+
+class RetainingClient : public wsocket::WSocketContext::Listener {
+public:
+    explicit RetainingClient(wsocket::WSocketContext &ctx) : ctx_(ctx) {}
+
+    void OnText(std::string_view text, bool finish) override {
+        auto *data = reinterpret_cast<uint8_t *>(const_cast<char *>(text.data()));
+        retained.push_back(ctx_.RetainPayload({data, text.size()}));
+    }
+
+    std::vector<wsocket::RetainedPayload> retained;
+
+private:
+    wsocket::WSocketContext &ctx_;
+};
+
+void test_WorkerPool() {
+    std::cout << "================== test_WorkerPool ==================" << std::endl;
+    {
+        // retained payloads survive the reads after them, frames split across reads included
+        wsocket::WSocketContext ctx1;
+        wsocket::WSocketContext ctx2;
+        RetainingClient         client(ctx2);
+        ctx2.ResetListener(&client);
+
+        std::string wire;
+        ctx1.ResetSendHandler(
+                [&](wsocket::Buffer buffer) { wire.append(reinterpret_cast<char *>(buffer.buf), buffer.size); });
+        ctx2.ResetSendHandler([&](wsocket::Buffer buffer) { ctx1.Feed(buffer); });
+        ctx1.Handshake();
+        ctx2.Feed({reinterpret_cast<uint8_t *>(wire.data()), wire.size()});
+        wire.clear();
+
+        for(int i = 0; i < 100; ++i) {
+            ctx1.SendText("message " + std::to_string(i));
+        }
+        for(size_t pos = 0; pos < wire.size(); pos += 37) {
+            auto len = std::min<size_t>(37, wire.size() - pos);
+            ctx2.Feed({reinterpret_cast<uint8_t *>(wire.data() + pos), len});
+        }
+        assert(client.retained.size() == 100);
+        for(int i = 0; i < 100; ++i) {
+            assert(client.retained[i].Text() == "message " + std::to_string(i));
+        }
+    }
+    {
+        // serial queues keep their order and never run a task twice at once
+        wsocket::WorkerPool pool(4);
+        constexpr int       QUEUES = 8;
+        constexpr int       TASKS  = 5000;
+
+        std::vector<std::shared_ptr<wsocket::SerialQueue>> queues;
+        std::vector<std::vector<int>>                      done(QUEUES);
+        std::vector<std::atomic<int>>                      busy(QUEUES);
+        for(int q = 0; q < QUEUES; ++q) {
+            queues.push_back(wsocket::SerialQueue::Create(pool));
+        }
+        std::vector<std::thread> producers;
+        for(int q = 0; q < QUEUES; ++q) {
+            producers.emplace_back([&, q] {
+                for(int i = 0; i < TASKS; ++i) {
+                    queues[q]->Post([&, q, i] {
+                        assert(busy[q]++ == 0);
+                        done[q].push_back(i);
+                        --busy[q];
+                    });
+                }
+            });
+        }
+        for(auto &producer : producers) {
+            producer.join();
+        }
+        while(std::any_of(queues.begin(), queues.end(), [](auto &queue) { return queue->Pending() > 0; })) {
+            std::this_thread::yield();
+        }
+        for(int q = 0; q < QUEUES; ++q) {
+            assert(done[q].size() == TASKS);
+            for(int i = 0; i < TASKS; ++i) {
+                assert(done[q][i] == i);
+            }
+        }
+    }
+
+    // servers hand their messages to the pool: in order per connection, in parallel across them
+    wsocket::WorkerPool     pool(4);
+    asio::io_context        io_executor;
+    asio::ip::tcp::acceptor acceptor(io_executor, {asio::ip::tcp::v4(), 0});
+    SlowReceiver::io_thread = std::this_thread::get_id();
+
+    constexpr int CLIENTS  = 3;
+    constexpr int MESSAGES = 200;
+
+    std::vector<std::shared_ptr<SlowReceiver>> servers;
+    std::function<void()>                      accept = [&] {
+        acceptor.async_accept([&](std::error_code ec, asio::ip::tcp::socket socket) {
+            assert(!ec);
+            auto server = SlowReceiver::Create(std::move(socket));
+            server->SetWorkerPool(&pool);
+            server->Start();
+            servers.push_back(server);
+            if(servers.size() < CLIENTS) {
+                accept();
+            }
+        });
+    };
+    accept();
+
+    std::vector<std::shared_ptr<wsocket::WSocket>> clients;
+    for(int c = 0; c < CLIENTS; ++c) {
+        clients.push_back(wsocket::WSocket::Create(io_executor.get_executor()));
+        clients.back()->Handshake({asio::ip::make_address_v4("127.0.0.1"), acceptor.local_endpoint().port()});
+    }
+    io_executor.run_for(std::chrono::milliseconds(100));
+    for(int c = 0; c < CLIENTS; ++c) {
+        for(int i = 0; i < MESSAGES; ++i) {
+            clients[c]->Text(std::to_string(c) + ":" + std::to_string(i));
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    while(std::chrono::steady_clock::now() - start < std::chrono::seconds(10)) {
+        io_executor.restart();
+        io_executor.run_for(std::chrono::milliseconds(20));
+        size_t received = 0;
+        for(auto &server : servers) {
+            received += server->received;
+        }
+        if(received == CLIENTS * MESSAGES) {
+            break;
+        }
+    }
+
+    assert(servers.size() == CLIENTS);
+    std::set<std::string> senders;
+    for(auto &server : servers) {
+        assert(server->texts.size() == MESSAGES && server->on_io_thread == 0);
+        auto sender = server->texts[0].substr(0, server->texts[0].find(':'));
+        for(int i = 0; i < MESSAGES; ++i) {
+            assert(server->texts[i] == sender + ":" + std::to_string(i));
+        }
+        senders.insert(sender);
+    }
+    assert(senders.size() == CLIENTS);
+    std::cout << "handlers in parallel: " << SlowReceiver::max_running << ", steals: " << pool.Steals() << std::endl;
+    assert(SlowReceiver::max_running > 1);
+    std::cout << "================== test_WorkerPool ==================" << std::endl;
+}
+
+class ShedClient : public wsocket::WSocket {
+    using wsocket::WSocket::WSocket;
+
+public:
+    static std::shared_ptr<ShedClient> Create(asio::any_io_executor io_executor) {
+        return std::shared_ptr<ShedClient>(new ShedClient(std::move(io_executor)));
+    }
+
+    int16_t close_code = 0;
+
+protected:
+    void OnClose(int16_t code, const std::string &reason) override { close_code = code; }
+};
+
+void test_LoopMonitor() {
+    std::cout << "================== test_LoopMonitor ==================" << std::endl;
+    asio::io_context        io_executor;
+    asio::ip::tcp::acceptor acceptor(io_executor, {asio::ip::tcp::v4(), 0});
+
+    wsocket::LoopMonitorOptions options;
+    options.interval     = std::chrono::milliseconds(20);
+    options.pause_accept = std::chrono::milliseconds(30);
+    options.skip_ping    = std::chrono::milliseconds(30);
+    options.shed         = std::chrono::milliseconds(30);
+    auto monitor         = wsocket::LoopMonitor::Create(io_executor.get_executor(), options);
+    monitor->Start();
+
+    // the n-th accepted connection sheds with priority n
+    std::vector<std::shared_ptr<TextReceiver>> servers;
+    std::function<void()>                      accept = [&] {
+        monitor->WhenAccepting([&] {
+            acceptor.async_accept([&](std::error_code ec, asio::ip::tcp::socket socket) {
+                if(ec) {
+                    return;
+                }
+                servers.push_back(TextReceiver::Create(std::move(socket)));
+                servers.back()->SetLoopMonitor(monitor, static_cast<int>(servers.size()) - 1);
+                servers.back()->Start();
+                servers.back()->SetKeepAliveExpiredTime(30);
+                accept();
+            });
+        });
+    };
+    accept();
+
+    asio::ip::tcp::endpoint endpoint(asio::ip::make_address_v4("127.0.0.1"), acceptor.local_endpoint().port());
+
+    std::vector<std::shared_ptr<ShedClient>> clients;
+    auto                                     connect = [&] {
+        clients.push_back(ShedClient::Create(io_executor.get_executor()));
+        clients.back()->Handshake(endpoint);
+    };
+    auto run_for = [&](int ms) {
+        io_executor.restart();
+        io_executor.run_for(std::chrono::milliseconds(ms));
+    };
+    for(int i = 0; i < 3; ++i) {
+        connect();
+    }
+    run_for(200);
+    auto idle = monitor->Snapshot();
+    assert(servers.size() == 3 && idle.probes > 0 && idle.accepting && !idle.skipping_pings);
+    assert(idle.connections_shed == 0 && idle.pings_skipped == 0);
+
+    // handlers blocking for 40ms keep the loop behind
+    bool                  busy = true;
+    std::function<void()> load = [&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(40));
+        if(busy) {
+            asio::post(io_executor, load);
+        }
+    };
+    asio::post(io_executor, load);
+    run_for(150);
+    // the accept pending since before the load takes the first, the second waits for the load to end
+    connect();
+    connect();
+    run_for(300);
+    auto loaded = monitor->Snapshot();
+    std::cout << "lag under load: " << loaded.lag_ns / 1000000 << "ms, max " << loaded.max_lag_ns / 1000000
+              << "ms, shed " << loaded.connections_shed << std::endl;
+    assert(loaded.lag_ns >= 30'000'000 && !loaded.accepting && loaded.skipping_pings);
+    assert(servers.size() == 4 && loaded.accepts_paused == 1);
+    assert(loaded.pings_skipped > 0 && loaded.connections_shed >= 1);
+
+    busy = false;
+    run_for(300);
+    auto after = monitor->Snapshot();
+    assert(after.lag_ns < 30'000'000 && after.accepting && !after.skipping_pings);
+    assert(servers.size() == 5);
+
+    // the lowest priorities went first
+    for(size_t i = 0; i < servers.size(); ++i) {
+        auto closes = servers[i]->GetMetrics().frames_sent[wsocket::FrameHeader::Close];
+        assert(closes == (i < after.connections_shed ? 1 : 0));
+    }
+    auto shed = std::count_if(clients.begin(), clients.end(), [](auto &client) {
+        return client->close_code == static_cast<int16_t>(wsocket::CloseCode::CLOSE_TRY_AGAIN_LATER);
+    });
+    assert(static_cast<uint64_t>(shed) == after.connections_shed);
+
+    auto text = wsocket::LoopLagToPrometheus(after, "loop=\"0\"");
+    assert(text.find("wsocket_loop_lag_seconds{loop=\"0\"}") != std::string::npos);
+    assert(text.find("wsocket_loop_accepts_paused_total{loop=\"0\"} 1") != std::string::npos);
+
+    monitor->Stop();
+    run_for(50);
+    std::cout << "================== test_LoopMonitor ==================" << std::endl;
+}
+#endif
+
 #ifdef WITH_ZSTD
 class TestZstdWSocket : public wsocket::WSocket {
 protected:
@@ -578,10 +2732,39 @@ int main() {
     try {
         testBasicHeader();
         testFrameHeader();
+        test_FrameScanner();
         test_SlidingBuffer();
         test_WSocketContext();
+        test_LoopbackPipe();
+        test_BasicWSocketContext();
+        test_Utf8();
+        test_Metrics();
+        test_Trace();
+        test_FramePool();
+        test_ReceiveBuffer();
+        test_Streams();
+        test_SendPriority();
+        test_Fragmentation();
+        test_Handshake();
+        test_Session();
+        test_Reliable();
+        test_RateLimit();
+        test_TypedChannel();
+        test_Capture();
+#if defined(WITH_ASIO) && !defined(_WIN32)
+        test_SendFile();
+#endif
+#ifdef WITH_ASIO
+        test_ClientPool();
+        test_PostFromThreads();
+        test_WorkerPool();
+        test_LoopMonitor();
+#endif
         // test_asio_wsocket();
         // test_asio_unix_wsocket();
+#ifdef ASIO_HAS_CO_AWAIT
+        test_awaitable_wsocket();
+#endif
         test_asio_wsocket_zstd();
     } catch(const std::exception &e) {
         std::cout << "exception: " << e.what() << std::endl;
@@ -0,0 +1,108 @@
+#pragma once
+#ifndef WSOCKET__TOOLS_HDR_HISTOGRAM_HPP
+#define WSOCKET__TOOLS_HDR_HISTOGRAM_HPP
+
+#include <cstdint>
+#include <vector>
+
+
+namespace wsocket {
+
+/**
+ * High dynamic range histogram of non-negative integer values (latencies in ns)
+ *
+ * Values keep 3 significant decimal digits over the whole range: values below 2048 are counted
+ * exactly, above that each power of two is split into 1024 linear sub-buckets. Recording is an
+ * index computation and one increment, percentiles walk the counters.
+ */
+class HdrHistogram {
+    static constexpr int      SUB_BUCKET_BITS = 10;
+    static constexpr uint64_t SUB_BUCKET_HALF = uint64_t{1} << SUB_BUCKET_BITS; // 1024
+    static constexpr int      MAX_BITS        = 48;                             // ~78 hours in ns
+
+public:
+    HdrHistogram() : counts_((MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_HALF, 0) {}
+
+    void Record(uint64_t value) {
+        ++counts_[Index(value)];
+        ++total_;
+        sum_ += value;
+        if(value > max_) {
+            max_ = value;
+        }
+        if(value < min_) {
+            min_ = value;
+        }
+    }
+
+    void Merge(const HdrHistogram &other) {
+        for(size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        max_ = other.max_ > max_ ? other.max_ : max_;
+        min_ = other.min_ < min_ ? other.min_ : min_;
+    }
+
+    void Reset() { *this = HdrHistogram(); }
+
+    uint64_t Count() const { return total_; }
+    uint64_t Max() const { return total_ ? max_ : 0; }
+    uint64_t Min() const { return total_ ? min_ : 0; }
+    double   Mean() const { return total_ ? static_cast<double>(sum_) / static_cast<double>(total_) : 0; }
+
+    // Smallest recorded value (bucket upper bound) with at least `percentile`% of values below or at it
+    uint64_t ValueAtPercentile(double percentile) const {
+        if(total_ == 0) {
+            return 0;
+        }
+        auto target = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(total_) + 0.5);
+        if(target == 0) {
+            target = 1;
+        }
+
+        uint64_t seen = 0;
+        for(size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if(seen >= target) {
+                auto value = HighestEquivalent(i);
+                return value < max_ ? value : max_;
+            }
+        }
+        return max_;
+    }
+
+private:
+    static size_t Index(uint64_t value) {
+        if(value < 2 * SUB_BUCKET_HALF) {
+            return static_cast<size_t>(value);
+        }
+        if(value >> MAX_BITS) {
+            value = (uint64_t{1} << MAX_BITS) - 1;
+        }
+        // shift so the value lands in [1024, 2048)
+        int shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS;
+        return static_cast<size_t>((shift + 1) * SUB_BUCKET_HALF + ((value >> shift) - SUB_BUCKET_HALF));
+    }
+
+    static uint64_t HighestEquivalent(size_t index) {
+        if(index < 2 * SUB_BUCKET_HALF) {
+            return index;
+        }
+        int      shift = static_cast<int>(index / SUB_BUCKET_HALF) - 1;
+        uint64_t sub   = index % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+        return ((sub + 1) << shift) - 1;
+    }
+
+private:
+    std::vector<uint64_t> counts_;
+    uint64_t              total_ = 0;
+    uint64_t              sum_   = 0;
+    uint64_t              max_   = 0;
+    uint64_t              min_   = UINT64_MAX;
+};
+
+} // namespace wsocket
+
+#endif // WSOCKET__TOOLS_HDR_HISTOGRAM_HPP
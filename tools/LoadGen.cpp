@@ -0,0 +1,449 @@
+/**
+ * wsocket_loadgen - load generator and echo server speaking the WSocket framing
+ *
+ *   server: wsocket_loadgen --server --tcp=127.0.0.1:9000 [--threads=2] [--compress]
+ *           wsocket_loadgen --server --uds=/tmp/wsocket.sock
+ *   client: wsocket_loadgen --tcp=127.0.0.1:9000 --connections=100 --threads=4 --size=128
+ *                           [--rate=1000] [--inflight=1] [--binary-ratio=0.5]
+ *                           [--duration=10] [--warmup=2]
+ *
+ * --rate is messages/s per connection on a fixed schedule (open loop, latency is measured from the
+ * scheduled send time so a stalled server is not hidden); without it every connection keeps
+ * --inflight messages outstanding and sends the next one on each echo (closed loop).
+ * Compression is chosen by the server (--compress), binary messages are not compressed by
+ * WSocketContext, so compressed connections send text only.
+ */
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "../include/ASIO_WSocket.hpp"
+#include "HdrHistogram.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+// every message starts with its send time, steady_clock ns as 16 hex digits (valid text)
+constexpr size_t STAMP_LEN = 16;
+
+struct Options {
+    bool        server = false;
+    std::string tcp;
+    std::string uds;
+
+    size_t threads      = 1;
+    size_t connections  = 1;
+    size_t size         = 128;
+    double rate         = 0; // per connection, 0 = closed loop
+    size_t inflight     = 1;
+    double binary_ratio = 0;
+    double duration     = 10;
+    double warmup       = 1;
+    bool   compress     = false;
+};
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now().time_since_epoch()).count();
+}
+
+void WriteStamp(char *dst, int64_t ns) {
+    static constexpr char digits[] = "0123456789abcdef";
+    auto                  v        = static_cast<uint64_t>(ns);
+    for(int i = STAMP_LEN - 1; i >= 0; --i) {
+        dst[i] = digits[v & 0xF];
+        v >>= 4;
+    }
+}
+
+bool ReadStamp(const char *src, size_t len, int64_t &ns) {
+    if(len < STAMP_LEN) {
+        return false;
+    }
+    uint64_t v   = 0;
+    auto     res = std::from_chars(src, src + STAMP_LEN, v, 16);
+    if(res.ec != std::errc() || res.ptr != src + STAMP_LEN) {
+        return false;
+    }
+    ns = static_cast<int64_t>(v);
+    return true;
+}
+
+// small messages must not wait for Nagle's algorithm
+template <typename Socket>
+void NoDelay(Socket &socket) {
+    if constexpr(std::is_same_v<Socket, asio::ip::tcp::socket>) {
+        asio::error_code ec;
+        std::ignore = socket.set_option(asio::ip::tcp::no_delay(true), ec);
+    }
+}
+
+// per io thread state, only touched by that thread until it is joined
+struct Worker {
+    asio::io_context                   io;
+    wsocket::HdrHistogram              latency;
+    uint64_t                           sent         = 0;
+    uint64_t                           received     = 0;
+    uint64_t                           bytes        = 0;
+    uint64_t                           errors       = 0;
+    int64_t                            measure_from = 0;
+    std::vector<std::shared_ptr<void>> sessions; // destroyed before io
+};
+
+
+//============ echo server ============//
+
+template <typename Protocol>
+class EchoSession : public wsocket::WSocketBase<Protocol> {
+    using base_type   = wsocket::WSocketBase<Protocol>;
+    using socket_type = typename Protocol::socket;
+
+    EchoSession(socket_type &&socket, bool compress) : base_type(std::move(socket)), compress_(compress) {}
+
+public:
+    static std::shared_ptr<EchoSession> Create(socket_type &&socket, bool compress) {
+        return std::shared_ptr<EchoSession>(new EchoSession(std::move(socket), compress));
+    }
+
+protected:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) override {
+        if(compress_) {
+            for(auto type : supported_compress_type) {
+                if(type != wsocket::CompressType::None) {
+                    return type;
+                }
+            }
+        }
+        return wsocket::CompressType::None;
+    }
+    void OnText(std::string_view text, bool finish) override { this->Text(text, finish); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { this->Binary(buffer, finish); }
+
+private:
+    bool compress_;
+};
+
+template <typename Protocol>
+void Accept(typename Protocol::acceptor &acceptor, std::vector<std::unique_ptr<Worker>> &workers, size_t next,
+            bool compress) {
+    auto &worker = *workers[next % workers.size()];
+    acceptor.async_accept(worker.io, [&acceptor, &workers, next, compress](asio::error_code ec,
+                                                                          typename Protocol::socket peer) {
+        if(ec) {
+            std::cerr << "accept: " << ec.message() << std::endl;
+            return;
+        }
+        NoDelay(peer);
+        EchoSession<Protocol>::Create(std::move(peer), compress)->Start();
+        Accept<Protocol>(acceptor, workers, next + 1, compress);
+    });
+}
+
+template <typename Protocol>
+int RunServer(const typename Protocol::endpoint &endpoint, const Options &opt) {
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(size_t i = 0; i < opt.threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    typename Protocol::acceptor acceptor(workers[0]->io, endpoint);
+    Accept<Protocol>(acceptor, workers, 0, opt.compress);
+    std::cout << "echo server listening, " << opt.threads << " thread(s)" << (opt.compress ? ", zstd" : "")
+              << std::endl;
+
+    std::vector<std::thread> threads;
+    for(auto &w : workers) {
+        threads.emplace_back([&w] {
+            auto guard = asio::make_work_guard(w->io);
+            w->io.run();
+        });
+    }
+    for(auto &t : threads) {
+        t.join();
+    }
+    return 0;
+}
+
+
+//============ load client ============//
+
+template <typename Protocol>
+class LoadClient : public wsocket::WSocketBase<Protocol> {
+    using base_type     = wsocket::WSocketBase<Protocol>;
+    using endpoint_type = typename Protocol::endpoint;
+
+    LoadClient(Worker &worker, const Options &opt, uint32_t seed) :
+        base_type(worker.io.get_executor()), worker_(worker), opt_(opt), timer_(this->GetExecutor()),
+        message_(std::max(opt.size, STAMP_LEN), 'x'), random_(seed) {}
+
+public:
+    static std::shared_ptr<LoadClient> Create(Worker &worker, const Options &opt, uint32_t seed) {
+        return std::shared_ptr<LoadClient>(new LoadClient(worker, opt, seed));
+    }
+
+protected:
+    void OnError(std::error_code code) override {
+        if(!failed_) {
+            failed_ = true;
+            ++worker_.errors;
+            std::cerr << "connection error: " << code.message() << std::endl;
+        }
+        timer_.cancel();
+    }
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) override {
+        // the server's reply carries its choice
+        auto type   = supported_compress_type.empty() ? wsocket::CompressType::None : supported_compress_type[0];
+        compressed_ = type != wsocket::CompressType::None;
+        NoDelay(this->GetSocket());
+
+        // the context is Connected once this returns
+        asio::post(this->GetExecutor(), [self = Self()] { self->Begin(); });
+        return type;
+    }
+    void OnClose(int16_t code, const std::string &reason) override { timer_.cancel(); }
+    void OnText(std::string_view text, bool finish) override { this->OnEcho(text.data(), text.size()); }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override {
+        this->OnEcho(reinterpret_cast<const char *>(buffer.buf), buffer.size);
+    }
+
+private:
+    std::shared_ptr<LoadClient> Self() {
+        return std::static_pointer_cast<LoadClient>(this->shared_from_this());
+    }
+
+    void Begin() {
+        start_ns_ = NowNs();
+        if(opt_.rate > 0) {
+            this->Tick();
+            return;
+        }
+        for(size_t i = 0; i < opt_.inflight; ++i) {
+            this->SendOne(NowNs());
+        }
+    }
+
+    // open loop: send everything scheduled up to now, stamped with its scheduled time
+    void Tick() {
+        auto elapsed = static_cast<double>(NowNs() - start_ns_) / 1e9;
+        auto due     = static_cast<uint64_t>(elapsed * opt_.rate) + 1; // message k is due at k / rate
+        while(scheduled_ < due && !failed_) {
+            auto at = start_ns_ + static_cast<int64_t>(static_cast<double>(scheduled_) * 1e9 / opt_.rate);
+            ++scheduled_;
+            this->SendOne(at);
+        }
+
+        auto interval = std::max(std::chrono::nanoseconds(1'000'000),
+                                 std::chrono::nanoseconds(static_cast<int64_t>(1e9 / opt_.rate)));
+        timer_.expires_at(timer_.expiry() + interval);
+        if(timer_.expiry() < clock_type::now()) {
+            timer_.expires_after(interval);
+        }
+        timer_.async_wait([self = Self()](std::error_code ec) {
+            if(!ec) {
+                self->Tick();
+            }
+        });
+    }
+
+    void SendOne(int64_t stamp_ns) {
+        WriteStamp(message_.data(), stamp_ns);
+        bool binary = !compressed_ && opt_.binary_ratio > 0 &&
+                      std::uniform_real_distribution<double>(0, 1)(random_) < opt_.binary_ratio;
+        if(binary) {
+            this->Binary({reinterpret_cast<uint8_t *>(message_.data()), message_.size()});
+        } else {
+            this->Text(message_);
+        }
+        ++worker_.sent;
+    }
+
+    void OnEcho(const char *data, size_t len) {
+        auto    now = NowNs();
+        int64_t stamp;
+        if(ReadStamp(data, len, stamp) && now >= worker_.measure_from) {
+            worker_.latency.Record(static_cast<uint64_t>(now - stamp));
+            ++worker_.received;
+            worker_.bytes += len;
+        }
+        if(opt_.rate <= 0 && !failed_) {
+            this->SendOne(now);
+        }
+    }
+
+private:
+    Worker            &worker_;
+    const Options     &opt_;
+    asio::steady_timer timer_;
+    std::string        message_;
+    std::minstd_rand   random_;
+
+    int64_t  start_ns_   = 0;
+    uint64_t scheduled_  = 0;
+    bool     compressed_ = false;
+    bool     failed_     = false;
+};
+
+template <typename Protocol>
+int RunClient(const typename Protocol::endpoint &endpoint, const Options &opt) {
+    std::vector<std::unique_ptr<Worker>> workers;
+    for(size_t i = 0; i < opt.threads; ++i) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+
+    auto measure_from = NowNs() + static_cast<int64_t>(opt.warmup * 1e9);
+    for(auto &w : workers) {
+        w->measure_from = measure_from;
+    }
+    for(size_t i = 0; i < opt.connections; ++i) {
+        auto &worker = *workers[i % workers.size()];
+        auto  client = LoadClient<Protocol>::Create(worker, opt, static_cast<uint32_t>(i + 1));
+        client->Handshake(endpoint);
+        worker.sessions.push_back(client);
+    }
+
+    std::vector<std::thread> threads;
+    for(auto &w : workers) {
+        threads.emplace_back([&w] {
+            auto guard = asio::make_work_guard(w->io);
+            w->io.run();
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(opt.warmup + opt.duration));
+    for(auto &w : workers) {
+        w->io.stop();
+    }
+    for(auto &t : threads) {
+        t.join();
+    }
+
+    wsocket::HdrHistogram latency;
+    uint64_t              sent = 0, received = 0, bytes = 0, errors = 0;
+    for(auto &w : workers) {
+        latency.Merge(w->latency);
+        sent += w->sent;
+        received += w->received;
+        bytes += w->bytes;
+        errors += w->errors;
+    }
+
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    std::printf("connections %zu, threads %zu, size %zu, %s\n",
+                opt.connections,
+                opt.threads,
+                std::max(opt.size, STAMP_LEN),
+                opt.rate > 0 ? "open loop" : "closed loop");
+    std::printf("sent %lu, echoed %lu (measured over %.1fs), errors %lu\n",
+                static_cast<unsigned long>(sent),
+                static_cast<unsigned long>(received),
+                opt.duration,
+                static_cast<unsigned long>(errors));
+    std::printf("throughput %.0f msg/s, %.2f MB/s\n",
+                static_cast<double>(received) / opt.duration,
+                static_cast<double>(bytes) / opt.duration / 1e6);
+    std::printf("latency us: min %.1f  mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+                us(latency.Min()),
+                latency.Mean() / 1000.0,
+                us(latency.ValueAtPercentile(50)),
+                us(latency.ValueAtPercentile(90)),
+                us(latency.ValueAtPercentile(99)),
+                us(latency.ValueAtPercentile(99.9)),
+                us(latency.Max()));
+
+    for(auto &w : workers) {
+        w->sessions.clear();
+    }
+    return errors == 0 ? 0 : 1;
+}
+
+
+//============ command line ============//
+
+bool ParseArgs(int argc, char **argv, Options &opt) {
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto        eq  = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string val = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if(key == "--server") {
+            opt.server = true;
+        } else if(key == "--compress") {
+            opt.compress = true;
+        } else if(key == "--tcp") {
+            opt.tcp = val;
+        } else if(key == "--uds") {
+            opt.uds = val;
+        } else if(key == "--threads") {
+            opt.threads = std::max<size_t>(1, std::stoul(val));
+        } else if(key == "--connections") {
+            opt.connections = std::stoul(val);
+        } else if(key == "--size") {
+            opt.size = std::stoul(val);
+        } else if(key == "--rate") {
+            opt.rate = std::stod(val);
+        } else if(key == "--inflight") {
+            opt.inflight = std::max<size_t>(1, std::stoul(val));
+        } else if(key == "--binary-ratio") {
+            opt.binary_ratio = std::stod(val);
+        } else if(key == "--duration") {
+            opt.duration = std::stod(val);
+        } else if(key == "--warmup") {
+            opt.warmup = std::stod(val);
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if(opt.tcp.empty() == opt.uds.empty()) {
+        std::cerr << "exactly one of --tcp=host:port or --uds=path is required" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    try {
+        if(!ParseArgs(argc, argv, opt)) {
+            return 2;
+        }
+
+        if(!opt.tcp.empty()) {
+            auto colon = opt.tcp.rfind(':');
+            if(colon == std::string::npos) {
+                std::cerr << "--tcp expects host:port" << std::endl;
+                return 2;
+            }
+            asio::ip::tcp::endpoint endpoint(asio::ip::make_address(opt.tcp.substr(0, colon)),
+                                             static_cast<uint16_t>(std::stoul(opt.tcp.substr(colon + 1))));
+            return opt.server ? RunServer<asio::ip::tcp>(endpoint, opt) : RunClient<asio::ip::tcp>(endpoint, opt);
+        }
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+        asio::local::stream_protocol::endpoint endpoint(opt.uds);
+        if(opt.server) {
+            std::remove(opt.uds.c_str());
+            return RunServer<asio::local::stream_protocol>(endpoint, opt);
+        }
+        return RunClient<asio::local::stream_protocol>(endpoint, opt);
+#else
+        std::cerr << "unix domain sockets are not supported on this platform" << std::endl;
+        return 2;
+#endif
+    } catch(const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,197 @@
+/**
+ * wsocket_replay - feed captured traffic (see include/Capture.hpp, WSocketBase::SetCapture) through
+ * WSocketContext without a network
+ *
+ *   wsocket_replay capture.wscap [--direction=received|sent] [--connection=N] [--timing] [--loops=N]
+ *
+ * Every captured connection gets its own WSocketContext and its records are fed in file order, each
+ * one as a single Feed() the way the transport delivered it, so parsing, decompression and listener
+ * dispatch run on the production byte stream. Records go back to back by default; with --timing
+ * each one waits for its original offset from the start of the capture.
+ *
+ * A stream starts with the peer's handshake: the context answers it into a discarding send handler
+ * and takes the first codec offered, compressed frames are flagged and decompressed as they were
+ * live. The listener reads every payload byte to stand in for application work.
+ */
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "../include/Capture.hpp"
+#include "../include/WSocketContext.hpp"
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+
+struct Options {
+    std::string               path;
+    wsocket::CaptureDirection direction  = wsocket::CaptureDirection::Received;
+    int64_t                   connection = -1; // all
+    bool                      timing     = false;
+    size_t                    loops      = 1;
+};
+
+class ReplayListener : public wsocket::WSocketContextListener, public wsocket::StreamListener {
+public:
+    wsocket::CompressType OnHandshake(const std::vector<wsocket::CompressType> &supported_compress_type) override {
+        return supported_compress_type.empty() ? wsocket::CompressType::None : supported_compress_type[0];
+    }
+    void OnError(std::error_code code) override { ++errors; }
+
+    void OnText(std::string_view text, bool finish) override {
+        this->Consume(reinterpret_cast<const uint8_t *>(text.data()), text.size(), finish);
+    }
+    void OnBinary(wsocket::Buffer buffer, bool finish) override { this->Consume(buffer.buf, buffer.size, finish); }
+    void OnText(uint32_t stream, std::string_view text, bool finish) override { this->OnText(text, finish); }
+    void OnBinary(uint32_t stream, wsocket::Buffer buffer, bool finish) override { this->OnBinary(buffer, finish); }
+
+    uint64_t messages = 0;
+    uint64_t bytes    = 0;
+    uint64_t errors   = 0;
+    uint64_t checksum = 0;
+
+private:
+    void Consume(const uint8_t *data, size_t len, bool finish) {
+        for(size_t i = 0; i < len; ++i) {
+            checksum += data[i];
+        }
+        bytes += len;
+        messages += finish;
+    }
+};
+
+struct Connection {
+    Connection() {
+        context.ResetListener(&listener);
+        context.ResetStreamListener(&listener);
+        context.ResetSendHandler([](const wsocket::Buffer &) {});
+    }
+
+    ReplayListener          listener;
+    wsocket::WSocketContext context;
+};
+
+int Replay(wsocket::CaptureReader &reader, const Options &opt) {
+    uint64_t                 records = 0, wire_bytes = 0, messages = 0, bytes = 0, errors = 0, checksum = 0;
+    size_t                   connection_count = 0;
+    wsocket::MetricsSnapshot metrics;
+
+    auto start = clock_type::now();
+    for(size_t loop = 0; loop < opt.loops; ++loop) {
+        std::map<uint32_t, std::unique_ptr<Connection>> connections;
+        reader.Rewind();
+
+        auto                  loop_start = clock_type::now();
+        wsocket::CaptureRecord record{};
+        while(reader.Next(record)) {
+            if(record.direction != opt.direction ||
+               (opt.connection >= 0 && record.connection != static_cast<uint64_t>(opt.connection))) {
+                continue;
+            }
+            auto &connection = connections[record.connection];
+            if(!connection) {
+                connection = std::make_unique<Connection>();
+            }
+            if(opt.timing) {
+                std::this_thread::sleep_until(loop_start + std::chrono::nanoseconds(record.time_ns));
+            }
+            connection->context.Feed(record.data);
+            ++records;
+            wire_bytes += record.data.size;
+        }
+
+        connection_count = connections.size();
+        for(auto &[id, connection] : connections) {
+            messages += connection->listener.messages;
+            bytes += connection->listener.bytes;
+            errors += connection->listener.errors;
+            checksum += connection->listener.checksum;
+            metrics += connection->context.Metrics().Snapshot();
+        }
+    }
+    auto seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+    std::printf("connections %zu, records %lu, loops %zu, %s\n",
+                connection_count,
+                static_cast<unsigned long>(records),
+                opt.loops,
+                opt.timing ? "original timing" : "as fast as possible");
+    std::printf("wire %.2f MB, messages %lu (%.2f MB), errors %lu, parse errors %lu, checksum %lx\n",
+                static_cast<double>(wire_bytes) / 1e6,
+                static_cast<unsigned long>(messages),
+                static_cast<double>(bytes) / 1e6,
+                static_cast<unsigned long>(errors),
+                static_cast<unsigned long>(metrics.parse_errors),
+                static_cast<unsigned long>(checksum));
+    std::printf("elapsed %.3fs: %.0f msg/s, %.2f MB/s wire\n",
+                seconds,
+                static_cast<double>(messages) / seconds,
+                static_cast<double>(wire_bytes) / seconds / 1e6);
+    std::printf("decompress %.3fs (%.2f MB -> %.2f MB)\n",
+                static_cast<double>(metrics.decompress_ns) / 1e9,
+                static_cast<double>(metrics.decompress_bytes_in) / 1e6,
+                static_cast<double>(metrics.decompress_bytes_out) / 1e6);
+    if(reader.Truncated()) {
+        std::printf("capture is truncated, replayed up to its last complete record\n");
+    }
+    return errors == 0 ? 0 : 1;
+}
+
+
+//============ command line ============//
+
+bool ParseArgs(int argc, char **argv, Options &opt) {
+    for(int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto        eq  = arg.find('=');
+        std::string key = arg.substr(0, eq);
+        std::string val = eq == std::string::npos ? "" : arg.substr(eq + 1);
+
+        if(key.rfind("--", 0) != 0 && opt.path.empty()) {
+            opt.path = arg;
+        } else if(key == "--direction" && (val == "received" || val == "sent")) {
+            opt.direction = val == "sent" ? wsocket::CaptureDirection::Sent : wsocket::CaptureDirection::Received;
+        } else if(key == "--connection") {
+            opt.connection = std::stol(val);
+        } else if(key == "--timing") {
+            opt.timing = true;
+        } else if(key == "--loops") {
+            opt.loops = std::max<size_t>(1, std::stoul(val));
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    if(opt.path.empty()) {
+        std::cerr << "usage: wsocket_replay capture.wscap [--direction=received|sent] [--connection=N] [--timing] "
+                     "[--loops=N]"
+                  << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options opt;
+    try {
+        if(!ParseArgs(argc, argv, opt)) {
+            return 2;
+        }
+        wsocket::CaptureReader reader;
+        if(!reader.Open(opt.path)) {
+            std::cerr << "cannot read capture " << opt.path << std::endl;
+            return 1;
+        }
+        return Replay(reader, opt);
+    } catch(const std::exception &e) {
+        std::cerr << "error: " << e.what() << std::endl;
+        return 1;
+    }
+}